@@ -1,17 +1,46 @@
 {
+    "variables": {
+        # Standalone benchmark tools, enable with:
+        # node-gyp configure -- -Dbuild_benchmarks=true
+        "build_benchmarks%": "false",
+        # Headless streaming server and its load test client, enable with:
+        # node-gyp configure -- -Dbuild_server=true
+        "build_server%": "false",
+        # Out-of-process inference host of the application, enable with:
+        # node-gyp configure -- -Dbuild_inference_host=true
+        "build_inference_host%": "false",
+        # whisper.cpp/src/whisper.cpp is compiled through cpp/whisper_ext.cc,
+        # which extends its internal API
+        "whisper_sources": [
+            "cpp/whisper_ext.cc",
+            "whisper.cpp/ggml/src/ggml.c",
+            "whisper.cpp/ggml/src/ggml-quants.c",
+            "whisper.cpp/ggml/src/ggml-aarch64.c",
+            "whisper.cpp/ggml/src/ggml-alloc.c",
+            "whisper.cpp/ggml/src/ggml-backend.c",
+            "whisper.cpp/src/whisper-mel.hpp",
+        ],
+        "engine_sources": [
+            "cpp/audio_file_reader.cc",
+            "cpp/audio_store.cc",
+            "cpp/flac_codec.cc",
+            "cpp/thread_scheduling.cc",
+            "cpp/transcription_cache.cc",
+            "cpp/trace_events.cc",
+            "cpp/session_recorder.cc",
+            "cpp/shared_model.cc",
+            "cpp/shm_audio_ring.cc",
+            "cpp/speculative_decoder.cc",
+            "cpp/stream_whisper.cc",
+        ],
+    },
     "targets": [
         {
             "target_name": "addon",
             "arch": ["arm64", "x64"],
             "sources": [
-                "whisper.cpp/src/whisper.cpp",
-                "whisper.cpp/ggml/src/ggml.c",
-                "whisper.cpp/ggml/src/ggml-quants.c",
-                "whisper.cpp/ggml/src/ggml-aarch64.c",
-                "whisper.cpp/ggml/src/ggml-alloc.c",
-                "whisper.cpp/ggml/src/ggml-backend.c",
-                "whisper.cpp/src/whisper-mel.hpp",
-                "cpp/stream_whisper.cc",
+                "<@(whisper_sources)",
+                "<@(engine_sources)",
                 "cpp/addon.cc",
             ],
             "cflags!": ["-fno-exceptions"],
@@ -74,7 +103,11 @@
                                 "-fno-rtti",
                                 "-DNDEBUG"
                             ],
-                            "OTHER_LDFLAGS": ["-framework Accelerate"],
+                            "OTHER_LDFLAGS": [
+                                "-framework Accelerate",
+                                "-framework AudioToolbox",
+                                "-framework CoreFoundation",
+                            ],
                         }
                     },
                 ],
@@ -119,7 +152,8 @@
                             "-fopenmp"
                         ],
                         "libraries": [
-                            "-lgomp"
+                            "-lgomp",
+                            "-lrt"
                         ],
                         "conditions": [
                             [
@@ -134,5 +168,178 @@
                 ]
             ],
         }
+    ],
+    "conditions": [
+        [
+            '(build_benchmarks=="true" or build_server=="true" or '
+            'build_inference_host=="true") and OS!="win"',
+            {
+                "targets": [
+                    {
+                        # Engine without the node-addon-api bindings, shared by
+                        # the benchmark, server and host executables.
+                        "target_name": "stt_engine",
+                        "type": "static_library",
+                        "sources": [
+                            "<@(whisper_sources)",
+                            "<@(engine_sources)",
+                        ],
+                        "include_dirs": [
+                            "cpp",
+                            "whisper.cpp",
+                            "whisper.cpp/include",
+                            "whisper.cpp/ggml/include",
+                        ],
+                        "direct_dependent_settings": {
+                            "include_dirs": [
+                                "cpp",
+                                "whisper.cpp/include",
+                                "whisper.cpp/ggml/include",
+                            ],
+                        },
+                        "cflags!": ["-fno-exceptions"],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags": ["-O3", "-DNDEBUG", "-D_GNU_SOURCE", "-fPIC"],
+                        "cflags_cc": ["-std=c++17", "-O3", "-DNDEBUG", "-D_GNU_SOURCE", "-fPIC"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                            "OTHER_CFLAGS": ["-DGGML_USE_ACCELERATE", "-O3", "-DNDEBUG"],
+                        },
+                        "link_settings": {
+                            "conditions": [
+                                ['OS=="mac"', {"libraries": [
+                                    "-framework Accelerate",
+                                    "-framework AudioToolbox",
+                                    "-framework CoreFoundation",
+                                ]}],
+                                ['OS=="linux"', {"libraries": ["-lpthread", "-lm", "-lrt"]}],
+                            ],
+                        },
+                    },
+                ]
+            },
+        ],
+        [
+            'build_benchmarks=="true" and OS!="win"',
+            {
+                "targets": [
+                    {
+                        "target_name": "stt_replay_bench",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "sources": [
+                            "cpp/bench/replay.cc",
+                            "cpp/bench/replay_bench.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                    {
+                        "target_name": "stt_microbench",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "sources": [
+                            "cpp/bench/replay.cc",
+                            "cpp/bench/microbench.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                    {
+                        "target_name": "stt_eval",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "sources": [
+                            "cpp/bench/replay.cc",
+                            "cpp/bench/eval_wer.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                ]
+            },
+        ],
+        [
+            'build_server=="true" and OS!="win"',
+            {
+                "targets": [
+                    {
+                        "target_name": "stt_server",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "sources": [
+                            "cpp/server/stream_protocol.cc",
+                            "cpp/server/stt_server.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                    {
+                        "target_name": "stt_load_client",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "include_dirs": ["cpp/bench"],
+                        "sources": [
+                            "cpp/bench/replay.cc",
+                            "cpp/server/stream_protocol.cc",
+                            "cpp/server/load_client.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                ]
+            },
+        ],
+        [
+            'build_inference_host=="true" and OS!="win"',
+            {
+                "targets": [
+                    {
+                        "target_name": "stt_host",
+                        "type": "executable",
+                        "dependencies": ["stt_engine"],
+                        "include_dirs": ["cpp/server"],
+                        "sources": [
+                            "cpp/server/stream_protocol.cc",
+                            "cpp/host/stt_host.cc",
+                        ],
+                        "cflags_cc!": ["-fno-exceptions"],
+                        "cflags_cc": ["-std=c++17", "-O3"],
+                        "xcode_settings": {
+                            "CLANG_CXX_LIBRARY": "libc++",
+                            "GCC_ENABLE_CPP_EXCEPTIONS": "YES",
+                            "MACOSX_DEPLOYMENT_TARGET": "14.5",
+                        },
+                    },
+                ]
+            },
+        ]
     ]
 }
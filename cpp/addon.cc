@@ -1,5 +1,8 @@
+#include "shm_audio_ring.h"
 #include "stream_whisper.h"
+#include "trace_events.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <napi.h>
 
@@ -15,6 +18,16 @@ private:
   Napi::Value AddAudioData(const Napi::CallbackInfo &info);
   Napi::Value ClearAudioData(const Napi::CallbackInfo &info);
   Napi::Value GetTranscribedText(const Napi::CallbackInfo &info);
+  Napi::Value GetMetrics(const Napi::CallbackInfo &info);
+  Napi::Value GetLatencyHistograms(const Napi::CallbackInfo &info);
+  Napi::Value StartTracing(const Napi::CallbackInfo &info);
+  Napi::Value StopTracing(const Napi::CallbackInfo &info);
+  Napi::Value StartSessionRecording(const Napi::CallbackInfo &info);
+  Napi::Value StopSessionRecording(const Napi::CallbackInfo &info);
+  Napi::Value StartAudioRetention(const Napi::CallbackInfo &info);
+  Napi::Value StopAudioRetention(const Napi::CallbackInfo &info);
+  Napi::Value GetUtteranceAudio(const Napi::CallbackInfo &info);
+  Napi::Value TranscribeUtterance(const Napi::CallbackInfo &info);
   Napi::Value TranscribeFileInput(const Napi::CallbackInfo &info);
   Napi::Value Reconfigure(const Napi::CallbackInfo &info);
   void Destroy(const Napi::CallbackInfo &info);
@@ -28,6 +41,18 @@ Napi::Object STTAddon::Init(Napi::Env env, Napi::Object exports) {
        InstanceMethod<&STTAddon::AddAudioData>("addAudioData"),
        InstanceMethod<&STTAddon::ClearAudioData>("clearAudioData"),
        InstanceMethod<&STTAddon::GetTranscribedText>("getTranscribedText"),
+       InstanceMethod<&STTAddon::GetMetrics>("getMetrics"),
+       InstanceMethod<&STTAddon::GetLatencyHistograms>(
+           "getLatencyHistograms"),
+       InstanceMethod<&STTAddon::StartTracing>("startTracing"),
+       InstanceMethod<&STTAddon::StopTracing>("stopTracing"),
+       InstanceMethod<&STTAddon::StartSessionRecording>(
+           "startSessionRecording"),
+       InstanceMethod<&STTAddon::StopSessionRecording>("stopSessionRecording"),
+       InstanceMethod<&STTAddon::StartAudioRetention>("startAudioRetention"),
+       InstanceMethod<&STTAddon::StopAudioRetention>("stopAudioRetention"),
+       InstanceMethod<&STTAddon::GetUtteranceAudio>("getUtteranceAudio"),
+       InstanceMethod<&STTAddon::TranscribeUtterance>("transcribeUtterance"),
        InstanceMethod<&STTAddon::TranscribeFileInput>("transcribeFileInput"),
        InstanceMethod<&STTAddon::Reconfigure>("reconfigure")});
 
@@ -70,6 +95,21 @@ whisper_configuration get_whisper_configuration(const Napi::CallbackInfo &info,
   return {language, static_cast<int>(n_threads)};
 }
 
+// Reads an optional integer option, keeps the given default when missing.
+void get_optional_int(const Napi::CallbackInfo &info,
+                      const Napi::Object &params, const char *key,
+                      int &value) {
+  if (!params.Has(key)) {
+    return;
+  }
+  if (!params.Get(key).IsNumber()) {
+    Napi::Error::New(info.Env(), std::string("Expected a number for ") + key)
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+  value = params.Get(key).As<Napi::Number>().Int32Value();
+}
+
 stream_configuration get_stream_configuration(const Napi::CallbackInfo &info,
                                               const Napi::Object &params) {
   if (!params.Get("trigger_ms").IsNumber()) {
@@ -80,8 +120,67 @@ stream_configuration get_stream_configuration(const Napi::CallbackInfo &info,
     throw -1;
   }
 
-  Napi::Number trigger_ms = params.Get("trigger_ms").As<Napi::Number>();
-  return {trigger_ms};
+  stream_configuration config;
+  config.trigger_ms = params.Get("trigger_ms").As<Napi::Number>().Int32Value();
+
+  // Optional adaptive pacing, enabled with the default bounds when missing
+  if (params.Has("adaptive_trigger")) {
+    if (!params.Get("adaptive_trigger").IsBoolean()) {
+      Napi::Error::New(info.Env(), "Expected a boolean for adaptive_trigger.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    config.is_adaptive = params.Get("adaptive_trigger").As<Napi::Boolean>();
+  }
+
+  get_optional_int(info, params, "min_trigger_ms", config.min_trigger_ms);
+  get_optional_int(info, params, "max_trigger_ms", config.max_trigger_ms);
+  get_optional_int(info, params, "min_window_ms", config.min_window_ms);
+  get_optional_int(info, params, "shed_partials_backlog_ms",
+                   config.shed_partials_backlog_ms);
+  get_optional_int(info, params, "drop_silence_backlog_ms",
+                   config.drop_silence_backlog_ms);
+  get_optional_int(info, params, "fallback_backlog_ms",
+                   config.fallback_backlog_ms);
+  get_optional_int(info, params, "n_draft_tokens", config.n_draft_tokens);
+
+  // Optional pipelining of encoder and decoder, disabled when missing
+  if (params.Has("pipelined")) {
+    if (!params.Get("pipelined").IsBoolean()) {
+      Napi::Error::New(info.Env(), "Expected a boolean for pipelined.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    config.is_pipelined = params.Get("pipelined").As<Napi::Boolean>();
+  }
+
+  // Optional refinement of finalized utterances, disabled when missing
+  if (params.Has("refinement")) {
+    if (!params.Get("refinement").IsBoolean()) {
+      Napi::Error::New(info.Env(), "Expected a boolean for refinement.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    config.is_refinement = params.Get("refinement").As<Napi::Boolean>();
+  }
+  get_optional_int(info, params, "refinement_beam_size",
+                   config.refinement_beam_size);
+
+  if (config.is_refinement && config.refinement_beam_size <= 0) {
+    Napi::Error::New(info.Env(), "Expected refinement_beam_size > 0.")
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+
+  if (config.min_trigger_ms <= 0 ||
+      config.min_trigger_ms > config.max_trigger_ms) {
+    Napi::Error::New(info.Env(),
+                     "Expected 0 < min_trigger_ms <= max_trigger_ms.")
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+
+  return config;
 }
 
 Napi::String get_whisper_model_path(const Napi::CallbackInfo &info,
@@ -109,6 +208,70 @@ Napi::Boolean get_dictation_mode(const Napi::CallbackInfo &info,
   return is_word_level_mode;
 }
 
+// Optional secondary model path, e.g. the fallback model which is used while
+// the engine is overloaded. Returns an empty string when not configured.
+std::string get_optional_model_path(const Napi::CallbackInfo &info,
+                                    const Napi::Object &params,
+                                    const char *key) {
+  if (!params.Has(key)) {
+    return "";
+  }
+  if (!params.Get(key).IsString()) {
+    Napi::Error::New(info.Env(), std::string("Expected a string for ") + key)
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+  return params.Get(key).As<Napi::String>();
+}
+
+// Optional thread scheduling options of the inference worker. Missing keys
+// keep the default scheduling of the operating system.
+scheduling_configuration
+get_scheduling_configuration(const Napi::CallbackInfo &info,
+                             const Napi::Object &params) {
+  scheduling_configuration config;
+
+  if (params.Has("cpu_affinity")) {
+    if (!params.Get("cpu_affinity").IsArray()) {
+      Napi::Error::New(info.Env(),
+                       "Expected an array of core ids for cpu_affinity.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    Napi::Array cpu_affinity = params.Get("cpu_affinity").As<Napi::Array>();
+    for (uint32_t i = 0; i < cpu_affinity.Length(); i++) {
+      if (!cpu_affinity.Get(i).IsNumber()) {
+        Napi::Error::New(info.Env(),
+                         "Expected a number as core id in cpu_affinity.")
+            .ThrowAsJavaScriptException();
+        throw -1;
+      }
+      config.cpu_affinity.push_back(
+          cpu_affinity.Get(i).As<Napi::Number>().Int32Value());
+    }
+  }
+
+  if (params.Has("nice")) {
+    if (!params.Get("nice").IsNumber()) {
+      Napi::Error::New(info.Env(), "Expected a number for nice.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    config.nice = params.Get("nice").As<Napi::Number>().Int32Value();
+  }
+
+  if (params.Has("realtime_priority")) {
+    if (!params.Get("realtime_priority").IsBoolean()) {
+      Napi::Error::New(info.Env(), "Expected a boolean for realtime_priority.")
+          .ThrowAsJavaScriptException();
+      throw -1;
+    }
+    config.realtime = params.Get("realtime_priority").As<Napi::Boolean>();
+  }
+
+  return config;
+}
+
 STTAddon::STTAddon(const Napi::CallbackInfo &info)
     : Napi::ObjectWrap<STTAddon>(info) {
   if (info.Length() <= 0 || !info[0].IsObject()) {
@@ -125,9 +288,41 @@ STTAddon::STTAddon(const Napi::CallbackInfo &info)
   whisper_configuration whisper_config =
       get_whisper_configuration(info, params);
   stream_configuration stream_config = get_stream_configuration(info, params);
+  scheduling_configuration sched_config =
+      get_scheduling_configuration(info, params);
+  std::string fallback_model_path =
+      get_optional_model_path(info, params, "fallback_model_path");
+  std::string partial_model_path =
+      get_optional_model_path(info, params, "partial_model_path");
+  std::string draft_model_path =
+      get_optional_model_path(info, params, "draft_model_path");
+  std::string refinement_model_path =
+      get_optional_model_path(info, params, "refinement_model_path");
   instance = new SpeechToTextEngine(model_path, whisper_config.language,
                                     whisper_config.n_threads,
                                     stream_config.trigger_ms, false);
+  instance->SetStreamConfiguration(stream_config);
+  if (!fallback_model_path.empty() &&
+      !instance->SetFallbackModel(fallback_model_path)) {
+    fprintf(stderr, "failed to load fallback model '%s'\n",
+            fallback_model_path.c_str());
+  }
+  if (!partial_model_path.empty() &&
+      !instance->SetPartialModel(partial_model_path)) {
+    fprintf(stderr, "failed to load partial model '%s'\n",
+            partial_model_path.c_str());
+  }
+  if (!draft_model_path.empty() &&
+      !instance->SetDraftModel(draft_model_path)) {
+    fprintf(stderr, "failed to load draft model '%s'\n",
+            draft_model_path.c_str());
+  }
+  if (!refinement_model_path.empty() &&
+      !instance->SetRefinementModel(refinement_model_path)) {
+    fprintf(stderr, "failed to load refinement model '%s'\n",
+            refinement_model_path.c_str());
+  }
+  instance->SetSchedulingConfiguration(sched_config);
 }
 
 Napi::Value STTAddon::AddAudioData(const Napi::CallbackInfo &info) {
@@ -168,15 +363,202 @@ Napi::Value STTAddon::GetTranscribedText(const Napi::CallbackInfo &info) {
     Napi::Object js_segment = Napi::Object::New(env);
     js_segment.Set("text", segment.text);
     js_segment.Set("isPartial", segment.is_partial);
+    js_segment.Set("utteranceId", (double)segment.utterance_id);
     js_segments.Set(i, js_segment);
   }
 
+  // Refined texts of earlier finals, keyed by their utterance id
+  std::vector<segment_update> updates = instance->GetSegmentUpdates();
+  Napi::Array js_updates = Napi::Array::New(env, updates.size());
+  for (int i = 0; i < (int)updates.size(); i++) {
+    Napi::Object js_update = Napi::Object::New(env);
+    js_update.Set("utteranceId", (double)updates[i].utterance_id);
+    js_update.Set("text", updates[i].text);
+    js_update.Set("previousText", updates[i].previous_text);
+    js_updates.Set(i, js_update);
+  }
+
   Napi::Object js_payload = Napi::Object::New(env);
   js_payload.Set("segments", js_segments);
+  js_payload.Set("updates", js_updates);
 
   return js_payload;
 }
 
+Napi::Value STTAddon::GetMetrics(const Napi::CallbackInfo &info) {
+  std::vector<iteration_metrics> iterations;
+  iterations = instance->GetIterationMetrics();
+
+  Napi::Env env = info.Env();
+  Napi::Array js_iterations = Napi::Array::New(env, iterations.size());
+
+  double inference_ms = 0.0;
+  double audio_ms = 0.0;
+  for (int i = 0; i < (int)iterations.size(); i++) {
+    const iteration_metrics &metrics = iterations[i];
+    Napi::Object js_metrics = Napi::Object::New(env);
+    js_metrics.Set("queueWaitMs", metrics.queue_wait_ms);
+    js_metrics.Set("melMs", metrics.mel_ms);
+    js_metrics.Set("encodeMs", metrics.encode_ms);
+    js_metrics.Set("decodeMs", metrics.decode_ms);
+    js_metrics.Set("inferenceMs", metrics.inference_ms);
+    js_metrics.Set("nTokens", metrics.n_tokens);
+    js_metrics.Set("audioMs", metrics.audio_ms);
+    js_metrics.Set("rtf", metrics.rtf);
+    js_metrics.Set("triggerMs", metrics.trigger_ms);
+    js_metrics.Set("windowMs", metrics.window_ms);
+    js_metrics.Set("nDraftProposed", metrics.n_draft_proposed);
+    js_metrics.Set("nDraftAccepted", metrics.n_draft_accepted);
+    js_iterations.Set(i, js_metrics);
+
+    inference_ms += metrics.inference_ms;
+    audio_ms += metrics.audio_ms;
+  }
+
+  Napi::Object js_payload = Napi::Object::New(env);
+  js_payload.Set("iterations", js_iterations);
+  // Real-time factor over all returned iterations
+  js_payload.Set("rtf", audio_ms > 0.0 ? inference_ms / audio_ms : 0.0);
+
+  // Counters of the overload policies since the engine was created
+  const load_shedding_counters counters = instance->GetLoadSheddingCounters();
+  Napi::Object js_load_shedding = Napi::Object::New(env);
+  js_load_shedding.Set("partialsSkipped", (double)counters.partials_skipped);
+  js_load_shedding.Set("silenceDroppedMs", counters.silence_dropped_ms);
+  js_load_shedding.Set("fallbackIterations",
+                       (double)counters.fallback_iterations);
+  js_payload.Set("loadShedding", js_load_shedding);
+
+  return js_payload;
+}
+
+Napi::Object latency_summary_to_js(Napi::Env env,
+                                   const latency_summary &summary) {
+  Napi::Object js_summary = Napi::Object::New(env);
+  js_summary.Set("count", (double)summary.count);
+  js_summary.Set("p50Ms", summary.p50_ms);
+  js_summary.Set("p95Ms", summary.p95_ms);
+  js_summary.Set("p99Ms", summary.p99_ms);
+  js_summary.Set("maxMs", summary.max_ms);
+  return js_summary;
+}
+
+Napi::Value STTAddon::GetLatencyHistograms(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+  Napi::Object js_payload = Napi::Object::New(env);
+  latency_summary partial = instance->GetLatencySummary(true);
+  latency_summary final = instance->GetLatencySummary(false);
+  js_payload.Set("partial", latency_summary_to_js(env, partial));
+  js_payload.Set("final", latency_summary_to_js(env, final));
+  return js_payload;
+}
+
+Napi::Value STTAddon::StartTracing(const Napi::CallbackInfo &info) {
+  trace_start();
+  return Napi::Number::New(info.Env(), 1);
+}
+
+// Stops tracing and writes the recorded spans as Chrome trace_event JSON to the
+// given file path.
+Napi::Value STTAddon::StopTracing(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::Error::New(info.Env(), "Expected a String as first argument")
+        .ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), 0);
+  }
+
+  std::string trace_path = info[0].As<Napi::String>();
+  trace_stop();
+  bool is_written = trace_write(trace_path);
+
+  return Napi::Number::New(info.Env(), is_written ? 1 : 0);
+}
+
+// Captures the audio input of the session into the given log file
+Napi::Value STTAddon::StartSessionRecording(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsString()) {
+    Napi::Error::New(info.Env(), "Expected a String as first argument")
+        .ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), 0);
+  }
+
+  std::string log_path = info[0].As<Napi::String>();
+  bool is_started = instance->StartSessionRecording(log_path);
+
+  return Napi::Number::New(info.Env(), is_started ? 1 : 0);
+}
+
+Napi::Value STTAddon::StopSessionRecording(const Napi::CallbackInfo &info) {
+  instance->StopSessionRecording();
+  return Napi::Number::New(info.Env(), 1);
+}
+
+Napi::Value STTAddon::StartAudioRetention(const Napi::CallbackInfo &info) {
+  if (info.Length() < 2 || !info[0].IsString() || !info[1].IsNumber()) {
+    Napi::Error::New(info.Env(),
+                     "Expected a directory and the retained seconds")
+        .ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), 0);
+  }
+
+  std::string directory = info[0].As<Napi::String>();
+  int max_seconds = info[1].As<Napi::Number>().Int32Value();
+  bool is_started = instance->StartAudioRetention(directory, max_seconds);
+
+  return Napi::Number::New(info.Env(), is_started ? 1 : 0);
+}
+
+Napi::Value STTAddon::StopAudioRetention(const Napi::CallbackInfo &info) {
+  instance->StopAudioRetention();
+  return Napi::Number::New(info.Env(), 1);
+}
+
+// Returns the retained audio of an utterance as Float32Array, or null
+Napi::Value STTAddon::GetUtteranceAudio(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::Error::New(info.Env(), "Expected an utterance id")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  const uint64_t utterance_id = info[0].As<Napi::Number>().Int64Value();
+  std::vector<float> pcmf32;
+  if (!instance->GetUtteranceAudio(utterance_id, pcmf32)) {
+    return info.Env().Null();
+  }
+
+  Napi::Float32Array samples =
+      Napi::Float32Array::New(info.Env(), pcmf32.size());
+  std::copy(pcmf32.begin(), pcmf32.end(), samples.Data());
+  return samples;
+}
+
+Napi::Value STTAddon::TranscribeUtterance(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsNumber()) {
+    Napi::Error::New(info.Env(), "Expected an utterance id")
+        .ThrowAsJavaScriptException();
+    return info.Env().Null();
+  }
+
+  const uint64_t utterance_id = info[0].As<Napi::Number>().Int64Value();
+  std::vector<transcribed_segment> segments =
+      instance->TranscribeUtterance(utterance_id);
+
+  Napi::Env env = info.Env();
+  Napi::Array js_segments = Napi::Array::New(env, segments.size());
+  for (int i = 0; i < (int)segments.size(); i++) {
+    Napi::Object js_segment = Napi::Object::New(env);
+    js_segment.Set("text", segments[i].text);
+    js_segment.Set("isPartial", segments[i].is_partial);
+    js_segment.Set("utteranceId", (double)segments[i].utterance_id);
+    js_segments.Set(i, js_segment);
+  }
+
+  Napi::Object js_payload = Napi::Object::New(env);
+  js_payload.Set("segments", js_segments);
+  return js_payload;
+}
+
 Napi::Value STTAddon::TranscribeFileInput(const Napi::CallbackInfo &info) {
   if (info.Length() < 1 || !info[0].IsString()) {
     Napi::Error::New(info.Env(), "Expected a String as first argument")
@@ -184,9 +566,20 @@ Napi::Value STTAddon::TranscribeFileInput(const Napi::CallbackInfo &info) {
     return Napi::Number::New(info.Env(), 1);
   }
 
+  // Optional directory of the transcription cache
+  std::string cache_directory;
+  if (info.Length() >= 2 && !info[1].IsUndefined()) {
+    if (!info[1].IsString()) {
+      Napi::Error::New(info.Env(), "Expected a String as cache directory")
+          .ThrowAsJavaScriptException();
+      return Napi::Number::New(info.Env(), 1);
+    }
+    cache_directory = info[1].As<Napi::String>();
+  }
+
   std::vector<transcribed_segment> segments;
   Napi::String file_path = info[0].As<Napi::String>();
-  segments = instance->TranscribeFileInput(file_path);
+  segments = instance->TranscribeFileInput(file_path, cache_directory);
 
   Napi::Env env = info.Env();
   Napi::Array js_segments = Napi::Array::New(env, segments.size());
@@ -196,6 +589,7 @@ Napi::Value STTAddon::TranscribeFileInput(const Napi::CallbackInfo &info) {
     Napi::Object js_segment = Napi::Object::New(env);
     js_segment.Set("text", segment.text);
     js_segment.Set("isPartial", segment.is_partial);
+    js_segment.Set("utteranceId", (double)segment.utterance_id);
     js_segments.Set(i, js_segment);
     i++;
   }
@@ -251,6 +645,16 @@ Napi::Value STTAddon::Reconfigure(const Napi::CallbackInfo &info) {
   whisper_configuration whisper_config =
       get_whisper_configuration(info, params);
   stream_configuration stream_config = get_stream_configuration(info, params);
+  scheduling_configuration sched_config =
+      get_scheduling_configuration(info, params);
+  std::string fallback_model_path =
+      get_optional_model_path(info, params, "fallback_model_path");
+  std::string partial_model_path =
+      get_optional_model_path(info, params, "partial_model_path");
+  std::string draft_model_path =
+      get_optional_model_path(info, params, "draft_model_path");
+  std::string refinement_model_path =
+      get_optional_model_path(info, params, "refinement_model_path");
 
   if (instance) {
     instance->~SpeechToTextEngine();
@@ -259,12 +663,106 @@ Napi::Value STTAddon::Reconfigure(const Napi::CallbackInfo &info) {
   instance = new SpeechToTextEngine(model_path, whisper_config.language,
                                     whisper_config.n_threads,
                                     stream_config.trigger_ms, false);
+  instance->SetStreamConfiguration(stream_config);
+  if (!fallback_model_path.empty() &&
+      !instance->SetFallbackModel(fallback_model_path)) {
+    fprintf(stderr, "failed to load fallback model '%s'\n",
+            fallback_model_path.c_str());
+  }
+  if (!partial_model_path.empty() &&
+      !instance->SetPartialModel(partial_model_path)) {
+    fprintf(stderr, "failed to load partial model '%s'\n",
+            partial_model_path.c_str());
+  }
+  if (!draft_model_path.empty() &&
+      !instance->SetDraftModel(draft_model_path)) {
+    fprintf(stderr, "failed to load draft model '%s'\n",
+            draft_model_path.c_str());
+  }
+  if (!refinement_model_path.empty() &&
+      !instance->SetRefinementModel(refinement_model_path)) {
+    fprintf(stderr, "failed to load refinement model '%s'\n",
+            refinement_model_path.c_str());
+  }
+  instance->SetSchedulingConfiguration(sched_config);
+
+  return Napi::Number::New(info.Env(), 1);
+}
+
+// Producer side of the shared memory audio ring of the inference host, see
+// shm_audio_ring.h and src/utils/inferenceHost.ts.
+class SharedAudioRing : public Napi::ObjectWrap<SharedAudioRing> {
+public:
+  static void Init(Napi::Env env, Napi::Object exports);
+  SharedAudioRing(const Napi::CallbackInfo &info);
+
+private:
+  shm_audio_ring ring;
+  Napi::Value Write(const Napi::CallbackInfo &info);
+  Napi::Value Position(const Napi::CallbackInfo &info);
+  Napi::Value DroppedSamples(const Napi::CallbackInfo &info);
+  Napi::Value Close(const Napi::CallbackInfo &info);
+};
+
+void SharedAudioRing::Init(Napi::Env env, Napi::Object exports) {
+  Napi::Function func = DefineClass(
+      env, "SharedAudioRing",
+      {InstanceMethod<&SharedAudioRing::Write>("write"),
+       InstanceMethod<&SharedAudioRing::Position>("position"),
+       InstanceMethod<&SharedAudioRing::DroppedSamples>("droppedSamples"),
+       InstanceMethod<&SharedAudioRing::Close>("close")});
+  exports.Set("SharedAudioRing", func);
+}
+
+SharedAudioRing::SharedAudioRing(const Napi::CallbackInfo &info)
+    : Napi::ObjectWrap<SharedAudioRing>(info) {
+  if (info.Length() < 2 || !info[0].IsString() || !info[1].IsNumber()) {
+    Napi::Error::New(info.Env(),
+                     "Expected a ring name and a capacity in samples.")
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+
+  const std::string name = info[0].As<Napi::String>();
+  const int64_t capacity = info[1].As<Napi::Number>().Int64Value();
+  if (capacity <= 0 || !ring.create(name, capacity)) {
+    Napi::Error::New(info.Env(), "Failed to create the shared audio ring.")
+        .ThrowAsJavaScriptException();
+    throw -1;
+  }
+}
+
+// Returns the number of written samples, the rest is dropped when the host
+// does not keep up.
+Napi::Value SharedAudioRing::Write(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsTypedArray() ||
+      info[0].As<Napi::TypedArray>().TypedArrayType() != napi_float32_array) {
+    Napi::Error::New(info.Env(), "Expected a Float32Array")
+        .ThrowAsJavaScriptException();
+    return Napi::Number::New(info.Env(), 0);
+  }
+
+  Napi::Float32Array samples = info[0].As<Napi::Float32Array>();
+  const size_t n_written = ring.write(samples.Data(), samples.ElementLength());
+  return Napi::Number::New(info.Env(), (double)n_written);
+}
+
+Napi::Value SharedAudioRing::Position(const Napi::CallbackInfo &info) {
+  return Napi::Number::New(info.Env(), (double)ring.write_position());
+}
+
+Napi::Value SharedAudioRing::DroppedSamples(const Napi::CallbackInfo &info) {
+  return Napi::Number::New(info.Env(), (double)ring.dropped_samples());
+}
 
+Napi::Value SharedAudioRing::Close(const Napi::CallbackInfo &info) {
+  ring.close();
   return Napi::Number::New(info.Env(), 1);
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
   STTAddon::Init(env, exports);
+  SharedAudioRing::Init(env, exports);
   return exports;
 }
 
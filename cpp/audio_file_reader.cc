@@ -0,0 +1,372 @@
+#include "audio_file_reader.h"
+#include "dr_wav.h"
+#include "flac_codec.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __APPLE__
+#include <AudioToolbox/ExtendedAudioFile.h>
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+// Frames decoded from the file at once
+static const size_t block_frames = 4096;
+// Zero crossings of the resampling kernel on each side, at the lower of the
+// two rates
+static const int kernel_zero_crossings = 16;
+static const int kernel_phases = 256;
+// Pass band of the resampler relative to the lower Nyquist frequency, leaves
+// room for the transition band of the kernel
+static const double kernel_cutoff = 0.95;
+
+struct audio_file_reader::source {
+  virtual ~source() = default;
+  // Appends up to max_frames frames, averaged to mono. Returns 0 at the end of
+  // the file, is_failed tells whether the end came early.
+  virtual size_t read(std::vector<float> &mono, size_t max_frames) = 0;
+
+  int rate = 0;
+  int channels = 0;
+  bool is_failed = false;
+};
+
+// Averages interleaved frames to mono and appends them
+static void append_mono(const float *interleaved, size_t n_frames,
+                        int channels, std::vector<float> &mono) {
+  if (channels == 1) {
+    mono.insert(mono.end(), interleaved, interleaved + n_frames);
+    return;
+  }
+  const float scale = 1.0f / channels;
+  for (size_t i = 0; i < n_frames; i++) {
+    float sum = 0.0f;
+    for (int channel = 0; channel < channels; channel++) {
+      sum += interleaved[i * channels + channel];
+    }
+    mono.push_back(sum * scale);
+  }
+}
+
+struct audio_file_reader::wav_source : audio_file_reader::source {
+  ~wav_source() override {
+    if (is_open) {
+      drwav_uninit(&wav);
+    }
+  }
+
+  bool open(const std::string &path) {
+    is_open = drwav_init_file(&wav, path.c_str(), nullptr);
+    if (!is_open) {
+      return false;
+    }
+    rate = wav.sampleRate;
+    channels = wav.channels;
+    return true;
+  }
+
+  size_t read(std::vector<float> &mono, size_t max_frames) override {
+    interleaved.resize(max_frames * channels);
+    // Converts every sample format dr_wav knows to float
+    const size_t n_frames =
+        drwav_read_pcm_frames_f32(&wav, max_frames, interleaved.data());
+    if (n_frames == 0 && wav.totalPCMFrameCount > 0 &&
+        wav.readCursorInPCMFrames < wav.totalPCMFrameCount) {
+      is_failed = true;
+    }
+    append_mono(interleaved.data(), n_frames, channels, mono);
+    return n_frames;
+  }
+
+  drwav wav;
+  bool is_open = false;
+  std::vector<float> interleaved;
+};
+
+struct audio_file_reader::flac_source : audio_file_reader::source {
+  bool open(const std::string &path) {
+    if (!decoder.open(path)) {
+      return false;
+    }
+    rate = decoder.sample_rate();
+    channels = decoder.channels();
+    scale = 1.0f / (float)(1u << (decoder.bits_per_sample() - 1));
+    return true;
+  }
+
+  size_t read(std::vector<float> &mono, size_t max_frames) override {
+    size_t n_frames = 0;
+    while (n_frames < max_frames) {
+      if (frame.empty() || frame_offset == frame[0].size()) {
+        if (!decoder.read_frame(frame)) {
+          // Frames stop before the length of STREAMINFO
+          is_failed = decoder.total_samples() > 0 &&
+                      n_decoded < decoder.total_samples();
+          break;
+        }
+        frame_offset = 0;
+        n_decoded += frame[0].size();
+      }
+      const size_t n = std::min(max_frames - n_frames,
+                                frame[0].size() - frame_offset);
+      for (size_t i = frame_offset; i < frame_offset + n; i++) {
+        int64_t sum = 0;
+        for (int channel = 0; channel < channels; channel++) {
+          sum += frame[channel][i];
+        }
+        mono.push_back(scale * sum / channels);
+      }
+      frame_offset += n;
+      n_frames += n;
+    }
+    return n_frames;
+  }
+
+  flac_decoder decoder;
+  float scale = 1.0f;
+  std::vector<std::vector<int32_t>> frame;
+  size_t frame_offset = 0;
+  uint64_t n_decoded = 0;
+};
+
+#ifdef __APPLE__
+struct audio_file_reader::apple_source : audio_file_reader::source {
+  ~apple_source() override {
+    if (file != nullptr) {
+      ExtAudioFileDispose(file);
+    }
+  }
+
+  bool open(const std::string &path) {
+    CFURLRef url = CFURLCreateFromFileSystemRepresentation(
+        kCFAllocatorDefault, (const UInt8 *)path.c_str(), path.size(), false);
+    if (url == nullptr) {
+      return false;
+    }
+    OSStatus status = ExtAudioFileOpenURL(url, &file);
+    CFRelease(url);
+    if (status != noErr) {
+      file = nullptr;
+      return false;
+    }
+
+    AudioStreamBasicDescription file_format = {};
+    UInt32 size = sizeof(file_format);
+    status = ExtAudioFileGetProperty(
+        file, kExtAudioFileProperty_FileDataFormat, &size, &file_format);
+    if (status != noErr || file_format.mChannelsPerFrame == 0) {
+      return false;
+    }
+    rate = (int)file_format.mSampleRate;
+    channels = file_format.mChannelsPerFrame;
+
+    // Decoded to interleaved float at the rate of the file, resampling and
+    // downmixing stay the same for every format
+    AudioStreamBasicDescription client_format = {};
+    client_format.mSampleRate = file_format.mSampleRate;
+    client_format.mFormatID = kAudioFormatLinearPCM;
+    client_format.mFormatFlags =
+        kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
+    client_format.mChannelsPerFrame = channels;
+    client_format.mBitsPerChannel = 32;
+    client_format.mBytesPerFrame = sizeof(float) * channels;
+    client_format.mFramesPerPacket = 1;
+    client_format.mBytesPerPacket = client_format.mBytesPerFrame;
+    status = ExtAudioFileSetProperty(file,
+                                     kExtAudioFileProperty_ClientDataFormat,
+                                     sizeof(client_format), &client_format);
+    return status == noErr;
+  }
+
+  size_t read(std::vector<float> &mono, size_t max_frames) override {
+    interleaved.resize(max_frames * channels);
+    AudioBufferList buffers;
+    buffers.mNumberBuffers = 1;
+    buffers.mBuffers[0].mNumberChannels = channels;
+    buffers.mBuffers[0].mDataByteSize =
+        (UInt32)(interleaved.size() * sizeof(float));
+    buffers.mBuffers[0].mData = interleaved.data();
+    UInt32 n_frames = (UInt32)max_frames;
+    if (ExtAudioFileRead(file, &n_frames, &buffers) != noErr) {
+      is_failed = true;
+      return 0;
+    }
+    append_mono(interleaved.data(), n_frames, channels, mono);
+    return n_frames;
+  }
+
+  ExtAudioFileRef file = nullptr;
+  std::vector<float> interleaved;
+};
+#endif
+
+audio_file_reader::audio_file_reader()
+    : n_input_rate(0), n_input_channels(0), n_output_rate(0),
+      is_input_done(true), has_failed(false), input_offset(0), n_input(0),
+      n_output(0), half_taps(0), output_offset(0) {}
+
+audio_file_reader::~audio_file_reader() = default;
+
+bool audio_file_reader::open(const std::string &path, int output_rate) {
+  close();
+
+  char marker[4] = {};
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+  const bool is_flac = fread(marker, 1, sizeof(marker), file) ==
+                           sizeof(marker) &&
+                       memcmp(marker, "fLaC", sizeof(marker)) == 0;
+  fclose(file);
+
+  if (is_flac) {
+    std::unique_ptr<flac_source> flac(new flac_source());
+    if (flac->open(path)) {
+      input = std::move(flac);
+    }
+  } else {
+    std::unique_ptr<wav_source> wav(new wav_source());
+    if (wav->open(path)) {
+      input = std::move(wav);
+    }
+#ifdef __APPLE__
+    if (!input) {
+      std::unique_ptr<apple_source> apple(new apple_source());
+      if (apple->open(path)) {
+        input = std::move(apple);
+      }
+    }
+#endif
+  }
+  if (!input || input->rate <= 0 || input->channels <= 0) {
+    fprintf(stderr, "%s: unsupported audio file '%s'\n", __func__,
+            path.c_str());
+    input.reset();
+    return false;
+  }
+
+  n_input_rate = input->rate;
+  n_input_channels = input->channels;
+  n_output_rate = output_rate;
+  is_input_done = false;
+  init_resampler();
+  return true;
+}
+
+void audio_file_reader::close() {
+  input.reset();
+  n_input_rate = 0;
+  n_input_channels = 0;
+  is_input_done = true;
+  has_failed = false;
+  history.clear();
+  input_offset = 0;
+  n_input = 0;
+  n_output = 0;
+  output.clear();
+  output_offset = 0;
+}
+
+bool audio_file_reader::read(std::vector<float> &pcmf32, size_t max_samples) {
+  pcmf32.clear();
+  if (!input || has_failed) {
+    return false;
+  }
+  output.erase(output.begin(), output.begin() + output_offset);
+  output_offset = 0;
+  while (output.size() < max_samples && !is_input_done) {
+    if (!decode_block()) {
+      has_failed = true;
+      return false;
+    }
+  }
+
+  const size_t n_samples = std::min(max_samples, output.size());
+  pcmf32.assign(output.begin(), output.begin() + n_samples);
+  output_offset = n_samples;
+  return n_samples > 0;
+}
+
+// Blackman windowed sinc, sampled from the center on. The cutoff is relative
+// to the input Nyquist frequency, so the kernel also filters out what the
+// output rate cannot represent when downsampling.
+void audio_file_reader::init_resampler() {
+  kernel.clear();
+  half_taps = 0;
+  if (n_input_rate == n_output_rate) {
+    return;
+  }
+  const double cutoff =
+      kernel_cutoff * std::min(1.0, (double)n_output_rate / n_input_rate);
+  half_taps = (int)std::ceil(kernel_zero_crossings / cutoff);
+  kernel.resize((size_t)half_taps * kernel_phases + 2, 0.0f);
+  for (size_t i = 0; i <= (size_t)half_taps * kernel_phases; i++) {
+    const double distance = (double)i / kernel_phases;
+    const double x = M_PI * cutoff * distance;
+    const double sinc = i == 0 ? 1.0 : std::sin(x) / x;
+    const double w = M_PI * distance / half_taps;
+    const double window = 0.42 + 0.5 * std::cos(w) + 0.08 * std::cos(2 * w);
+    kernel[i] = (float)(cutoff * sinc * window);
+  }
+}
+
+bool audio_file_reader::decode_block() {
+  const size_t n_previous = history.size();
+  const size_t n_frames = input->read(history, block_frames);
+  if (input->is_failed) {
+    return false;
+  }
+  if (n_frames == 0) {
+    is_input_done = true;
+  }
+  if (half_taps == 0) {
+    output.insert(output.end(), history.begin() + n_previous, history.end());
+    history.clear();
+    return true;
+  }
+  n_input += n_frames;
+
+  // Output sample k is at input position k * input_rate / output_rate, kept
+  // as a fraction so long files do not drift
+  const uint64_t in_rate = n_input_rate;
+  const uint64_t out_rate = n_output_rate;
+  while (n_output * in_rate < n_input * out_rate) {
+    const uint64_t position = n_output * in_rate;
+    const int64_t center = position / out_rate;
+    // The taps after the center are not decoded yet
+    if (!is_input_done && (uint64_t)center + half_taps >= n_input) {
+      break;
+    }
+    const double fraction = (double)(position % out_rate) / out_rate;
+
+    double sum = 0.0;
+    const int64_t first = std::max<int64_t>(center - half_taps + 1, 0);
+    const int64_t last = std::min<int64_t>(center + half_taps, n_input - 1);
+    for (int64_t j = first; j <= last; j++) {
+      const double distance = std::fabs(fraction + (double)(center - j));
+      const double phase = distance * kernel_phases;
+      const size_t index = (size_t)phase;
+      const double weight = phase - index;
+      const float h =
+          kernel[index] + (float)weight * (kernel[index + 1] - kernel[index]);
+      sum += h * history[j - input_offset];
+    }
+    output.push_back((float)sum);
+    n_output++;
+  }
+
+  // Drops the input before the first tap of the next output sample
+  const int64_t next_center = n_output * in_rate / out_rate;
+  const int64_t first_needed = next_center - half_taps + 1;
+  if (first_needed > (int64_t)input_offset) {
+    const size_t n_drop = std::min<size_t>(first_needed - input_offset,
+                                           history.size());
+    history.erase(history.begin(), history.begin() + n_drop);
+    input_offset += n_drop;
+  }
+  return true;
+}
@@ -0,0 +1,71 @@
+#ifndef STT_AUDIO_FILE_READER_H_
+#define STT_AUDIO_FILE_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Streaming conversion of a sound file to the mono float samples at the rate
+// whisper expects (16kHz), so long recordings are decoded piece by piece
+// instead of being converted to a 16kHz WAV file first.
+//
+// The format is detected from the content: WAV of any sample format through
+// dr_wav, FLAC through flac_decoder (see flac_codec.h) and, on macOS, every
+// format Core Audio decodes (MP3, AAC, ALAC, ...) through ExtAudioFile.
+// Channels are averaged, other sample rates are converted with a windowed
+// sinc resampler.
+class audio_file_reader {
+public:
+  audio_file_reader();
+  ~audio_file_reader();
+  audio_file_reader(const audio_file_reader &) = delete;
+  audio_file_reader &operator=(const audio_file_reader &) = delete;
+
+  bool open(const std::string &path, int output_rate);
+  void close();
+
+  // Sample rate and channel count of the file
+  int input_rate() const { return n_input_rate; }
+  int input_channels() const { return n_input_channels; }
+
+  // Replaces the buffer with up to max_samples of the following output
+  // samples. Returns false once the file is read completely or cannot be
+  // decoded further, see is_failed.
+  bool read(std::vector<float> &pcmf32, size_t max_samples);
+  bool is_failed() const { return has_failed; }
+
+private:
+  struct source;
+  struct wav_source;
+  struct flac_source;
+  struct apple_source;
+
+  // Resamples the next block of the source into the output buffer
+  bool decode_block();
+  void init_resampler();
+
+  std::unique_ptr<source> input;
+  int n_input_rate;
+  int n_input_channels;
+  int n_output_rate;
+  bool is_input_done;
+  bool has_failed;
+
+  // Mono samples at the input rate, from input_offset on
+  std::vector<float> history;
+  uint64_t input_offset;
+  uint64_t n_input;
+  uint64_t n_output;
+  // Kernel of the resampler, sampled at kernel_phases points per input sample
+  // from the center to half_taps
+  std::vector<float> kernel;
+  int half_taps;
+
+  // Output which did not fit into the previous read
+  std::vector<float> output;
+  size_t output_offset;
+};
+
+#endif // STT_AUDIO_FILE_READER_H_
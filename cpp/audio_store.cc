@@ -0,0 +1,309 @@
+#include "audio_store.h"
+#include "flac_codec.h"
+#include "thread_scheduling.h"
+
+#include <algorithm>
+#include <cmath>
+
+static const int store_sample_rate = 16000;
+// 5s of audio per chunk file
+static const uint64_t chunk_samples = store_sample_rate * 5;
+
+static int16_t quantize_sample(float sample) {
+  return (int16_t)lrintf(std::min(1.0f, std::max(-1.0f, sample)) * 32767.0f);
+}
+
+static float dequantize_sample(int16_t sample) { return sample / 32767.0f; }
+
+audio_store::audio_store()
+    : is_opened(false), max_chunks(0), begin_position(0), end_position(0),
+      has_samples(false), first_chunk(0), pending_chunk(0), is_stopping(false),
+      first_utterance_id(0) {}
+
+audio_store::~audio_store() { close(); }
+
+bool audio_store::open(const std::string &path, uint64_t max_samples) {
+  close();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  directory = path;
+  max_chunks = std::max<uint64_t>(
+      1, (max_samples + chunk_samples - 1) / chunk_samples);
+  is_opened = true;
+  is_stopping = false;
+  encoder = std::thread(&audio_store::run_encoder, this);
+  return true;
+}
+
+void audio_store::close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    is_stopping = true;
+  }
+  // Chunks still queued are dropped, they would be removed right away
+  encode_cv.notify_all();
+  if (encoder.joinable()) {
+    encoder.join();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  remove_chunks();
+}
+
+bool audio_store::is_open() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return is_opened;
+}
+
+void audio_store::append(uint64_t position,
+                         const std::vector<float> &samples) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!is_opened) {
+    return;
+  }
+
+  if (!has_samples) {
+    // Chunks are aligned to the engine positions, the head of the first chunk
+    // is padded
+    has_samples = true;
+    begin_position = position;
+    end_position = position;
+    first_chunk = position / chunk_samples;
+    pending_chunk = first_chunk;
+    pending.assign(position % chunk_samples, 0);
+  }
+  // Audio the store missed is retained as silence, so positions stay aligned
+  while (end_position < position) {
+    append_sample(0.0f);
+  }
+  if (position < end_position) {
+    fprintf(stderr, "%s: ignoring audio before the end of the store\n",
+            __func__);
+    return;
+  }
+
+  for (float sample : samples) {
+    append_sample(sample);
+  }
+}
+
+void audio_store::add_utterance(uint64_t utterance_id,
+                                const audio_span &span) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!is_opened) {
+    return;
+  }
+
+  if (utterances.empty()) {
+    first_utterance_id = utterance_id;
+  } else if (utterance_id < first_utterance_id + utterances.size()) {
+    fprintf(stderr, "%s: ignoring the reused utterance id %llu\n", __func__,
+            (unsigned long long)utterance_id);
+    return;
+  }
+  // Skipped ids keep an empty span, which is never found
+  while (first_utterance_id + utterances.size() < utterance_id) {
+    utterances.push_back({0, 0});
+  }
+  utterances.push_back(span);
+}
+
+bool audio_store::find_utterance(uint64_t utterance_id, audio_span &span) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (utterance_id < first_utterance_id ||
+      utterance_id >= first_utterance_id + utterances.size()) {
+    return false;
+  }
+  span = utterances[utterance_id - first_utterance_id];
+  return span.end > span.begin;
+}
+
+bool audio_store::read(const audio_span &span, std::vector<float> &samples) {
+  // Pieces of the span in chunk files, decoded after the lock is released so
+  // append() is not blocked meanwhile. Queued chunks are shared with the
+  // encoder, the pending chunk is copied right away.
+  struct chunk_piece {
+    std::string path;
+    uint64_t offset;
+    uint64_t n_samples;
+    float *output;
+    std::shared_ptr<const std::vector<int16_t>> queued;
+  };
+  std::vector<chunk_piece> pieces;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!has_samples || span.end <= span.begin ||
+        span.begin < begin_position || span.end > end_position) {
+      return false;
+    }
+
+    samples.resize(span.end - span.begin);
+    float *output = samples.data();
+    uint64_t position = span.begin;
+    while (position < span.end) {
+      const uint64_t chunk_index = position / chunk_samples;
+      const uint64_t offset = position % chunk_samples;
+      const uint64_t n_samples =
+          std::min(span.end - position, chunk_samples - offset);
+      // Chunks which are not written yet are read from memory
+      if (chunk_index == pending_chunk) {
+        for (uint64_t i = 0; i < n_samples; i++) {
+          output[i] = dequantize_sample(pending[offset + i]);
+        }
+      } else if (!encode_queue.empty() &&
+                 chunk_index >= encode_queue.front().chunk_index) {
+        pieces.push_back(
+            {std::string(), offset, n_samples, output,
+             encode_queue[chunk_index - encode_queue.front().chunk_index]
+                 .samples});
+      } else {
+        pieces.push_back(
+            {chunk_path(chunk_index), offset, n_samples, output, nullptr});
+      }
+      output += n_samples;
+      position += n_samples;
+    }
+  }
+
+  for (const chunk_piece &piece : pieces) {
+    if (piece.queued) {
+      for (uint64_t i = 0; i < piece.n_samples; i++) {
+        piece.output[i] = dequantize_sample((*piece.queued)[piece.offset + i]);
+      }
+    } else if (!read_chunk(piece.path, piece.offset, piece.n_samples,
+                           piece.output)) {
+      return false;
+    }
+  }
+
+  // The oldest chunks may have been evicted while they were decoded
+  std::lock_guard<std::mutex> lock(mutex);
+  return has_samples && span.begin >= begin_position;
+}
+
+std::string audio_store::chunk_path(uint64_t chunk_index) const {
+  return directory + "/chunk-" + std::to_string(chunk_index) + ".flac";
+}
+
+void audio_store::append_sample(float sample) {
+  pending.push_back(quantize_sample(sample));
+  end_position++;
+  if (pending.size() == chunk_samples) {
+    encode_queue.push_back(
+        {pending_chunk, std::make_shared<const std::vector<int16_t>>(
+                            std::move(pending))});
+    encode_cv.notify_one();
+    pending.clear();
+    pending.reserve(chunk_samples);
+    pending_chunk++;
+    evict_chunks();
+  }
+}
+
+// Encodes the queued chunks one after another with the lowest priority, so
+// the compression only uses otherwise idle CPU time
+void audio_store::run_encoder() {
+  scheduling_configuration low_priority;
+  low_priority.nice = 19;
+  apply_thread_scheduling(low_priority);
+
+  std::vector<uint8_t> flac;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    encode_cv.wait(lock,
+                   [this] { return is_stopping || !encode_queue.empty(); });
+    if (is_stopping) {
+      return;
+    }
+    // Stays queued for readers until the file is complete
+    const encode_job job = encode_queue.front();
+    const std::string path = chunk_path(job.chunk_index);
+    lock.unlock();
+
+    bool is_written = false;
+    if (flac_encode(job.samples->data(), job.samples->size(),
+                    store_sample_rate, flac)) {
+      FILE *file = fopen(path.c_str(), "wb");
+      if (file != nullptr) {
+        is_written = fwrite(flac.data(), 1, flac.size(), file) == flac.size();
+        is_written = fclose(file) == 0 && is_written;
+      }
+    }
+    if (!is_written) {
+      fprintf(stderr, "%s: failed to write '%s'\n", __func__, path.c_str());
+    }
+
+    lock.lock();
+    if (!encode_queue.empty() &&
+        encode_queue.front().chunk_index == job.chunk_index) {
+      encode_queue.pop_front();
+    }
+    // Evicted while it was encoded
+    if (job.chunk_index < first_chunk) {
+      remove(path.c_str());
+    }
+  }
+}
+
+// Removes the oldest chunks beyond the bound, together with the utterances
+// which cannot be read completely anymore
+void audio_store::evict_chunks() {
+  while (pending_chunk - first_chunk > max_chunks) {
+    if (!encode_queue.empty() &&
+        encode_queue.front().chunk_index == first_chunk) {
+      // Not written yet, unless the encoder is at it and removes it after
+      encode_queue.pop_front();
+    } else {
+      remove(chunk_path(first_chunk).c_str());
+    }
+    first_chunk++;
+    begin_position = std::max(begin_position, first_chunk * chunk_samples);
+  }
+  while (!utterances.empty() && utterances.front().begin < begin_position) {
+    utterances.pop_front();
+    first_utterance_id++;
+  }
+}
+
+void audio_store::remove_chunks() {
+  if (has_samples) {
+    for (uint64_t index = first_chunk; index < pending_chunk; index++) {
+      remove(chunk_path(index).c_str());
+    }
+  }
+  is_opened = false;
+  has_samples = false;
+  pending.clear();
+  encode_queue.clear();
+  utterances.clear();
+}
+
+bool audio_store::read_chunk(const std::string &path, uint64_t offset,
+                             uint64_t n_samples, float *samples) {
+  flac_decoder decoder;
+  if (!decoder.open(path)) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+
+  // FLAC frames are not indexed, the frames before the offset are decoded and
+  // skipped
+  std::vector<std::vector<int32_t>> frame;
+  uint64_t frame_begin = 0;
+  uint64_t n_read = 0;
+  while (n_read < n_samples) {
+    if (!decoder.read_frame(frame) || frame.size() != 1) {
+      fprintf(stderr, "%s: failed to decode '%s'\n", __func__, path.c_str());
+      return false;
+    }
+    const std::vector<int32_t> &quantized = frame[0];
+    const uint64_t frame_end = frame_begin + quantized.size();
+    for (uint64_t i = std::max(frame_begin, offset + n_read);
+         i < frame_end && n_read < n_samples; i++) {
+      const int16_t sample = (int16_t)quantized[i - frame_begin];
+      samples[n_read++] = dequantize_sample(sample);
+    }
+    frame_begin = frame_end;
+  }
+  return true;
+}
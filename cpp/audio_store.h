@@ -0,0 +1,95 @@
+#ifndef STT_AUDIO_STORE_H_
+#define STT_AUDIO_STORE_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sample range of the engine input, in samples since the engine was created
+struct audio_span {
+  uint64_t begin;
+  uint64_t end;
+};
+
+// Bounded on-disk retention of the engine input, so the audio of a finalized
+// utterance can be played back or transcribed again later in the session.
+//
+// Audio is quantized to int16 and stored in FLAC chunk files (see flac_codec)
+// of a fixed number of samples, named by the chunk index
+// (`<directory>/chunk-<index>.flac`). Full chunks are encoded and written on
+// a low priority thread of the store, neither the thread which appends nor the
+// inference workers of the engine spend time on compression. The
+// chunk of a sample offset is its offset divided by the chunk length, the
+// span of an utterance is kept in an index by utterance id, so both lookups
+// take constant time. The oldest chunks are removed once more than the
+// configured number of samples is retained, all chunks are removed on close.
+class audio_store {
+public:
+  audio_store();
+  ~audio_store();
+  audio_store(const audio_store &) = delete;
+  audio_store &operator=(const audio_store &) = delete;
+
+  // The directory has to exist and should be used by this store only
+  bool open(const std::string &directory, uint64_t max_samples);
+  void close();
+  bool is_open();
+
+  // Appends the samples starting at the position, which follows the previous
+  // append. Audio before the first append of an opening is not retained.
+  void append(uint64_t position, const std::vector<float> &samples);
+  // Links the utterance to the range of audio it was transcribed from. Ids
+  // increase, a reused id is ignored.
+  void add_utterance(uint64_t utterance_id, const audio_span &span);
+
+  bool find_utterance(uint64_t utterance_id, audio_span &span);
+  // Returns false when part of the range was not retained or already removed.
+  // Chunk files are decoded without holding the lock of the store.
+  bool read(const audio_span &span, std::vector<float> &samples);
+
+private:
+  // Full chunk waiting for the encoder, shared with readers meanwhile
+  struct encode_job {
+    uint64_t chunk_index;
+    std::shared_ptr<const std::vector<int16_t>> samples;
+  };
+
+  std::string chunk_path(uint64_t chunk_index) const;
+  void append_sample(float sample);
+  void run_encoder();
+  void evict_chunks();
+  void remove_chunks();
+  // Does not access the store, called without holding the lock
+  static bool read_chunk(const std::string &path, uint64_t offset,
+                         uint64_t n_samples, float *samples);
+
+  std::mutex mutex;
+  std::string directory;
+  bool is_opened;
+  uint64_t max_chunks;
+  // First sample which is still retained and the next sample to append
+  uint64_t begin_position;
+  uint64_t end_position;
+  bool has_samples;
+  // Chunks [first_chunk, pending_chunk) are on disk or in the encode queue,
+  // the pending chunk is filled in memory
+  uint64_t first_chunk;
+  uint64_t pending_chunk;
+  std::vector<int16_t> pending;
+  // Consecutive chunks, the front one is encoded until it is written
+  std::deque<encode_job> encode_queue;
+  std::condition_variable encode_cv;
+  bool is_stopping;
+  std::thread encoder;
+  // Spans of the utterances [first_utterance_id, + utterances.size())
+  uint64_t first_utterance_id;
+  std::deque<audio_span> utterances;
+};
+
+#endif // STT_AUDIO_STORE_H_
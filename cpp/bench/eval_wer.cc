@@ -0,0 +1,400 @@
+// Accuracy-vs-latency evaluation of the streaming engine.
+//
+// Streams a corpus of WAV files through the engine and scores the output
+// against reference transcripts with word and character error rates, next to
+// the latency and real-time factor of the same run. Reports of several runs
+// (e.g. different trigger_ms or models) can be plotted with plot_eval.py.
+//
+// The corpus manifest is a text file with one `<path.wav>\t<reference>` pair
+// per line, relative paths are resolved against the manifest directory.
+//
+// Two outputs are scored:
+// - final:   all finalized segments, which end up in the transcript
+// - partial: the last partial hypothesis before each finalized segment, which
+//            is what the user saw right before the text got finalized
+//
+// Usage:
+//   stt_eval -m models/ggml-base.bin --manifest corpus.tsv -o report.json
+#include "replay.h"
+#include "stream_whisper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+struct eval_params {
+  std::string model = "whisper.cpp/models/ggml-base.bin";
+  std::string fname_manifest;
+  std::string fname_out;
+  std::string language = "en";
+  int n_threads = 4;
+  int trigger_ms = 400;
+  bool is_adaptive = true;
+  std::string partial_model;
+  std::string draft_model;
+  replay_options replay;
+};
+
+struct corpus_entry {
+  std::string fname;
+  std::string reference;
+};
+
+struct error_counts {
+  size_t n_word_errors = 0;
+  size_t n_words = 0;
+  size_t n_char_errors = 0;
+  size_t n_chars = 0;
+
+  void add(const error_counts &other) {
+    n_word_errors += other.n_word_errors;
+    n_words += other.n_words;
+    n_char_errors += other.n_char_errors;
+    n_chars += other.n_chars;
+  }
+  double wer() const {
+    return n_words > 0 ? (double)n_word_errors / n_words : 0.0;
+  }
+  double cer() const {
+    return n_chars > 0 ? (double)n_char_errors / n_chars : 0.0;
+  }
+};
+
+// Levenshtein distance with unit costs for substitution, insertion and
+// deletion, using two rows of the dynamic programming table.
+template <typename T>
+static size_t edit_distance(const std::vector<T> &ref,
+                            const std::vector<T> &hyp) {
+  std::vector<size_t> prev(hyp.size() + 1);
+  std::vector<size_t> curr(hyp.size() + 1);
+  for (size_t j = 0; j <= hyp.size(); j++) {
+    prev[j] = j;
+  }
+  for (size_t i = 1; i <= ref.size(); i++) {
+    curr[0] = i;
+    for (size_t j = 1; j <= hyp.size(); j++) {
+      const size_t substitution =
+          prev[j - 1] + (ref[i - 1] == hyp[j - 1] ? 0 : 1);
+      curr[j] = std::min({substitution, prev[j] + 1, curr[j - 1] + 1});
+    }
+    std::swap(prev, curr);
+  }
+  return prev[hyp.size()];
+}
+
+static std::vector<char32_t> utf8_decode(const std::string &text) {
+  std::vector<char32_t> code_points;
+  for (size_t i = 0; i < text.size();) {
+    const unsigned char c = text[i];
+    char32_t code_point = c;
+    size_t n_continuation = 0;
+    if (c >= 0xF0) {
+      code_point = c & 0x07;
+      n_continuation = 3;
+    } else if (c >= 0xE0) {
+      code_point = c & 0x0F;
+      n_continuation = 2;
+    } else if (c >= 0xC0) {
+      code_point = c & 0x1F;
+      n_continuation = 1;
+    }
+    i++;
+    for (size_t k = 0; k < n_continuation && i < text.size(); k++, i++) {
+      code_point = (code_point << 6) | (text[i] & 0x3F);
+    }
+    code_points.push_back(code_point);
+  }
+  return code_points;
+}
+
+// Lowercases ASCII and Latin-1 letters and maps punctuation to whitespace, so
+// casing and punctuation choices of the model are not counted as errors.
+static std::vector<char32_t> normalize(const std::string &text) {
+  std::vector<char32_t> normalized;
+  bool is_space = true;
+  for (char32_t c : utf8_decode(text)) {
+    if ((c >= 'A' && c <= 'Z') || (c >= 0xC0 && c <= 0xDE && c != 0xD7)) {
+      c += 32;
+    }
+    const bool is_word_char =
+        (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '\'' ||
+        (c >= 0xC0 && c != 0xD7 && c != 0xF7);
+    if (!is_word_char) {
+      if (!is_space) {
+        normalized.push_back(' ');
+      }
+      is_space = true;
+      continue;
+    }
+    normalized.push_back(c);
+    is_space = false;
+  }
+  if (!normalized.empty() && normalized.back() == ' ') {
+    normalized.pop_back();
+  }
+  return normalized;
+}
+
+static std::vector<std::u32string>
+split_words(const std::vector<char32_t> &text) {
+  std::vector<std::u32string> words;
+  std::u32string word;
+  for (char32_t c : text) {
+    if (c == ' ') {
+      words.push_back(word);
+      word.clear();
+    } else {
+      word += c;
+    }
+  }
+  if (!word.empty()) {
+    words.push_back(word);
+  }
+  return words;
+}
+
+static error_counts score(const std::string &reference,
+                          const std::string &hypothesis) {
+  const std::vector<char32_t> ref = normalize(reference);
+  const std::vector<char32_t> hyp = normalize(hypothesis);
+  const std::vector<std::u32string> ref_words = split_words(ref);
+  const std::vector<std::u32string> hyp_words = split_words(hyp);
+
+  error_counts counts;
+  counts.n_word_errors = edit_distance(ref_words, hyp_words);
+  counts.n_words = ref_words.size();
+  counts.n_char_errors = edit_distance(ref, hyp);
+  counts.n_chars = ref.size();
+  return counts;
+}
+
+static bool read_manifest(const std::string &fname,
+                          std::vector<corpus_entry> &corpus) {
+  std::ifstream manifest(fname);
+  if (!manifest) {
+    return false;
+  }
+  const size_t separator = fname.find_last_of("/\\");
+  const std::string base_dir =
+      separator == std::string::npos ? "" : fname.substr(0, separator + 1);
+
+  std::string line;
+  while (std::getline(manifest, line)) {
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    const size_t tab = line.find('\t');
+    if (line.empty() || line[0] == '#' || tab == std::string::npos) {
+      continue;
+    }
+    corpus_entry entry;
+    entry.fname = line.substr(0, tab);
+    entry.reference = line.substr(tab + 1);
+    if (!entry.fname.empty() && entry.fname[0] != '/') {
+      entry.fname = base_dir + entry.fname;
+    }
+    corpus.push_back(entry);
+  }
+  return true;
+}
+
+static bool parse_params(int argc, char **argv, eval_params &params) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if ((arg == "-m" || arg == "--model") && has_value) {
+      params.model = argv[++i];
+    } else if (arg == "--manifest" && has_value) {
+      params.fname_manifest = argv[++i];
+    } else if ((arg == "-o" || arg == "--output") && has_value) {
+      params.fname_out = argv[++i];
+    } else if ((arg == "-l" || arg == "--language") && has_value) {
+      params.language = argv[++i];
+    } else if ((arg == "-t" || arg == "--threads") && has_value) {
+      params.n_threads = std::atoi(argv[++i]);
+    } else if (arg == "--trigger-ms" && has_value) {
+      params.trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--draft-model" && has_value) {
+      params.draft_model = argv[++i];
+    } else if (arg == "--partial-model" && has_value) {
+      params.partial_model = argv[++i];
+    } else if (arg == "--fixed-trigger") {
+      params.is_adaptive = false;
+    } else if (arg == "--fast") {
+      params.replay.is_realtime = false;
+    } else {
+      return false;
+    }
+  }
+  return !params.fname_manifest.empty();
+}
+
+static void write_scores(FILE *out, const char *name,
+                         const error_counts &counts) {
+  fprintf(out,
+          "\"%s\": {\"wer\": %.4f, \"cer\": %.4f, \"word_errors\": %zu, "
+          "\"words\": %zu, \"char_errors\": %zu, \"chars\": %zu}",
+          name, counts.wer(), counts.cer(), counts.n_word_errors,
+          counts.n_words, counts.n_char_errors, counts.n_chars);
+}
+
+int main(int argc, char **argv) {
+  eval_params params;
+  if (!parse_params(argc, argv, params)) {
+    fprintf(stderr,
+            "usage: %s --manifest corpus.tsv [-m model] [-l language] "
+            "[-t threads] [--trigger-ms N] [--fixed-trigger] "
+            "[--partial-model FNAME] [--draft-model FNAME] [--fast] "
+            "[-o report.json]\n",
+            argv[0]);
+    return 1;
+  }
+  params.replay.trigger_ms = params.trigger_ms;
+
+  std::vector<corpus_entry> corpus;
+  if (!read_manifest(params.fname_manifest, corpus) || corpus.empty()) {
+    fprintf(stderr, "error: failed to read corpus from '%s'\n",
+            params.fname_manifest.c_str());
+    return 1;
+  }
+
+  SpeechToTextEngine engine(params.model, params.language.c_str(),
+                            params.n_threads, params.trigger_ms, false);
+  stream_configuration stream_config;
+  stream_config.trigger_ms = params.trigger_ms;
+  stream_config.is_adaptive = params.is_adaptive;
+  engine.SetStreamConfiguration(stream_config);
+  if (!params.draft_model.empty() &&
+      !engine.SetDraftModel(params.draft_model)) {
+    fprintf(stderr, "error: failed to load draft model '%s'\n",
+            params.draft_model.c_str());
+    return 1;
+  }
+  if (!params.partial_model.empty() &&
+      !engine.SetPartialModel(params.partial_model)) {
+    fprintf(stderr, "error: failed to load partial model '%s'\n",
+            params.partial_model.c_str());
+    return 1;
+  }
+  engine.Start();
+
+  FILE *out = stdout;
+  if (!params.fname_out.empty()) {
+    out = fopen(params.fname_out.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "error: failed to open '%s'\n", params.fname_out.c_str());
+      return 1;
+    }
+  }
+
+  error_counts total_final;
+  error_counts total_partial;
+  double inference_ms = 0.0;
+  double window_ms = 0.0;
+  double audio_ms = 0.0;
+  double wall_ms = 0.0;
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"model\": \"%s\",\n", json_escape(params.model).c_str());
+  fprintf(out, "  \"mode\": \"%s\",\n",
+          params.replay.is_realtime ? "realtime" : "fast");
+  fprintf(out, "  \"n_threads\": %d,\n", params.n_threads);
+  fprintf(out, "  \"trigger_ms\": %d,\n", params.trigger_ms);
+  fprintf(out, "  \"adaptive_trigger\": %s,\n",
+          params.is_adaptive ? "true" : "false");
+  fprintf(out, "  \"files\": [\n");
+
+  // Skipped files leave no entry, the separator precedes every written entry
+  // after the first
+  size_t n_written = 0;
+  for (size_t i = 0; i < corpus.size(); i++) {
+    const corpus_entry &entry = corpus[i];
+    std::vector<float> pcmf32;
+    if (!read_wav(entry.fname, pcmf32)) {
+      fprintf(stderr, "warning: skipping '%s'\n", entry.fname.c_str());
+      continue;
+    }
+
+    replay_result result = replay_audio(engine, pcmf32, params.replay);
+    // Dropping left over state before the next file
+    engine.ClearAudioData();
+    engine.GetTranscribedText();
+
+    std::string final_text;
+    std::string partial_text;
+    std::string last_partial;
+    for (const transcribed_segment &segment : result.segments) {
+      if (segment.is_partial) {
+        last_partial = segment.text;
+      } else {
+        final_text += segment.text;
+        partial_text += last_partial;
+        last_partial.clear();
+      }
+    }
+    // An utterance which never got finalized only exists as partial
+    final_text += last_partial;
+    partial_text += last_partial;
+
+    const error_counts final_counts = score(entry.reference, final_text);
+    const error_counts partial_counts = score(entry.reference, partial_text);
+    total_final.add(final_counts);
+    total_partial.add(partial_counts);
+    for (const iteration_metrics &metrics : result.iterations) {
+      inference_ms += metrics.inference_ms;
+      window_ms += metrics.audio_ms;
+    }
+    audio_ms += result.audio_ms;
+    wall_ms += result.wall_ms;
+
+    fprintf(stderr, "[%zu/%zu] %s: WER %.2f%% CER %.2f%%\n", i + 1,
+            corpus.size(), entry.fname.c_str(), final_counts.wer() * 100.0,
+            final_counts.cer() * 100.0);
+
+    fprintf(out, "%s    {\"file\": \"%s\", ", n_written > 0 ? ",\n" : "",
+            json_escape(entry.fname).c_str());
+    n_written++;
+    write_scores(out, "final", final_counts);
+    fprintf(out, ", ");
+    write_scores(out, "partial", partial_counts);
+    fprintf(out, ", \"hypothesis\": \"%s\"}", json_escape(final_text).c_str());
+  }
+  if (n_written > 0) {
+    fprintf(out, "\n");
+  }
+  engine.Stop();
+
+  const latency_summary latency_partial = engine.GetLatencySummary(true);
+  const latency_summary latency_final = engine.GetLatencySummary(false);
+
+  fprintf(out, "  ],\n");
+  fprintf(out, "  ");
+  write_scores(out, "final", total_final);
+  fprintf(out, ",\n  ");
+  write_scores(out, "partial", total_partial);
+  fprintf(out, ",\n");
+  fprintf(out, "  \"rtf\": %.4f,\n",
+          window_ms > 0.0 ? inference_ms / window_ms : 0.0);
+  fprintf(out, "  \"stream_rtf\": %.4f,\n",
+          audio_ms > 0.0 ? wall_ms / audio_ms : 0.0);
+  fprintf(out,
+          "  \"latency\": {\"partial\": {\"p50_ms\": %.3f, \"p95_ms\": %.3f}, "
+          "\"final\": {\"p50_ms\": %.3f, \"p95_ms\": %.3f}}\n",
+          latency_partial.p50_ms, latency_partial.p95_ms, latency_final.p50_ms,
+          latency_final.p95_ms);
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+
+  fprintf(stderr,
+          "final WER %.2f%% CER %.2f%%, partial WER %.2f%% CER %.2f%%\n",
+          total_final.wer() * 100.0, total_final.cer() * 100.0,
+          total_partial.wer() * 100.0, total_partial.cer() * 100.0);
+  return 0;
+}
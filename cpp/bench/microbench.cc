@@ -0,0 +1,311 @@
+// Microbenchmarks for the DSP and I/O hot paths of the streaming engine.
+//
+// Covers high_pass_filter, vad_simple, read_wav (mono and stereo conversion)
+// and the AddAudioData/GetTranscribedText hand-off over several buffer sizes.
+// Results are written in the JSON layout of Google Benchmark, so they can be
+// compared with its tools (e.g. tools/compare.py) across revisions.
+//
+// Usage:
+//   stt_microbench [--filter NAME] [--min-time-ms N] [-o results.json]
+#include "replay.h"
+#include "stream_whisper.h"
+#include "whisper.h"
+
+#include "dr_wav.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct microbench_params {
+  std::string filter;
+  std::string fname_out;
+  std::string tmp_dir = "/tmp";
+  int min_time_ms = 500;
+  int repetitions = 5;
+};
+
+struct microbench_result {
+  std::string name;
+  uint64_t iterations;
+  double real_time_ns;
+  double cpu_time_ns;
+  double items_per_second;
+};
+
+// A benchmark body runs `n` iterations and returns the number of processed
+// items (samples), which is reported as throughput.
+typedef std::function<uint64_t(uint64_t n)> microbench_body;
+
+static double cpu_time_ns() {
+  return (double)std::clock() * 1e9 / CLOCKS_PER_SEC;
+}
+
+// Grows the iteration count until a run takes at least min_time_ms, then
+// reports the median of the repetitions.
+static microbench_result run_benchmark(const std::string &name,
+                                       const microbench_body &body,
+                                       const microbench_params &params) {
+  uint64_t n = 1;
+  while (true) {
+    const auto t_begin = std::chrono::steady_clock::now();
+    body(n);
+    const double elapsed_ms =
+        std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t_begin)
+            .count();
+    if (elapsed_ms >= params.min_time_ms || n >= (1ULL << 40)) {
+      break;
+    }
+    const double scale = elapsed_ms > 0.0
+                             ? std::min(10.0, 1.4 * params.min_time_ms /
+                                                  elapsed_ms)
+                             : 10.0;
+    n = std::max(n + 1, (uint64_t)(n * scale));
+  }
+
+  std::vector<double> real_times;
+  std::vector<double> cpu_times;
+  uint64_t items = 0;
+  for (int r = 0; r < params.repetitions; r++) {
+    const double cpu_begin = cpu_time_ns();
+    const auto t_begin = std::chrono::steady_clock::now();
+    items = body(n);
+    const double real_ns = std::chrono::duration<double, std::nano>(
+                               std::chrono::steady_clock::now() - t_begin)
+                               .count();
+    real_times.push_back(real_ns / n);
+    cpu_times.push_back((cpu_time_ns() - cpu_begin) / n);
+  }
+  std::sort(real_times.begin(), real_times.end());
+  std::sort(cpu_times.begin(), cpu_times.end());
+
+  microbench_result result;
+  result.name = name;
+  result.iterations = n;
+  result.real_time_ns = real_times[real_times.size() / 2];
+  result.cpu_time_ns = cpu_times[cpu_times.size() / 2];
+  result.items_per_second =
+      result.real_time_ns > 0.0
+          ? (items / (double)n) * 1e9 / result.real_time_ns
+          : 0.0;
+  return result;
+}
+
+// Speech-like test signal: a tone with a pause in the last second, so the VAD
+// runs through all of its branches.
+static std::vector<float> make_signal(size_t n_samples) {
+  std::vector<float> pcmf32(n_samples);
+  const size_t n_silence = std::min(n_samples / 4, (size_t)WHISPER_SAMPLE_RATE);
+  for (size_t i = 0; i < n_samples; i++) {
+    const float t = (float)i / WHISPER_SAMPLE_RATE;
+    const float amplitude = i < n_samples - n_silence ? 0.3f : 0.001f;
+    pcmf32[i] = amplitude * sinf(2.0f * (float)M_PI * 220.0f * t) +
+                0.01f * (float)((i * 7919) % 100) / 100.0f;
+  }
+  return pcmf32;
+}
+
+static bool write_test_wav(const std::string &path, int channels,
+                           size_t n_frames) {
+  drwav_data_format format;
+  format.container = drwav_container_riff;
+  format.format = DR_WAVE_FORMAT_PCM;
+  format.channels = channels;
+  format.sampleRate = WHISPER_SAMPLE_RATE;
+  format.bitsPerSample = 16;
+
+  drwav wav;
+  if (!drwav_init_file_write(&wav, path.c_str(), &format, nullptr)) {
+    return false;
+  }
+  const std::vector<float> signal = make_signal(n_frames);
+  std::vector<int16_t> pcm16(n_frames * channels);
+  for (size_t i = 0; i < n_frames; i++) {
+    for (int c = 0; c < channels; c++) {
+      pcm16[i * channels + c] = (int16_t)(signal[i] * 32767.0f);
+    }
+  }
+  drwav_write_pcm_frames(&wav, n_frames, pcm16.data());
+  drwav_uninit(&wav);
+  return true;
+}
+
+static bool parse_params(int argc, char **argv, microbench_params &params) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "--filter" && has_value) {
+      params.filter = argv[++i];
+    } else if ((arg == "-o" || arg == "--output") && has_value) {
+      params.fname_out = argv[++i];
+    } else if (arg == "--min-time-ms" && has_value) {
+      params.min_time_ms = std::atoi(argv[++i]);
+    } else if (arg == "--repetitions" && has_value) {
+      params.repetitions = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--tmp-dir" && has_value) {
+      params.tmp_dir = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--filter NAME] [--min-time-ms N] "
+              "[--repetitions N] [--tmp-dir DIR] [-o results.json]\n",
+              argv[0]);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  microbench_params params;
+  if (!parse_params(argc, argv, params)) {
+    return 1;
+  }
+
+  std::vector<std::pair<std::string, microbench_body>> benchmarks;
+
+  // Buffer sizes: one render quantum, one worklet report, the VAD window and
+  // a full 30s whisper window.
+  const std::vector<size_t> dsp_sizes = {128, 3200, 48000, 480000};
+  for (size_t n_samples : dsp_sizes) {
+    const std::vector<float> signal = make_signal(n_samples);
+    benchmarks.emplace_back(
+        "high_pass_filter/" + std::to_string(n_samples),
+        [signal](uint64_t n) {
+          std::vector<float> data(signal.size());
+          for (uint64_t i = 0; i < n; i++) {
+            std::copy(signal.begin(), signal.end(), data.begin());
+            high_pass_filter(data, 200.0f, WHISPER_SAMPLE_RATE);
+          }
+          return (uint64_t)signal.size() * n;
+        });
+  }
+
+  for (size_t n_samples : {(size_t)48000, (size_t)480000}) {
+    const std::vector<float> signal = make_signal(n_samples);
+    for (float freq_thold : {0.0f, 200.0f}) {
+      benchmarks.emplace_back(
+          "vad_simple/" + std::to_string(n_samples) + "/freq_thold:" +
+              std::to_string((int)freq_thold),
+          [signal, freq_thold](uint64_t n) {
+            std::vector<float> data(signal.size());
+            for (uint64_t i = 0; i < n; i++) {
+              std::copy(signal.begin(), signal.end(), data.begin());
+              vad_simple(data, WHISPER_SAMPLE_RATE, 500, 0.3f, freq_thold,
+                         false);
+            }
+            return (uint64_t)signal.size() * n;
+          });
+    }
+  }
+
+  std::vector<std::string> tmp_files;
+  for (int channels : {1, 2}) {
+    const size_t n_frames = WHISPER_SAMPLE_RATE * 30;
+    const std::string path = params.tmp_dir + "/stt_microbench_" +
+                             std::to_string(channels) + "ch.wav";
+    if (!write_test_wav(path, channels, n_frames)) {
+      fprintf(stderr, "error: failed to write '%s'\n", path.c_str());
+      return 1;
+    }
+    tmp_files.push_back(path);
+    benchmarks.emplace_back(
+        std::string("read_wav/") + (channels == 1 ? "mono" : "stereo") +
+            "/30s",
+        [path, n_frames](uint64_t n) {
+          std::vector<float> pcmf32;
+          for (uint64_t i = 0; i < n; i++) {
+            read_wav(path, pcmf32);
+          }
+          return (uint64_t)n_frames * n;
+        });
+  }
+
+  // The hand-off is measured without a running worker and without a model, so
+  // only the shared queue and its locking are part of the measurement.
+  SpeechToTextEngine engine("", "en", 1, 400, false);
+  for (size_t n_samples : {(size_t)128, (size_t)3200, (size_t)16000}) {
+    const std::vector<float> chunk = make_signal(n_samples);
+    benchmarks.emplace_back(
+        "add_audio_data/" + std::to_string(n_samples),
+        [&engine, chunk](uint64_t n) {
+          for (uint64_t i = 0; i < n; i++) {
+            engine.AddAudioData(chunk);
+            engine.GetTranscribedText();
+            // Keeps the queue at the size of a trigger interval
+            if (i % 64 == 63) {
+              engine.ClearAudioData();
+            }
+          }
+          engine.ClearAudioData();
+          return (uint64_t)chunk.size() * n;
+        });
+  }
+
+  std::vector<microbench_result> results;
+  for (const auto &benchmark : benchmarks) {
+    if (!params.filter.empty() &&
+        benchmark.first.find(params.filter) == std::string::npos) {
+      continue;
+    }
+    microbench_result result =
+        run_benchmark(benchmark.first, benchmark.second, params);
+    fprintf(stderr, "%-40s %12.1f ns %12.1f ns %12llu  %8.2f M items/s\n",
+            result.name.c_str(), result.real_time_ns, result.cpu_time_ns,
+            (unsigned long long)result.iterations,
+            result.items_per_second / 1e6);
+    results.push_back(result);
+  }
+
+  for (const std::string &path : tmp_files) {
+    std::remove(path.c_str());
+  }
+
+  FILE *out = stdout;
+  if (!params.fname_out.empty()) {
+    out = fopen(params.fname_out.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "error: failed to open '%s'\n", params.fname_out.c_str());
+      return 1;
+    }
+  }
+
+  char date[64];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"context\": {\n");
+  fprintf(out, "    \"date\": \"%s\",\n", date);
+  fprintf(out, "    \"executable\": \"%s\",\n", json_escape(argv[0]).c_str());
+  fprintf(out, "    \"min_time_ms\": %d,\n", params.min_time_ms);
+  fprintf(out, "    \"repetitions\": %d\n", params.repetitions);
+  fprintf(out, "  },\n");
+  fprintf(out, "  \"benchmarks\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const microbench_result &result = results[i];
+    fprintf(out,
+            "    {\"name\": \"%s\", \"run_type\": \"aggregate\", "
+            "\"aggregate_name\": \"median\", \"iterations\": %llu, "
+            "\"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\", "
+            "\"items_per_second\": %.3f}%s\n",
+            json_escape(result.name).c_str(),
+            (unsigned long long)result.iterations, result.real_time_ns,
+            result.cpu_time_ns, result.items_per_second,
+            i + 1 < results.size() ? "," : "");
+  }
+  fprintf(out, "  ]\n");
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
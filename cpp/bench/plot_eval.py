@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Plots accuracy against latency and real-time factor of stt_eval reports.
+
+Every report is one point, labelled by model and trigger_ms, so runs with
+different engine settings can be judged on both axes.
+
+Usage:
+  python3 cpp/bench/plot_eval.py report-*.json -o eval.png
+"""
+import argparse
+import json
+import os
+
+import matplotlib
+
+matplotlib.use("Agg")
+import matplotlib.pyplot as plt
+
+
+def load_reports(paths):
+    reports = []
+    for path in paths:
+        with open(path, encoding="utf-8") as f:
+            report = json.load(f)
+        model = os.path.basename(report["model"]).replace("ggml-", "").replace(".bin", "")
+        report["label"] = f"{model} {report['trigger_ms']}ms"
+        reports.append(report)
+    return reports
+
+
+def plot(reports, output):
+    fig, (ax_latency, ax_rtf) = plt.subplots(1, 2, figsize=(12, 5))
+
+    for kind, marker in (("final", "o"), ("partial", "x")):
+        wer = [r[kind]["wer"] * 100 for r in reports]
+        latency = [r["latency"][kind]["p50_ms"] for r in reports]
+        rtf = [r["rtf"] for r in reports]
+        ax_latency.scatter(latency, wer, marker=marker, label=kind)
+        ax_rtf.scatter(rtf, wer, marker=marker, label=kind)
+        if kind == "final":
+            for r, x_latency, x_rtf, y in zip(reports, latency, rtf, wer):
+                ax_latency.annotate(r["label"], (x_latency, y), fontsize=8)
+                ax_rtf.annotate(r["label"], (x_rtf, y), fontsize=8)
+
+    ax_latency.set_xlabel("end-to-end latency p50 (ms)")
+    ax_rtf.set_xlabel("real-time factor")
+    for ax in (ax_latency, ax_rtf):
+        ax.set_ylabel("WER (%)")
+        ax.grid(True, alpha=0.3)
+        ax.legend()
+
+    fig.tight_layout()
+    fig.savefig(output, dpi=150)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("reports", nargs="+", help="stt_eval JSON reports")
+    parser.add_argument("-o", "--output", default="eval.png")
+    args = parser.parse_args()
+
+    plot(load_reports(args.reports), args.output)
+    print(f"written {args.output}")
+
+
+if __name__ == "__main__":
+    main()
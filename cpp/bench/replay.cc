@@ -0,0 +1,177 @@
+#include "replay.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+#include <sys/resource.h>
+
+replay_result replay_audio(SpeechToTextEngine &engine,
+                           const std::vector<float> &pcmf32,
+                           const replay_options &options) {
+  std::vector<float> audio(pcmf32);
+  const size_t n_samples_tail =
+      (size_t)WHISPER_SAMPLE_RATE * options.tail_ms / 1000;
+  audio.insert(audio.end(), n_samples_tail, 0.0f);
+
+  // Splitting the audio into chunks as the recorder worklet would deliver them
+  const size_t n_samples_chunk =
+      std::max(1, WHISPER_SAMPLE_RATE * options.chunk_ms / 1000);
+  std::vector<session_event> events;
+  for (size_t offset = 0; offset < audio.size(); offset += n_samples_chunk) {
+    const size_t n = std::min(n_samples_chunk, audio.size() - offset);
+    session_event event;
+    event.type = SESSION_EVENT_AUDIO;
+    // A chunk arrives once all of its samples were captured
+    event.t_us = (uint64_t)((offset + n) * 1000000.0 / WHISPER_SAMPLE_RATE);
+    event.samples.assign(audio.begin() + offset, audio.begin() + offset + n);
+    events.push_back(std::move(event));
+  }
+
+  return replay_session(engine, events, options);
+}
+
+replay_result replay_session(SpeechToTextEngine &engine,
+                             const std::vector<session_event> &events,
+                             const replay_options &options) {
+  replay_result result;
+  result.audio_ms = 0.0;
+
+  const auto t_begin = std::chrono::steady_clock::now();
+  auto t_last_result = t_begin;
+  auto t_next_poll = t_begin;
+
+  const size_t n_samples_step =
+      (size_t)WHISPER_SAMPLE_RATE * options.trigger_ms / 1000;
+  size_t n_samples_fed_step = 0;
+
+  size_t event_index = 0;
+  bool is_stopped = false;
+  // In fast mode the next step is held back until the engine emitted the
+  // result of the previous iteration.
+  bool is_waiting = false;
+
+  while (true) {
+    const auto t_now = std::chrono::steady_clock::now();
+
+    while (event_index < events.size() && !is_waiting) {
+      const session_event &event = events[event_index];
+      if (options.is_realtime &&
+          t_now < t_begin + std::chrono::microseconds(event.t_us)) {
+        break;
+      }
+
+      if (event.type == SESSION_EVENT_AUDIO) {
+        if (is_stopped) {
+          engine.Start();
+          is_stopped = false;
+        }
+        engine.AddAudioData(event.samples);
+        result.audio_ms += event.samples.size() * 1000.0 / WHISPER_SAMPLE_RATE;
+        n_samples_fed_step += event.samples.size();
+        if (!options.is_realtime && n_samples_fed_step >= n_samples_step) {
+          is_waiting = true;
+          n_samples_fed_step = 0;
+        }
+      } else if (event.type == SESSION_EVENT_CLEAR) {
+        engine.ClearAudioData();
+        n_samples_fed_step = 0;
+      } else if (event.type == SESSION_EVENT_STOP) {
+        engine.Stop();
+        is_stopped = true;
+      }
+      event_index++;
+    }
+
+    if (!options.is_realtime || t_now >= t_next_poll) {
+      std::vector<transcribed_segment> segments = engine.GetTranscribedText();
+      if (!segments.empty()) {
+        t_last_result = t_now;
+        is_waiting = false;
+        result.segments.insert(result.segments.end(), segments.begin(),
+                               segments.end());
+      }
+      std::vector<iteration_metrics> iterations = engine.GetIterationMetrics();
+      result.iterations.insert(result.iterations.end(), iterations.begin(),
+                               iterations.end());
+      t_next_poll = t_now + std::chrono::milliseconds(options.poll_ms);
+    }
+
+    // Guards against iterations which failed without emitting a segment
+    if (is_waiting &&
+        t_now - t_last_result >
+            std::chrono::milliseconds(options.idle_timeout_ms)) {
+      is_waiting = false;
+    }
+
+    if (event_index >= events.size() &&
+        std::chrono::steady_clock::now() - t_last_result >
+            std::chrono::milliseconds(options.idle_timeout_ms)) {
+      break;
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  if (is_stopped) {
+    engine.Start();
+  }
+  result.wall_ms = std::chrono::duration<double, std::milli>(
+                       t_last_result - t_begin)
+                       .count();
+  return result;
+}
+
+process_usage get_process_usage() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  process_usage result;
+  result.user_cpu_ms =
+      usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0;
+  result.system_cpu_ms =
+      usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0;
+#if defined(__APPLE__)
+  // Darwin reports the maximum resident set size in bytes
+  result.peak_rss_mb = usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+  // Linux reports the maximum resident set size in kilobytes
+  result.peak_rss_mb = usage.ru_maxrss / 1024.0;
+#endif
+  return result;
+}
+
+std::string json_escape(const std::string &text) {
+  std::string escaped;
+  escaped.reserve(text.size());
+  for (char c : text) {
+    switch (c) {
+    case '"':
+      escaped += "\\\"";
+      break;
+    case '\\':
+      escaped += "\\\\";
+      break;
+    case '\n':
+      escaped += "\\n";
+      break;
+    case '\r':
+      escaped += "\\r";
+      break;
+    case '\t':
+      escaped += "\\t";
+      break;
+    default:
+      if ((unsigned char)c < 0x20) {
+        char buffer[8];
+        snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+        escaped += buffer;
+      } else {
+        escaped += c;
+      }
+    }
+  }
+  return escaped;
+}
@@ -0,0 +1,59 @@
+#ifndef STT_BENCH_REPLAY_H_
+#define STT_BENCH_REPLAY_H_
+
+#include "session_recorder.h"
+#include "stream_whisper.h"
+
+#include <string>
+#include <vector>
+
+struct replay_options {
+  // Feed the audio with wall-clock pacing. Otherwise audio is fed in steps of
+  // the trigger length, each as soon as the engine emitted the result of the
+  // previous step.
+  bool is_realtime = true;
+  // Trigger length of the engine, defines the step size in fast mode
+  int trigger_ms = 400;
+  // Size of a fed chunk, matches the report size of the recorder worklet
+  int chunk_ms = 200;
+  // Polling interval of GetTranscribedText, matches the editor polling
+  int poll_ms = 300;
+  // Trailing silence appended so the last utterance gets finalized
+  int tail_ms = 2000;
+  // Stop waiting for results after this idle time once all audio was fed
+  int idle_timeout_ms = 3000;
+};
+
+struct replay_result {
+  std::vector<transcribed_segment> segments;
+  std::vector<iteration_metrics> iterations;
+  double audio_ms;
+  double wall_ms;
+};
+
+// Streams the audio through a started engine via AddAudioData and collects the
+// emitted segments and iteration metrics.
+replay_result replay_audio(SpeechToTextEngine &engine,
+                           const std::vector<float> &pcmf32,
+                           const replay_options &options);
+
+// Feeds a captured session (see session_recorder.h) into a started engine. In
+// real-time mode every event is replayed at its original arrival time, chunk
+// boundaries and Clear/Stop calls are reproduced in both modes.
+replay_result replay_session(SpeechToTextEngine &engine,
+                             const std::vector<session_event> &events,
+                             const replay_options &options);
+
+// Resource usage of the whole process
+struct process_usage {
+  double user_cpu_ms;
+  double system_cpu_ms;
+  double peak_rss_mb;
+};
+
+process_usage get_process_usage();
+
+// Escapes a string to be embedded into a JSON document
+std::string json_escape(const std::string &text);
+
+#endif // STT_BENCH_REPLAY_H_
@@ -0,0 +1,317 @@
+// Standalone replay benchmark for the SpeechToTextEngine.
+//
+// Streams a WAV file through AddAudioData, either paced in real time like the
+// recorder worklet or as fast as the engine keeps up, polls
+// GetTranscribedText and reports real-time factor, end-to-end latency, CPU
+// time and peak RSS as JSON.
+//
+// Instead of a WAV file, a session log captured in the application (see
+// session_recorder.h) can be replayed with the original chunking and timing.
+//
+// With --sessions N the input is replayed concurrently through N engines which
+// share the model, the report covers the first session.
+//
+// Usage:
+//   stt_replay_bench -m models/ggml-base.bin -f samples/jfk.wav [--fast]
+//   stt_replay_bench -m models/ggml-base.bin --session session.sttrec
+#include "replay.h"
+#include "stream_whisper.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct replay_bench_params {
+  std::string model = "whisper.cpp/models/ggml-base.bin";
+  std::string fname_inp;
+  std::string fname_session;
+  std::string fname_out;
+  std::string fallback_model;
+  std::string partial_model;
+  std::string draft_model;
+  int n_draft_tokens = 4;
+  std::string language = "en";
+  int n_threads = 4;
+  int trigger_ms = 400;
+  bool is_adaptive = true;
+  bool is_pipelined = false;
+  int n_sessions = 1;
+  replay_options replay;
+};
+
+static void print_usage(const char *argv0, const replay_bench_params &params) {
+  fprintf(stderr, "usage: %s [options] -f <file.wav>\n", argv0);
+  fprintf(stderr, "       %s [options] --session <file.sttrec>\n\n", argv0);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -h,  --help            show this help message\n");
+  fprintf(stderr, "  -m,  --model FNAME     model path (default: %s)\n",
+          params.model.c_str());
+  fprintf(stderr, "  -f,  --file FNAME      16kHz WAV file to replay\n");
+  fprintf(stderr, "       --session FNAME   captured session log to replay\n");
+  fprintf(stderr, "  -o,  --output FNAME    write the JSON report to a file "
+                  "(default: stdout)\n");
+  fprintf(stderr, "  -l,  --language LANG   spoken language (default: %s)\n",
+          params.language.c_str());
+  fprintf(stderr, "  -t,  --threads N       inference threads (default: %d)\n",
+          params.n_threads);
+  fprintf(stderr, "       --trigger-ms N    engine trigger (default: %d)\n",
+          params.trigger_ms);
+  fprintf(stderr, "       --fixed-trigger   disable the adaptive trigger\n");
+  fprintf(stderr, "       --pipelined       overlap encoder and decoder of "
+                  "consecutive windows\n");
+  fprintf(stderr, "       --sessions N      concurrent sessions on the same "
+                  "model (default: %d)\n",
+          params.n_sessions);
+  fprintf(stderr, "       --fallback-model FNAME  smaller model used while "
+                  "overloaded\n");
+  fprintf(stderr, "       --partial-model FNAME  fast model for partials\n");
+  fprintf(stderr, "       --draft-model FNAME    draft model for speculative "
+                  "decoding\n");
+  fprintf(stderr, "       --draft-tokens N       draft tokens per pass, 0 "
+                  "decodes greedy without draft (default: %d)\n",
+          params.n_draft_tokens);
+  fprintf(stderr, "       --chunk-ms N      size of fed chunks (default: %d)\n",
+          params.replay.chunk_ms);
+  fprintf(stderr, "       --fast            feed as fast as possible instead "
+                  "of real time\n");
+}
+
+static bool parse_params(int argc, char **argv, replay_bench_params &params) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-m" || arg == "--model") && has_value) {
+      params.model = argv[++i];
+    } else if ((arg == "-f" || arg == "--file") && has_value) {
+      params.fname_inp = argv[++i];
+    } else if (arg == "--session" && has_value) {
+      params.fname_session = argv[++i];
+    } else if ((arg == "-o" || arg == "--output") && has_value) {
+      params.fname_out = argv[++i];
+    } else if ((arg == "-l" || arg == "--language") && has_value) {
+      params.language = argv[++i];
+    } else if ((arg == "-t" || arg == "--threads") && has_value) {
+      params.n_threads = std::atoi(argv[++i]);
+    } else if (arg == "--trigger-ms" && has_value) {
+      params.trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--chunk-ms" && has_value) {
+      params.replay.chunk_ms = std::atoi(argv[++i]);
+    } else if (arg == "--fallback-model" && has_value) {
+      params.fallback_model = argv[++i];
+    } else if (arg == "--draft-model" && has_value) {
+      params.draft_model = argv[++i];
+    } else if (arg == "--draft-tokens" && has_value) {
+      params.n_draft_tokens = std::atoi(argv[++i]);
+    } else if (arg == "--partial-model" && has_value) {
+      params.partial_model = argv[++i];
+    } else if (arg == "--fixed-trigger") {
+      params.is_adaptive = false;
+    } else if (arg == "--pipelined") {
+      params.is_pipelined = true;
+    } else if (arg == "--sessions" && has_value) {
+      params.n_sessions = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--fast") {
+      params.replay.is_realtime = false;
+    } else {
+      fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return !params.fname_inp.empty() || !params.fname_session.empty();
+}
+
+static bool configure_engine(SpeechToTextEngine &engine,
+                             const replay_bench_params &params) {
+  stream_configuration stream_config;
+  stream_config.trigger_ms = params.trigger_ms;
+  stream_config.is_adaptive = params.is_adaptive;
+  stream_config.is_pipelined = params.is_pipelined;
+  stream_config.n_draft_tokens = params.n_draft_tokens;
+  engine.SetStreamConfiguration(stream_config);
+  if (!params.draft_model.empty() &&
+      !engine.SetDraftModel(params.draft_model)) {
+    fprintf(stderr, "error: failed to load draft model '%s'\n",
+            params.draft_model.c_str());
+    return false;
+  }
+  if (!params.partial_model.empty() &&
+      !engine.SetPartialModel(params.partial_model)) {
+    fprintf(stderr, "error: failed to load partial model '%s'\n",
+            params.partial_model.c_str());
+    return false;
+  }
+  if (!params.fallback_model.empty() &&
+      !engine.SetFallbackModel(params.fallback_model)) {
+    fprintf(stderr, "error: failed to load fallback model '%s'\n",
+            params.fallback_model.c_str());
+    return false;
+  }
+  return true;
+}
+
+static void write_latency(FILE *out, const char *name,
+                          const latency_summary &summary) {
+  fprintf(out,
+          "    \"%s\": {\"count\": %llu, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+          "\"p99_ms\": %.3f, \"max_ms\": %.3f}",
+          name, (unsigned long long)summary.count, summary.p50_ms,
+          summary.p95_ms, summary.p99_ms, summary.max_ms);
+}
+
+int main(int argc, char **argv) {
+  replay_bench_params params;
+  if (!parse_params(argc, argv, params)) {
+    print_usage(argv[0], params);
+    return 1;
+  }
+  params.replay.trigger_ms = params.trigger_ms;
+
+  std::vector<float> pcmf32;
+  std::vector<session_event> events;
+  if (!params.fname_session.empty()) {
+    int sample_rate = 0;
+    if (!read_session_log(params.fname_session, events, sample_rate) ||
+        sample_rate != WHISPER_SAMPLE_RATE) {
+      fprintf(stderr, "error: failed to read session log '%s'\n",
+              params.fname_session.c_str());
+      return 1;
+    }
+  } else if (!read_wav(params.fname_inp, pcmf32)) {
+    fprintf(stderr, "error: failed to read WAV file '%s'\n",
+            params.fname_inp.c_str());
+    return 1;
+  }
+
+  std::vector<std::unique_ptr<SpeechToTextEngine>> engines;
+  for (int i = 0; i < params.n_sessions; i++) {
+    engines.emplace_back(new SpeechToTextEngine(
+        params.model, params.language.c_str(), params.n_threads,
+        params.trigger_ms, false));
+    if (!configure_engine(*engines.back(), params)) {
+      return 1;
+    }
+  }
+
+  auto replay = [&](SpeechToTextEngine &engine) {
+    engine.Start();
+    replay_result result =
+        events.empty() ? replay_audio(engine, pcmf32, params.replay)
+                       : replay_session(engine, events, params.replay);
+    engine.Stop();
+    return result;
+  };
+  std::vector<std::thread> concurrent_sessions;
+  for (int i = 1; i < params.n_sessions; i++) {
+    SpeechToTextEngine &engine = *engines[i];
+    concurrent_sessions.emplace_back([&replay, &engine] { replay(engine); });
+  }
+  replay_result result = replay(*engines[0]);
+  for (std::thread &session : concurrent_sessions) {
+    session.join();
+  }
+  SpeechToTextEngine &engine = *engines[0];
+
+  double inference_ms = 0.0;
+  double window_ms = 0.0;
+  double effective_trigger_ms = 0.0;
+  double decode_ms = 0.0;
+  int n_draft_proposed = 0;
+  int n_draft_accepted = 0;
+  for (const iteration_metrics &metrics : result.iterations) {
+    inference_ms += metrics.inference_ms;
+    window_ms += metrics.audio_ms;
+    effective_trigger_ms += metrics.trigger_ms;
+    decode_ms += metrics.decode_ms;
+    n_draft_proposed += metrics.n_draft_proposed;
+    n_draft_accepted += metrics.n_draft_accepted;
+  }
+  if (!result.iterations.empty()) {
+    effective_trigger_ms /= result.iterations.size();
+    decode_ms /= result.iterations.size();
+  }
+  int n_partials = 0;
+  int n_finals = 0;
+  std::string transcript;
+  for (const transcribed_segment &segment : result.segments) {
+    if (segment.is_partial) {
+      n_partials++;
+    } else {
+      n_finals++;
+      transcript += segment.text;
+    }
+  }
+  const process_usage usage = get_process_usage();
+
+  FILE *out = stdout;
+  if (!params.fname_out.empty()) {
+    out = fopen(params.fname_out.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "error: failed to open '%s'\n", params.fname_out.c_str());
+      return 1;
+    }
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"model\": \"%s\",\n", json_escape(params.model).c_str());
+  fprintf(out, "  \"file\": \"%s\",\n",
+          json_escape(params.fname_session.empty() ? params.fname_inp
+                                                   : params.fname_session)
+              .c_str());
+  fprintf(out, "  \"mode\": \"%s\",\n",
+          params.replay.is_realtime ? "realtime" : "fast");
+  fprintf(out, "  \"n_threads\": %d,\n", params.n_threads);
+  fprintf(out, "  \"trigger_ms\": %d,\n", params.trigger_ms);
+  fprintf(out, "  \"adaptive_trigger\": %s,\n",
+          params.is_adaptive ? "true" : "false");
+  fprintf(out, "  \"pipelined\": %s,\n",
+          params.is_pipelined ? "true" : "false");
+  fprintf(out, "  \"sessions\": %d,\n", params.n_sessions);
+  // Mean trigger over all iterations, differs from trigger_ms when adaptive
+  fprintf(out, "  \"effective_trigger_ms\": %.3f,\n", effective_trigger_ms);
+  fprintf(out, "  \"audio_ms\": %.3f,\n", result.audio_ms);
+  fprintf(out, "  \"wall_ms\": %.3f,\n", result.wall_ms);
+  fprintf(out, "  \"iterations\": %zu,\n", result.iterations.size());
+  fprintf(out, "  \"partials\": %d,\n", n_partials);
+  fprintf(out, "  \"finals\": %d,\n", n_finals);
+  // Inference time relative to the length of all processed windows
+  fprintf(out, "  \"rtf\": %.4f,\n",
+          window_ms > 0.0 ? inference_ms / window_ms : 0.0);
+  // Wall time relative to the replayed audio, below 1.0 keeps up in real time
+  fprintf(out, "  \"stream_rtf\": %.4f,\n",
+          result.audio_ms > 0.0 ? result.wall_ms / result.audio_ms : 0.0);
+  fprintf(out, "  \"mean_decode_ms\": %.3f,\n", decode_ms);
+  fprintf(out, "  \"draft_acceptance\": %.4f,\n",
+          n_draft_proposed > 0 ? (double)n_draft_accepted / n_draft_proposed
+                               : 0.0);
+  fprintf(out, "  \"latency\": {\n");
+  write_latency(out, "partial", engine.GetLatencySummary(true));
+  fprintf(out, ",\n");
+  write_latency(out, "final", engine.GetLatencySummary(false));
+  fprintf(out, "\n  },\n");
+  const load_shedding_counters counters = engine.GetLoadSheddingCounters();
+  fprintf(out,
+          "  \"load_shedding\": {\"partials_skipped\": %llu, "
+          "\"silence_dropped_ms\": %.3f, \"fallback_iterations\": %llu},\n",
+          (unsigned long long)counters.partials_skipped,
+          counters.silence_dropped_ms,
+          (unsigned long long)counters.fallback_iterations);
+  fprintf(out, "  \"cpu_user_ms\": %.3f,\n", usage.user_cpu_ms);
+  fprintf(out, "  \"cpu_system_ms\": %.3f,\n", usage.system_cpu_ms);
+  fprintf(out, "  \"peak_rss_mb\": %.3f,\n", usage.peak_rss_mb);
+  fprintf(out, "  \"transcript\": \"%s\"\n", json_escape(transcript).c_str());
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return 0;
+}
@@ -0,0 +1,767 @@
+#include "flac_codec.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+static const uint8_t flac_marker[4] = {'f', 'L', 'a', 'C'};
+static const size_t flac_block_size = 4096;
+static const int flac_max_fixed_order = 4;
+static const int flac_max_partition_order = 8;
+// Rice parameters of the RICE2 residual coding method have 5 bits, the largest
+// value is the escape code
+static const int flac_max_rice_parameter = 30;
+
+enum flac_subframe_type : uint32_t {
+  FLAC_SUBFRAME_CONSTANT = 0,
+  FLAC_SUBFRAME_VERBATIM = 1,
+  FLAC_SUBFRAME_FIXED = 8,
+  FLAC_SUBFRAME_LPC = 32,
+};
+
+static uint8_t flac_crc8(const uint8_t *data, size_t size) {
+  uint8_t crc = 0;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= data[i];
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+static uint16_t flac_crc16(const uint8_t *data, size_t size) {
+  uint16_t crc = 0;
+  for (size_t i = 0; i < size; i++) {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x8005)
+                           : (uint16_t)(crc << 1);
+    }
+  }
+  return crc;
+}
+
+// Signed residuals are Rice coded as unsigned values: 0, -1, 1, -2, ...
+static uint32_t fold_signed(int32_t value) {
+  return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+namespace {
+
+// MSB-first bit writer, appends to a byte buffer
+struct bit_writer {
+  std::vector<uint8_t> &bytes;
+  uint64_t accumulator = 0;
+  int n_bits = 0;
+
+  explicit bit_writer(std::vector<uint8_t> &bytes) : bytes(bytes) {}
+
+  void write(uint32_t value, int bits) {
+    for (int remaining = bits; remaining > 0;) {
+      const int n = std::min(remaining, 24);
+      remaining -= n;
+      const uint32_t bits_n = (value >> remaining) & ((1u << n) - 1);
+      accumulator = (accumulator << n) | bits_n;
+      n_bits += n;
+      while (n_bits >= 8) {
+        n_bits -= 8;
+        bytes.push_back((uint8_t)(accumulator >> n_bits));
+      }
+    }
+  }
+
+  void write_signed(int32_t value, int bits) {
+    write((uint32_t)value & (bits == 32 ? ~0u : ((1u << bits) - 1)), bits);
+  }
+
+  // Unary code of the value, zeros terminated by a one
+  void write_unary(uint32_t value) {
+    while (value >= 24) {
+      write(0, 24);
+      value -= 24;
+    }
+    write(1, value + 1);
+  }
+
+  void write_rice(uint32_t value, int parameter) {
+    write_unary(value >> parameter);
+    if (parameter > 0) {
+      write(value & ((1u << parameter) - 1), parameter);
+    }
+  }
+
+  void align() {
+    if (n_bits > 0) {
+      write(0, 8 - n_bits);
+    }
+  }
+};
+
+// MSB-first bit reader, reads past the end fail
+struct bit_reader {
+  const uint8_t *data;
+  size_t size;
+  size_t position = 0;
+  bool is_failed = false;
+
+  bit_reader(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+  // Reads up to 32 bits
+  uint32_t read(int bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    if (position + bits > size * 8) {
+      is_failed = true;
+      position = size * 8;
+      return 0;
+    }
+    const size_t first_byte = position / 8;
+    const int skipped = position % 8;
+    const int n_bytes = (skipped + bits + 7) / 8;
+    uint64_t value = 0;
+    for (int i = 0; i < n_bytes; i++) {
+      value = (value << 8) | data[first_byte + i];
+    }
+    value >>= n_bytes * 8 - skipped - bits;
+    position += bits;
+    return (uint32_t)(value & ((1ull << bits) - 1));
+  }
+
+  int32_t read_signed(int bits) {
+    if (bits == 0) {
+      return 0;
+    }
+    const uint32_t value = read(bits);
+    const uint32_t sign = 1u << (bits - 1);
+    return (int32_t)((value ^ sign) - sign);
+  }
+
+  // Counts the zeros up to the next one, skipping whole zero bytes at once
+  uint32_t read_unary() {
+    uint32_t value = 0;
+    while (position < size * 8) {
+      const int skipped = position % 8;
+      const uint8_t byte = (uint8_t)(data[position / 8] << skipped);
+      if (byte == 0) {
+        value += 8 - skipped;
+        position += 8 - skipped;
+        continue;
+      }
+      int zeros = 0;
+      while (!(byte & (0x80 >> zeros))) {
+        zeros++;
+      }
+      position += zeros + 1;
+      return value + zeros;
+    }
+    is_failed = true;
+    return value;
+  }
+
+  void align() { position = (position + 7) / 8 * 8; }
+  size_t byte_position() const { return position / 8; }
+};
+
+} // namespace
+
+// Residual of the fixed predictor of the order, for samples [order, n)
+static void fixed_residual(const int32_t *x, size_t n, int order,
+                           int32_t *residual) {
+  for (size_t i = order; i < n; i++) {
+    switch (order) {
+    case 0:
+      residual[i] = x[i];
+      break;
+    case 1:
+      residual[i] = x[i] - x[i - 1];
+      break;
+    case 2:
+      residual[i] = x[i] - 2 * x[i - 1] + x[i - 2];
+      break;
+    case 3:
+      residual[i] = x[i] - 3 * x[i - 1] + 3 * x[i - 2] - x[i - 3];
+      break;
+    default:
+      residual[i] =
+          x[i] - 4 * x[i - 1] + 6 * x[i - 2] - 4 * x[i - 3] + x[i - 4];
+      break;
+    }
+  }
+}
+
+// Rice parameter with the fewest bits for the folded residuals, returns the
+// number of bits including the parameter itself
+static uint64_t best_rice_parameter(const uint32_t *folded, size_t n,
+                                    int &parameter) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += folded[i];
+  }
+  // The optimum is close to log2 of the mean, its neighbours are compared
+  int estimate = 0;
+  while (estimate < flac_max_rice_parameter && n > 0 &&
+         ((uint64_t)n << (estimate + 1)) <= sum) {
+    estimate++;
+  }
+
+  uint64_t best_bits = UINT64_MAX;
+  for (int k = std::max(0, estimate - 1);
+       k <= std::min(flac_max_rice_parameter - 1, estimate + 1); k++) {
+    uint64_t bits = 5 + (uint64_t)n * (k + 1);
+    for (size_t i = 0; i < n; i++) {
+      bits += folded[i] >> k;
+    }
+    if (bits < best_bits) {
+      best_bits = bits;
+      parameter = k;
+    }
+  }
+  return best_bits;
+}
+
+struct residual_coding {
+  int partition_order;
+  int parameters[1 << flac_max_partition_order];
+  uint64_t bits;
+};
+
+static residual_coding best_residual_coding(const uint32_t *folded, size_t n,
+                                            int order) {
+  residual_coding best;
+  best.bits = UINT64_MAX;
+  for (int partition_order = 0; partition_order <= flac_max_partition_order;
+       partition_order++) {
+    const size_t n_partitions = (size_t)1 << partition_order;
+    const size_t partition_size = n >> partition_order;
+    if (n % n_partitions != 0 || partition_size <= (size_t)order) {
+      break;
+    }
+
+    residual_coding coding;
+    coding.partition_order = partition_order;
+    coding.bits = 2 + 4;
+    for (size_t p = 0; p < n_partitions; p++) {
+      // The warm-up samples of the predictor have no residual
+      const size_t begin = p == 0 ? order : p * partition_size;
+      const size_t end = (p + 1) * partition_size;
+      coding.bits += best_rice_parameter(folded + begin, end - begin,
+                                         coding.parameters[p]);
+    }
+    if (coding.bits < best.bits) {
+      best = coding;
+    }
+  }
+  return best;
+}
+
+static void write_subframe(bit_writer &writer, const int32_t *x, size_t n) {
+  const int bps = 16;
+  bool is_constant = true;
+  for (size_t i = 1; i < n && is_constant; i++) {
+    is_constant = x[i] == x[0];
+  }
+  if (is_constant) {
+    writer.write(FLAC_SUBFRAME_CONSTANT << 1, 8);
+    writer.write_signed(x[0], bps);
+    return;
+  }
+
+  // Fixed predictor with the smallest residual
+  std::vector<int32_t> residual(n);
+  int best_order = -1;
+  uint64_t best_magnitude = UINT64_MAX;
+  for (int order = 0; order <= flac_max_fixed_order && (size_t)order < n;
+       order++) {
+    fixed_residual(x, n, order, residual.data());
+    uint64_t magnitude = 0;
+    for (size_t i = order; i < n; i++) {
+      magnitude += std::abs(residual[i]);
+    }
+    if (magnitude < best_magnitude) {
+      best_magnitude = magnitude;
+      best_order = order;
+    }
+  }
+
+  fixed_residual(x, n, best_order, residual.data());
+  std::vector<uint32_t> folded(n, 0);
+  for (size_t i = best_order; i < n; i++) {
+    folded[i] = fold_signed(residual[i]);
+  }
+  const residual_coding coding =
+      best_residual_coding(folded.data(), n, best_order);
+
+  const uint64_t fixed_bits = (uint64_t)best_order * bps + coding.bits;
+  if (coding.bits == UINT64_MAX || fixed_bits >= (uint64_t)n * bps) {
+    writer.write(FLAC_SUBFRAME_VERBATIM << 1, 8);
+    for (size_t i = 0; i < n; i++) {
+      writer.write_signed(x[i], bps);
+    }
+    return;
+  }
+
+  writer.write((FLAC_SUBFRAME_FIXED + best_order) << 1, 8);
+  for (int i = 0; i < best_order; i++) {
+    writer.write_signed(x[i], bps);
+  }
+  // RICE2 coding method with 5-bit parameters
+  writer.write(1, 2);
+  writer.write(coding.partition_order, 4);
+  const size_t n_partitions = (size_t)1 << coding.partition_order;
+  const size_t partition_size = n >> coding.partition_order;
+  for (size_t p = 0; p < n_partitions; p++) {
+    const size_t begin = p == 0 ? best_order : p * partition_size;
+    const size_t end = (p + 1) * partition_size;
+    writer.write(coding.parameters[p], 5);
+    for (size_t i = begin; i < end; i++) {
+      writer.write_rice(folded[i], coding.parameters[p]);
+    }
+  }
+}
+
+// Frame numbers are coded like UTF-8 code points
+static void write_frame_number(bit_writer &writer, uint32_t number) {
+  if (number < 0x80) {
+    writer.write(number, 8);
+    return;
+  }
+  int n_continuation = 1;
+  while (n_continuation < 5 && number >= (1u << (6 + 5 * n_continuation))) {
+    n_continuation++;
+  }
+  const uint32_t lead_mask = (0xFF00u >> (n_continuation + 1)) & 0xFF;
+  writer.write(lead_mask | (number >> (6 * n_continuation)), 8);
+  for (int i = n_continuation - 1; i >= 0; i--) {
+    writer.write(0x80 | ((number >> (6 * i)) & 0x3F), 8);
+  }
+}
+
+static void write_frame(std::vector<uint8_t> &flac, const int16_t *samples,
+                        size_t n, uint32_t frame_number) {
+  const size_t frame_begin = flac.size();
+  bit_writer writer(flac);
+
+  // Sync code, fixed block size strategy
+  writer.write(0x3FFE, 14);
+  writer.write(0, 1);
+  writer.write(0, 1);
+  // 4096 samples, or the size at the end of the header
+  writer.write(n == flac_block_size ? 12 : 7, 4);
+  // Sample rate of the STREAMINFO block, mono, 16 bits per sample
+  writer.write(0, 4);
+  writer.write(0, 4);
+  writer.write(4, 3);
+  writer.write(0, 1);
+  write_frame_number(writer, frame_number);
+  if (n != flac_block_size) {
+    writer.write((uint32_t)n - 1, 16);
+  }
+  writer.write(flac_crc8(flac.data() + frame_begin, flac.size() - frame_begin),
+               8);
+
+  std::vector<int32_t> x(samples, samples + n);
+  write_subframe(writer, x.data(), n);
+  writer.align();
+
+  writer.write(flac_crc16(flac.data() + frame_begin, flac.size() - frame_begin),
+               16);
+}
+
+bool flac_encode(const int16_t *samples, size_t n_samples, int sample_rate,
+                 std::vector<uint8_t> &flac) {
+  if (n_samples == 0 || sample_rate <= 0 || sample_rate >= (1 << 20)) {
+    return false;
+  }
+
+  flac.assign(flac_marker, flac_marker + sizeof(flac_marker));
+  bit_writer writer(flac);
+  // Last metadata block, STREAMINFO of 34 bytes
+  writer.write(0x80, 8);
+  writer.write(34, 24);
+  const uint32_t block_size = std::min(n_samples, flac_block_size);
+  writer.write(block_size, 16);
+  writer.write(block_size, 16);
+  // Frame sizes and MD5 signature are unknown
+  writer.write(0, 24);
+  writer.write(0, 24);
+  writer.write(sample_rate, 20);
+  writer.write(0, 3);
+  writer.write(16 - 1, 5);
+  writer.write((uint32_t)((uint64_t)n_samples >> 32), 4);
+  writer.write((uint32_t)n_samples, 32);
+  for (int i = 0; i < 16; i++) {
+    writer.write(0, 8);
+  }
+
+  uint32_t frame_number = 0;
+  for (size_t offset = 0; offset < n_samples; offset += flac_block_size) {
+    const size_t n = std::min(flac_block_size, n_samples - offset);
+    write_frame(flac, samples + offset, n, frame_number++);
+  }
+  return true;
+}
+
+
+static bool read_residual(bit_reader &reader, size_t n, int order,
+                          int32_t *residual) {
+  const uint32_t method = reader.read(2);
+  if (method > 1) {
+    return false;
+  }
+  const int parameter_bits = method == 0 ? 4 : 5;
+  const uint32_t escape = (1u << parameter_bits) - 1;
+  const int partition_order = reader.read(4);
+  const size_t n_partitions = (size_t)1 << partition_order;
+  const size_t partition_size = n >> partition_order;
+  if (n % n_partitions != 0 || partition_size < (size_t)order) {
+    return false;
+  }
+
+  for (size_t p = 0; p < n_partitions && !reader.is_failed; p++) {
+    const size_t begin = p == 0 ? order : p * partition_size;
+    const size_t end = (p + 1) * partition_size;
+    const uint32_t parameter = reader.read(parameter_bits);
+    if (parameter == escape) {
+      const int bits = reader.read(5);
+      for (size_t i = begin; i < end; i++) {
+        residual[i] = reader.read_signed(bits);
+      }
+      continue;
+    }
+    for (size_t i = begin; i < end && !reader.is_failed; i++) {
+      const uint32_t quotient = reader.read_unary();
+      const uint32_t folded = (quotient << parameter) | reader.read(parameter);
+      residual[i] = (int32_t)(folded >> 1) ^ -(int32_t)(folded & 1);
+    }
+  }
+  return !reader.is_failed;
+}
+
+// Restores the samples of a fixed predictor in place, x[i] holds the residual
+// for i >= order until then
+static void restore_fixed(int32_t *x, size_t n, int order) {
+  for (size_t i = order; i < n; i++) {
+    switch (order) {
+    case 0:
+      break;
+    case 1:
+      x[i] += x[i - 1];
+      break;
+    case 2:
+      x[i] += 2 * x[i - 1] - x[i - 2];
+      break;
+    case 3:
+      x[i] += 3 * x[i - 1] - 3 * x[i - 2] + x[i - 3];
+      break;
+    default:
+      x[i] += 4 * x[i - 1] - 6 * x[i - 2] + 4 * x[i - 3] - x[i - 4];
+      break;
+    }
+  }
+}
+
+// Restores the samples of a linear predictor in place, like restore_fixed
+static void restore_lpc(int32_t *x, size_t n, const int32_t *coefficients,
+                        int order, int shift) {
+  for (size_t i = order; i < n; i++) {
+    int64_t prediction = 0;
+    for (int j = 0; j < order; j++) {
+      prediction += (int64_t)coefficients[j] * x[i - j - 1];
+    }
+    x[i] += (int32_t)(prediction >> shift);
+  }
+}
+
+static bool read_subframe(bit_reader &reader, size_t n, int bps, int32_t *x) {
+  if (reader.read(1) != 0) {
+    return false;
+  }
+  const uint32_t type = reader.read(6);
+  int wasted_bits = 0;
+  if (reader.read(1) == 1) {
+    wasted_bits = reader.read_unary() + 1;
+  }
+  bps -= wasted_bits;
+  if (bps <= 0) {
+    return false;
+  }
+
+  if (type == FLAC_SUBFRAME_CONSTANT) {
+    std::fill(x, x + n, reader.read_signed(bps));
+  } else if (type == FLAC_SUBFRAME_VERBATIM) {
+    for (size_t i = 0; i < n; i++) {
+      x[i] = reader.read_signed(bps);
+    }
+  } else if (type >= FLAC_SUBFRAME_FIXED &&
+             type <= FLAC_SUBFRAME_FIXED + flac_max_fixed_order) {
+    const int order = type - FLAC_SUBFRAME_FIXED;
+    if ((size_t)order > n) {
+      return false;
+    }
+    for (int i = 0; i < order; i++) {
+      x[i] = reader.read_signed(bps);
+    }
+    if (!read_residual(reader, n, order, x)) {
+      return false;
+    }
+    restore_fixed(x, n, order);
+  } else if (type >= FLAC_SUBFRAME_LPC) {
+    const int order = (type & 0x1F) + 1;
+    if ((size_t)order > n) {
+      return false;
+    }
+    for (int i = 0; i < order; i++) {
+      x[i] = reader.read_signed(bps);
+    }
+    const int precision = reader.read(4) + 1;
+    const int shift = reader.read_signed(5);
+    if (precision > 15 || shift < 0) {
+      return false;
+    }
+    int32_t coefficients[32];
+    for (int i = 0; i < order; i++) {
+      coefficients[i] = reader.read_signed(precision);
+    }
+    if (!read_residual(reader, n, order, x)) {
+      return false;
+    }
+    restore_lpc(x, n, coefficients, order, shift);
+  } else {
+    // Reserved subframe types
+    return false;
+  }
+
+  if (wasted_bits > 0) {
+    for (size_t i = 0; i < n; i++) {
+      x[i] = (int32_t)((uint32_t)x[i] << wasted_bits);
+    }
+  }
+  return !reader.is_failed;
+}
+
+// Bits per sample of the frame header codes, 0 refers to STREAMINFO
+static const int flac_sample_sizes[8] = {0, 8, 12, -1, 16, 20, 24, -1};
+
+static bool read_frame_header(bit_reader &reader, int stream_bps, size_t &n,
+                              int &channel_assignment, int &bps) {
+  if (reader.read(14) != 0x3FFE) {
+    return false;
+  }
+  reader.read(1);
+  // Fixed or variable block size, the frame/sample number is skipped either
+  // way
+  reader.read(1);
+  const uint32_t block_size_code = reader.read(4);
+  const uint32_t sample_rate_code = reader.read(4);
+  channel_assignment = reader.read(4);
+  const int sample_size = flac_sample_sizes[reader.read(3)];
+  reader.read(1);
+  if (channel_assignment > 10 || sample_size < 0) {
+    return false;
+  }
+  bps = sample_size == 0 ? stream_bps : sample_size;
+
+  // Frame or sample number, coded like UTF-8
+  uint32_t lead = reader.read(8);
+  while ((lead & 0xC0) == 0xC0) {
+    reader.read(8);
+    lead = (lead << 1) & 0xFF;
+  }
+
+  if (block_size_code == 1) {
+    n = 192;
+  } else if (block_size_code >= 2 && block_size_code <= 5) {
+    n = (size_t)576 << (block_size_code - 2);
+  } else if (block_size_code == 6) {
+    n = reader.read(8) + 1;
+  } else if (block_size_code == 7) {
+    n = reader.read(16) + 1;
+  } else if (block_size_code >= 8) {
+    n = (size_t)256 << (block_size_code - 8);
+  } else {
+    return false;
+  }
+  if (sample_rate_code == 12) {
+    reader.read(8);
+  } else if (sample_rate_code == 13 || sample_rate_code == 14) {
+    reader.read(16);
+  } else if (sample_rate_code == 15) {
+    return false;
+  }
+  // CRC-8 of the header
+  reader.read(8);
+  return !reader.is_failed;
+}
+
+static bool decode_frame(bit_reader &reader, int stream_channels,
+                         int stream_bps,
+                         std::vector<std::vector<int32_t>> &samples) {
+  size_t n = 0;
+  int channel_assignment = 0;
+  int bps = 0;
+  if (!read_frame_header(reader, stream_bps, n, channel_assignment, bps)) {
+    return false;
+  }
+  // Independent channels, or left/side, side/right and mid/side stereo
+  const int n_channels = channel_assignment < 8 ? channel_assignment + 1 : 2;
+  if (n_channels != stream_channels) {
+    return false;
+  }
+
+  samples.resize(n_channels);
+  for (int channel = 0; channel < n_channels; channel++) {
+    // The side channel has one bit more
+    const bool is_side = (channel_assignment == 8 && channel == 1) ||
+                         (channel_assignment == 9 && channel == 0) ||
+                         (channel_assignment == 10 && channel == 1);
+    samples[channel].resize(n);
+    if (!read_subframe(reader, n, bps + (is_side ? 1 : 0),
+                       samples[channel].data())) {
+      return false;
+    }
+  }
+  reader.align();
+  // CRC-16 of the frame
+  reader.read(16);
+  if (reader.is_failed) {
+    return false;
+  }
+
+  if (channel_assignment >= 8) {
+    int32_t *left = samples[0].data();
+    int32_t *right = samples[1].data();
+    for (size_t i = 0; i < n; i++) {
+      if (channel_assignment == 8) {
+        right[i] = left[i] - right[i];
+      } else if (channel_assignment == 9) {
+        left[i] += right[i];
+      } else {
+        const int32_t side = right[i];
+        const int32_t mid = (int32_t)(((uint32_t)left[i] << 1) | (side & 1));
+        left[i] = (mid + side) >> 1;
+        right[i] = (mid - side) >> 1;
+      }
+    }
+  }
+  return true;
+}
+
+flac_decoder::flac_decoder()
+    : file(nullptr), offset(0), is_eof(false), rate(0), n_channels(0), bps(0),
+      n_total_samples(0), max_frame_size(0) {}
+
+flac_decoder::~flac_decoder() { close(); }
+
+bool flac_decoder::open(const std::string &path) {
+  close();
+  file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+
+  if (!fill(sizeof(flac_marker)) || buffer.size() < sizeof(flac_marker) ||
+      memcmp(buffer.data(), flac_marker, sizeof(flac_marker)) != 0) {
+    close();
+    return false;
+  }
+  offset = sizeof(flac_marker);
+
+  bool is_last = false;
+  bool has_streaminfo = false;
+  while (!is_last) {
+    if (!fill(4) || buffer.size() - offset < 4) {
+      close();
+      return false;
+    }
+    bit_reader header(buffer.data() + offset, 4);
+    is_last = header.read(1) == 1;
+    const uint32_t type = header.read(7);
+    const uint32_t length = header.read(24);
+    offset += 4;
+    if (!fill(length) || buffer.size() - offset < length) {
+      close();
+      return false;
+    }
+    if (type == 0 && length >= 34) {
+      bit_reader reader(buffer.data() + offset, length);
+      reader.read(16);
+      reader.read(16);
+      reader.read(24);
+      max_frame_size = reader.read(24);
+      rate = reader.read(20);
+      n_channels = reader.read(3) + 1;
+      bps = reader.read(5) + 1;
+      n_total_samples = (uint64_t)reader.read(4) << 32;
+      n_total_samples |= reader.read(32);
+      has_streaminfo = true;
+    }
+    offset += length;
+  }
+
+  if (!has_streaminfo || rate == 0 || bps < 4 || bps > 24) {
+    fprintf(stderr, "%s: unsupported FLAC stream '%s'\n", __func__,
+            path.c_str());
+    close();
+    return false;
+  }
+  return true;
+}
+
+void flac_decoder::close() {
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+  buffer.clear();
+  offset = 0;
+  is_eof = false;
+}
+
+// Makes sure at least n_bytes are buffered after the read offset, unless the
+// file ends before. Consumed bytes are dropped first.
+bool flac_decoder::fill(size_t n_bytes) {
+  if (file == nullptr) {
+    return false;
+  }
+  if (offset > 0 && offset >= buffer.size() / 2) {
+    buffer.erase(buffer.begin(), buffer.begin() + offset);
+    offset = 0;
+  }
+  while (!is_eof && buffer.size() - offset < n_bytes) {
+    const size_t previous_size = buffer.size();
+    const size_t n_missing = n_bytes - (buffer.size() - offset);
+    buffer.resize(previous_size + std::max<size_t>(n_missing, 1 << 16));
+    const size_t n_read = fread(buffer.data() + previous_size, 1,
+                                buffer.size() - previous_size, file);
+    buffer.resize(previous_size + n_read);
+    if (n_read == 0) {
+      is_eof = true;
+    }
+  }
+  return true;
+}
+
+bool flac_decoder::read_frame(std::vector<std::vector<int32_t>> &samples) {
+  // Frames are decoded from memory, a frame which does not fit into the
+  // buffered bytes is retried with more of the file
+  size_t n_bytes = max_frame_size > 0 ? max_frame_size : 1 << 16;
+  while (true) {
+    if (!fill(n_bytes) || offset >= buffer.size()) {
+      return false;
+    }
+    const size_t n_buffered = buffer.size() - offset;
+    bit_reader reader(buffer.data() + offset, n_buffered);
+    if (decode_frame(reader, n_channels, bps, samples)) {
+      offset += reader.byte_position();
+      return true;
+    }
+    // Corrupt, or the end of the file was reached
+    if (!reader.is_failed || is_eof || n_buffered < n_bytes) {
+      return false;
+    }
+    n_bytes *= 2;
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef STT_FLAC_CODEC_H_
+#define STT_FLAC_CODEC_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Minimal FLAC encoder for mono 16-bit audio, which stores speech in roughly
+// half the size of int16 PCM without loss.
+//
+// The encoder writes a complete stream (STREAMINFO and frames of 4096
+// samples) with the fixed predictors of order 0 to 4 and partitioned Rice
+// coding of the residual, the choice of predictor and partitioning is made per
+// frame. Any FLAC decoder reads the result.
+bool flac_encode(const int16_t *samples, size_t n_samples, int sample_rate,
+                 std::vector<uint8_t> &flac);
+
+// Streaming FLAC decoder, reads a file frame by frame with a bounded buffer.
+// Supports 1 to 8 channels with inter-channel decorrelation, 4 to 24 bits per
+// sample, constant, verbatim, fixed and LPC subframes and fixed or variable
+// block sizes. Frame CRCs are not verified.
+class flac_decoder {
+public:
+  flac_decoder();
+  ~flac_decoder();
+  flac_decoder(const flac_decoder &) = delete;
+  flac_decoder &operator=(const flac_decoder &) = delete;
+
+  // Reads the metadata, false when the file is not a supported FLAC stream
+  bool open(const std::string &path);
+  void close();
+
+  int sample_rate() const { return rate; }
+  int channels() const { return n_channels; }
+  int bits_per_sample() const { return bps; }
+  // 0 when unknown
+  uint64_t total_samples() const { return n_total_samples; }
+
+  // Decodes the next frame into one buffer per channel. Returns false at the
+  // end of the stream or when the frame is corrupt.
+  bool read_frame(std::vector<std::vector<int32_t>> &samples);
+
+private:
+  bool fill(size_t n_bytes);
+
+  FILE *file;
+  std::vector<uint8_t> buffer;
+  // Read offset into the buffer
+  size_t offset;
+  bool is_eof;
+  int rate;
+  int n_channels;
+  int bps;
+  uint64_t n_total_samples;
+  uint32_t max_frame_size;
+};
+
+#endif // STT_FLAC_CODEC_H_
@@ -0,0 +1,432 @@
+// Inference host process of the application.
+//
+// Hosts a SpeechToTextEngine outside of the Electron main process, so a slow
+// or crashing inference does not block the IPC handlers and the model memory
+// is not accounted to the application. The main process supervises the host
+// (see src/utils/inferenceHost.ts) and restarts it when it exits.
+//
+// Audio arrives through a shm_audio_ring created by the main process, control
+// frames and results are exchanged over an inherited socket in the framing of
+// stream_protocol.h. The host exits when the control channel closes, so it
+// never outlives the application.
+//
+// Metrics, latency histograms, tracing and session recording of the engine
+// are requested over the channel as well, each request gets a reply frame.
+//
+// With --transcribe a single file is transcribed, the segments are written to
+// the channel and the host exits. The file host loads its own copy of the
+// model, which adds the model size to the memory in use while it runs.
+//
+// Usage:
+//   stt_host -m models/ggml-base.bin --ring /stt-audio-1234 --channel-fd 3
+#include "shm_audio_ring.h"
+#include "stream_protocol.h"
+#include "stream_whisper.h"
+#include "trace_events.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct host_params {
+  std::string model = "whisper.cpp/models/ggml-base.bin";
+  std::string ring_name;
+  std::string fname_transcribe;
+  std::string transcription_cache;
+  int channel_fd = 3;
+  std::string language = "en";
+  int n_threads = 4;
+  int trigger_ms = 400;
+  // Polling interval of the audio ring and of the engine results
+  int poll_ms = 20;
+  stream_configuration stream_config;
+  scheduling_configuration sched_config;
+  std::string fallback_model;
+  std::string partial_model;
+  std::string draft_model;
+  std::string refinement_model;
+};
+
+static void print_usage(const char *argv0, const host_params &params) {
+  fprintf(stderr, "usage: %s [options] --ring <name>\n", argv0);
+  fprintf(stderr, "       %s [options] --transcribe <file>\n\n", argv0);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -h,  --help            show this help message\n");
+  fprintf(stderr, "  -m,  --model FNAME     model path (default: %s)\n",
+          params.model.c_str());
+  fprintf(stderr, "       --ring NAME       shared memory audio ring\n");
+  fprintf(stderr, "       --channel-fd N    inherited control socket "
+                  "(default: %d)\n",
+          params.channel_fd);
+  fprintf(stderr, "       --transcribe FNAME  transcribe a file and exit\n");
+  fprintf(stderr, "       --transcription-cache DIR  reuse transcriptions "
+                  "of the same audio\n");
+  fprintf(stderr, "  -l,  --language LANG   spoken language (default: %s)\n",
+          params.language.c_str());
+  fprintf(stderr, "  -t,  --threads N       inference threads (default: %d)\n",
+          params.n_threads);
+  fprintf(stderr, "       --trigger-ms N    engine trigger (default: %d)\n",
+          params.trigger_ms);
+  fprintf(stderr, "       --fixed-trigger   disable the adaptive trigger\n");
+  fprintf(stderr, "       --min-trigger-ms N        adaptive trigger "
+                  "bounds\n");
+  fprintf(stderr, "       --max-trigger-ms N\n");
+  fprintf(stderr, "       --min-window-ms N         adaptive window bound\n");
+  fprintf(stderr, "       --shed-partials-backlog-ms N  overload "
+                  "policies\n");
+  fprintf(stderr, "       --drop-silence-backlog-ms N\n");
+  fprintf(stderr, "       --fallback-backlog-ms N\n");
+  fprintf(stderr, "       --pipelined       overlap encoder and decoder of "
+                  "consecutive windows\n");
+  fprintf(stderr, "       --refinement      refine finals in the background\n");
+  fprintf(stderr, "       --refinement-beam-size N  beam size of the "
+                  "refinement\n");
+  fprintf(stderr, "       --fallback-model FNAME  smaller model used while "
+                  "overloaded\n");
+  fprintf(stderr, "       --partial-model FNAME  fast model for partials\n");
+  fprintf(stderr, "       --draft-model FNAME    draft model for speculative "
+                  "decoding\n");
+  fprintf(stderr, "       --draft-tokens N       draft tokens per pass\n");
+  fprintf(stderr, "       --refinement-model FNAME  model of the "
+                  "refinement\n");
+  fprintf(stderr, "       --cpu-affinity LIST  comma separated core ids of "
+                  "the inference threads\n");
+  fprintf(stderr, "       --nice N          nice value of the inference "
+                  "threads\n");
+  fprintf(stderr, "       --realtime-priority  real-time scheduling class\n");
+}
+
+static std::vector<int> parse_core_list(const char *list) {
+  std::vector<int> cores;
+  for (const char *c = list; *c != '\0';) {
+    char *end = nullptr;
+    const long core = std::strtol(c, &end, 10);
+    if (end == c) {
+      break;
+    }
+    cores.push_back((int)core);
+    c = *end == ',' ? end + 1 : end;
+  }
+  return cores;
+}
+
+static bool parse_params(int argc, char **argv, host_params &params) {
+  stream_configuration &config = params.stream_config;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-m" || arg == "--model") && has_value) {
+      params.model = argv[++i];
+    } else if (arg == "--ring" && has_value) {
+      params.ring_name = argv[++i];
+    } else if (arg == "--channel-fd" && has_value) {
+      params.channel_fd = std::atoi(argv[++i]);
+    } else if (arg == "--transcribe" && has_value) {
+      params.fname_transcribe = argv[++i];
+    } else if (arg == "--transcription-cache" && has_value) {
+      params.transcription_cache = argv[++i];
+    } else if ((arg == "-l" || arg == "--language") && has_value) {
+      params.language = argv[++i];
+    } else if ((arg == "-t" || arg == "--threads") && has_value) {
+      params.n_threads = std::atoi(argv[++i]);
+    } else if (arg == "--trigger-ms" && has_value) {
+      params.trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--fixed-trigger") {
+      config.is_adaptive = false;
+    } else if (arg == "--min-trigger-ms" && has_value) {
+      config.min_trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--max-trigger-ms" && has_value) {
+      config.max_trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--min-window-ms" && has_value) {
+      config.min_window_ms = std::atoi(argv[++i]);
+    } else if (arg == "--shed-partials-backlog-ms" && has_value) {
+      config.shed_partials_backlog_ms = std::atoi(argv[++i]);
+    } else if (arg == "--drop-silence-backlog-ms" && has_value) {
+      config.drop_silence_backlog_ms = std::atoi(argv[++i]);
+    } else if (arg == "--fallback-backlog-ms" && has_value) {
+      config.fallback_backlog_ms = std::atoi(argv[++i]);
+    } else if (arg == "--pipelined") {
+      config.is_pipelined = true;
+    } else if (arg == "--refinement") {
+      config.is_refinement = true;
+    } else if (arg == "--refinement-beam-size" && has_value) {
+      config.refinement_beam_size = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--fallback-model" && has_value) {
+      params.fallback_model = argv[++i];
+    } else if (arg == "--partial-model" && has_value) {
+      params.partial_model = argv[++i];
+    } else if (arg == "--draft-model" && has_value) {
+      params.draft_model = argv[++i];
+    } else if (arg == "--draft-tokens" && has_value) {
+      config.n_draft_tokens = std::atoi(argv[++i]);
+    } else if (arg == "--refinement-model" && has_value) {
+      params.refinement_model = argv[++i];
+    } else if (arg == "--cpu-affinity" && has_value) {
+      params.sched_config.cpu_affinity = parse_core_list(argv[++i]);
+    } else if (arg == "--nice" && has_value) {
+      params.sched_config.nice = std::atoi(argv[++i]);
+    } else if (arg == "--realtime-priority") {
+      params.sched_config.realtime = true;
+    } else {
+      fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  config.trigger_ms = params.trigger_ms;
+  return !params.ring_name.empty() || !params.fname_transcribe.empty();
+}
+
+// Serializes the frames written by the result and control threads
+static std::mutex channel_mutex;
+
+static bool send_frame(int fd, stream_frame_type type,
+                       const std::vector<uint8_t> &payload) {
+  std::lock_guard<std::mutex> lock(channel_mutex);
+  return write_stream_frame(fd, type, payload.data(), payload.size());
+}
+
+static bool send_segments(int fd,
+                          const std::vector<transcribed_segment> &segments) {
+  for (const transcribed_segment &segment : segments) {
+    if (!send_frame(fd, STREAM_FRAME_SEGMENT,
+                    encode_segment_frame(segment.is_partial,
+                                         segment.utterance_id,
+                                         segment.text))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Same objects as STTAddon::GetMetrics and GetLatencyHistograms, as JSON
+static std::string metrics_json(SpeechToTextEngine &engine) {
+  std::string json = "{\"iterations\":[";
+  double inference_ms = 0.0;
+  double audio_ms = 0.0;
+  char buffer[512];
+  const std::vector<iteration_metrics> iterations =
+      engine.GetIterationMetrics();
+  for (size_t i = 0; i < iterations.size(); i++) {
+    const iteration_metrics &metrics = iterations[i];
+    snprintf(buffer, sizeof(buffer),
+             "%s{\"queueWaitMs\":%.3f,\"melMs\":%.3f,\"encodeMs\":%.3f,"
+             "\"decodeMs\":%.3f,\"inferenceMs\":%.3f,\"nTokens\":%d,"
+             "\"audioMs\":%.3f,\"rtf\":%.6f,\"triggerMs\":%d,"
+             "\"windowMs\":%d,\"nDraftProposed\":%d,"
+             "\"nDraftAccepted\":%d}",
+             i > 0 ? "," : "", metrics.queue_wait_ms, metrics.mel_ms,
+             metrics.encode_ms, metrics.decode_ms, metrics.inference_ms,
+             metrics.n_tokens, metrics.audio_ms, metrics.rtf,
+             metrics.trigger_ms, metrics.window_ms, metrics.n_draft_proposed,
+             metrics.n_draft_accepted);
+    json += buffer;
+    inference_ms += metrics.inference_ms;
+    audio_ms += metrics.audio_ms;
+  }
+
+  const load_shedding_counters counters = engine.GetLoadSheddingCounters();
+  snprintf(buffer, sizeof(buffer),
+           "],\"rtf\":%.6f,\"loadShedding\":{\"partialsSkipped\":%llu,"
+           "\"silenceDroppedMs\":%.3f,\"fallbackIterations\":%llu}}",
+           audio_ms > 0.0 ? inference_ms / audio_ms : 0.0,
+           (unsigned long long)counters.partials_skipped,
+           counters.silence_dropped_ms,
+           (unsigned long long)counters.fallback_iterations);
+  return json + buffer;
+}
+
+static std::string latency_json(const latency_summary &summary) {
+  char buffer[256];
+  snprintf(buffer, sizeof(buffer),
+           "{\"count\":%llu,\"p50Ms\":%.3f,\"p95Ms\":%.3f,"
+           "\"p99Ms\":%.3f,\"maxMs\":%.3f}",
+           (unsigned long long)summary.count, summary.p50_ms, summary.p95_ms,
+           summary.p99_ms, summary.max_ms);
+  return buffer;
+}
+
+// Answers a request frame, see stream_protocol.h
+static bool reply_request(SpeechToTextEngine &engine,
+                          const host_params &params,
+                          const stream_frame &frame) {
+  const std::string path(frame.payload.begin(), frame.payload.end());
+  std::string reply;
+  switch (frame.type) {
+  case STREAM_FRAME_GET_METRICS:
+    reply = metrics_json(engine);
+    break;
+  case STREAM_FRAME_GET_LATENCY:
+    reply = "{\"partial\":" + latency_json(engine.GetLatencySummary(true)) +
+            ",\"final\":" + latency_json(engine.GetLatencySummary(false)) +
+            "}";
+    break;
+  case STREAM_FRAME_START_TRACING:
+    trace_start();
+    reply = "1";
+    break;
+  case STREAM_FRAME_STOP_TRACING:
+    trace_stop();
+    reply = trace_write(path) ? "1" : "0";
+    break;
+  case STREAM_FRAME_START_RECORDING:
+    reply = engine.StartSessionRecording(path) ? "1" : "0";
+    break;
+  case STREAM_FRAME_STOP_RECORDING:
+    engine.StopSessionRecording();
+    reply = "1";
+    break;
+  default:
+    return false;
+  }
+  send_frame(params.channel_fd, STREAM_FRAME_REPLY,
+             std::vector<uint8_t>(reply.begin(), reply.end()));
+  return true;
+}
+
+static void load_models(SpeechToTextEngine &engine,
+                        const host_params &params) {
+  engine.SetStreamConfiguration(params.stream_config);
+  if (!params.fallback_model.empty() &&
+      !engine.SetFallbackModel(params.fallback_model)) {
+    fprintf(stderr, "failed to load fallback model '%s'\n",
+            params.fallback_model.c_str());
+  }
+  if (!params.partial_model.empty() &&
+      !engine.SetPartialModel(params.partial_model)) {
+    fprintf(stderr, "failed to load partial model '%s'\n",
+            params.partial_model.c_str());
+  }
+  if (!params.draft_model.empty() &&
+      !engine.SetDraftModel(params.draft_model)) {
+    fprintf(stderr, "failed to load draft model '%s'\n",
+            params.draft_model.c_str());
+  }
+  if (!params.refinement_model.empty() &&
+      !engine.SetRefinementModel(params.refinement_model)) {
+    fprintf(stderr, "failed to load refinement model '%s'\n",
+            params.refinement_model.c_str());
+  }
+  engine.SetSchedulingConfiguration(params.sched_config);
+}
+
+// Moves the engine results into the channel, until the control thread clears
+// is_open
+static void send_results(SpeechToTextEngine &engine, const host_params &params,
+                         std::atomic<bool> &is_open) {
+  while (is_open) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(params.poll_ms));
+
+    bool is_sent = send_segments(params.channel_fd,
+                                 engine.GetTranscribedText());
+    for (const segment_update &update : engine.GetSegmentUpdates()) {
+      is_sent = is_sent && send_frame(params.channel_fd, STREAM_FRAME_UPDATE,
+                                      encode_update_frame(update.utterance_id,
+                                                          update.previous_text,
+                                                          update.text));
+    }
+    if (!is_sent) {
+      is_open = false;
+    }
+  }
+}
+
+static int transcribe_file(const host_params &params) {
+  SpeechToTextEngine engine(params.model, params.language.c_str(),
+                            params.n_threads, params.trigger_ms, false);
+  const std::vector<transcribed_segment> segments =
+      engine.TranscribeFileInput(params.fname_transcribe,
+                                 params.transcription_cache);
+  return send_segments(params.channel_fd, segments) ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  host_params params;
+  if (!parse_params(argc, argv, params)) {
+    print_usage(argv[0], params);
+    return 1;
+  }
+  // A closed channel is detected by the failing write instead
+  signal(SIGPIPE, SIG_IGN);
+
+  if (!params.fname_transcribe.empty()) {
+    return transcribe_file(params);
+  }
+
+  SpeechToTextEngine engine(params.model, params.language.c_str(),
+                            params.n_threads, params.trigger_ms, false);
+  load_models(engine, params);
+
+  // Audio written before a restart belongs to the crashed session, the
+  // reader starts at the current write position
+  shm_audio_ring_reader reader;
+  if (!reader.start(params.ring_name, params.poll_ms,
+                    [&engine](const std::vector<float> &samples) {
+                      engine.AddAudioData(samples);
+                    })) {
+    const char *message = "failed to open the audio ring";
+    write_stream_frame(params.channel_fd, STREAM_FRAME_ERROR, message,
+                       strlen(message));
+    return 1;
+  }
+  send_frame(params.channel_fd, STREAM_FRAME_READY, {});
+
+  std::atomic<bool> is_open(true);
+  std::thread results_thread(send_results, std::ref(engine),
+                             std::cref(params), std::ref(is_open));
+
+  bool is_running = false;
+  stream_frame frame;
+  while (is_open && read_stream_frame(params.channel_fd, frame)) {
+    switch (frame.type) {
+    case STREAM_FRAME_START:
+      if (!is_running) {
+        engine.Start();
+        is_running = true;
+      }
+      break;
+    case STREAM_FRAME_STOP:
+      if (is_running) {
+        engine.Stop();
+        is_running = false;
+      }
+      break;
+    case STREAM_FRAME_CLEAR: {
+      uint64_t position = reader.write_position();
+      if (frame.payload.size() == sizeof(position)) {
+        memcpy(&position, frame.payload.data(), sizeof(position));
+      }
+      reader.clear(position, [&engine] { engine.ClearAudioData(); });
+      break;
+    }
+    case STREAM_FRAME_END:
+      is_open = false;
+      break;
+    default:
+      if (!reply_request(engine, params, frame)) {
+        fprintf(stderr, "unexpected frame type %d\n", (int)frame.type);
+      }
+      break;
+    }
+  }
+
+  is_open = false;
+  results_thread.join();
+  reader.stop();
+  if (is_running) {
+    engine.Stop();
+  }
+  return 0;
+}
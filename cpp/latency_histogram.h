@@ -0,0 +1,125 @@
+#ifndef STT_LATENCY_HISTOGRAM_H_
+#define STT_LATENCY_HISTOGRAM_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Percentiles of a latency histogram in milliseconds.
+struct latency_summary {
+  uint64_t count;
+  double p50_ms;
+  double p95_ms;
+  double p99_ms;
+  double max_ms;
+};
+
+// Lock-free latency histogram with HDR-style log-linear buckets. Values are
+// recorded in microseconds, every power of two range is split into 32 linear
+// sub-buckets which bounds the relative error to ~3%. Recording is wait-free
+// and can happen from any thread while another thread reads percentiles.
+class latency_histogram {
+public:
+  latency_histogram() { reset(); }
+
+  void record(uint64_t value_us) {
+    counts[bucket_index(value_us)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = max_us.load(std::memory_order_relaxed);
+    while (value_us > max &&
+           !max_us.compare_exchange_weak(max, value_us,
+                                         std::memory_order_relaxed)) {
+    }
+  }
+
+  void reset() {
+    for (size_t i = 0; i < n_buckets; i++) {
+      counts[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    max_us.store(0, std::memory_order_relaxed);
+  }
+
+  // Returns the highest value (in microseconds) of the bucket which contains
+  // the given percentile (0-100) of all recorded values.
+  uint64_t percentile(double p) const {
+    const uint64_t n = total.load(std::memory_order_relaxed);
+    if (n == 0) {
+      return 0;
+    }
+
+    uint64_t rank = (uint64_t)((p / 100.0) * n + 0.5);
+    if (rank < 1) {
+      rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < n_buckets; i++) {
+      seen += counts[i].load(std::memory_order_relaxed);
+      if (seen >= rank) {
+        const uint64_t upper = bucket_upper_bound(i);
+        const uint64_t max = max_us.load(std::memory_order_relaxed);
+        return upper < max ? upper : max;
+      }
+    }
+    return max_us.load(std::memory_order_relaxed);
+  }
+
+  latency_summary summary() const {
+    latency_summary summary;
+    summary.count = total.load(std::memory_order_relaxed);
+    summary.p50_ms = percentile(50.0) / 1000.0;
+    summary.p95_ms = percentile(95.0) / 1000.0;
+    summary.p99_ms = percentile(99.0) / 1000.0;
+    summary.max_ms = max_us.load(std::memory_order_relaxed) / 1000.0;
+    return summary;
+  }
+
+private:
+  static const int sub_bucket_bits = 5;
+  static const uint64_t sub_bucket_count = 1 << sub_bucket_bits;
+  // Covers values up to 2^40us (~12 days), larger values are clamped
+  static const int max_exponent = 40;
+  static const size_t n_buckets =
+      (max_exponent - sub_bucket_bits + 2) * sub_bucket_count;
+
+  static int highest_bit(uint64_t value) {
+    int bit = 0;
+    while (value >>= 1) {
+      bit++;
+    }
+    return bit;
+  }
+
+  // Values below the sub-bucket count map linearly, above that every power of
+  // two range is indexed by its 5 most significant bits.
+  static size_t bucket_index(uint64_t value) {
+    if (value < sub_bucket_count) {
+      return (size_t)value;
+    }
+    int exponent = highest_bit(value);
+    if (exponent > max_exponent) {
+      return n_buckets - 1;
+    }
+    const int shift = exponent - sub_bucket_bits;
+    const uint64_t mantissa = value >> shift;
+    return (size_t)((shift + 1) * sub_bucket_count +
+                    (mantissa - sub_bucket_count));
+  }
+
+  static uint64_t bucket_upper_bound(size_t index) {
+    if (index < sub_bucket_count) {
+      return index;
+    }
+    const int shift = (int)(index / sub_bucket_count) - 1;
+    const uint64_t mantissa = index % sub_bucket_count + sub_bucket_count;
+    return ((mantissa + 1) << shift) - 1;
+  }
+
+  std::atomic<uint64_t> counts[n_buckets];
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max_us;
+};
+
+#endif // STT_LATENCY_HISTOGRAM_H_
@@ -0,0 +1,311 @@
+// Load test client of the local streaming server (see stt_server.cc).
+//
+// Opens N concurrent connections, streams the same WAV file over each of them
+// either paced in real time like the recorder worklet or as fast as the socket
+// accepts, and reports result counts and latency percentiles over all
+// connections as JSON.
+//
+// Usage:
+//   stt_load_client -s /tmp/stt.sock -f samples/jfk.wav --clients 8
+#include "latency_histogram.h"
+#include "replay.h"
+#include "stream_protocol.h"
+#include "stream_whisper.h"
+#include "whisper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct load_client_params {
+  std::string socket_path = "/tmp/stt.sock";
+  std::string fname_inp;
+  std::string fname_out;
+  int n_clients = 4;
+  // Size of a sent chunk, matches the report size of the recorder worklet
+  int chunk_ms = 200;
+  // Trailing silence sent so the last utterance gets finalized
+  int tail_ms = 2000;
+  // Delay between the connections being opened
+  int ramp_ms = 0;
+  bool is_realtime = true;
+};
+
+// Aggregated over all connections, recorded from the client threads
+struct load_stats {
+  std::atomic<int> n_connected{0};
+  std::atomic<int> n_errors{0};
+  std::atomic<int> n_partials{0};
+  std::atomic<int> n_finals{0};
+  std::atomic<int> n_updates{0};
+  // First audio sent until the first partial arrived
+  latency_histogram first_partial;
+  // Gap between consecutive segments of a connection
+  latency_histogram result_interval;
+  // End frame sent until the server flushed the results and closed, includes
+  // the idle period the server waits for late finals
+  latency_histogram flush;
+};
+
+static void print_usage(const char *argv0, const load_client_params &params) {
+  fprintf(stderr, "usage: %s [options] -f <file.wav>\n\n", argv0);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -h,  --help            show this help message\n");
+  fprintf(stderr, "  -s,  --socket PATH     server socket (default: %s)\n",
+          params.socket_path.c_str());
+  fprintf(stderr, "  -f,  --file FNAME      16kHz WAV file to stream\n");
+  fprintf(stderr, "  -o,  --output FNAME    write the JSON report to a file "
+                  "(default: stdout)\n");
+  fprintf(stderr, "  -c,  --clients N       concurrent connections "
+                  "(default: %d)\n",
+          params.n_clients);
+  fprintf(stderr, "       --chunk-ms N      size of sent chunks "
+                  "(default: %d)\n",
+          params.chunk_ms);
+  fprintf(stderr, "       --tail-ms N       trailing silence (default: %d)\n",
+          params.tail_ms);
+  fprintf(stderr, "       --ramp-ms N       delay between connections "
+                  "(default: %d)\n",
+          params.ramp_ms);
+  fprintf(stderr, "       --fast            send as fast as possible instead "
+                  "of real time\n");
+}
+
+static bool parse_params(int argc, char **argv, load_client_params &params) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-s" || arg == "--socket") && has_value) {
+      params.socket_path = argv[++i];
+    } else if ((arg == "-f" || arg == "--file") && has_value) {
+      params.fname_inp = argv[++i];
+    } else if ((arg == "-o" || arg == "--output") && has_value) {
+      params.fname_out = argv[++i];
+    } else if ((arg == "-c" || arg == "--clients") && has_value) {
+      params.n_clients = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--chunk-ms" && has_value) {
+      params.chunk_ms = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--tail-ms" && has_value) {
+      params.tail_ms = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--ramp-ms" && has_value) {
+      params.ramp_ms = std::max(0, std::atoi(argv[++i]));
+    } else if (arg == "--fast") {
+      params.is_realtime = false;
+    } else {
+      fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return !params.fname_inp.empty();
+}
+
+static int connect_to(const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  if (connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static uint64_t elapsed_us(std::chrono::steady_clock::time_point t_begin,
+                           std::chrono::steady_clock::time_point t_end) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(t_end -
+                                                               t_begin)
+      .count();
+}
+
+// Receives the results of one connection until the server closes it
+static void receive_results(int fd, load_stats &stats,
+                            std::chrono::steady_clock::time_point t_begin,
+                            std::atomic<int64_t> &t_end_sent_us) {
+  bool has_partial = false;
+  bool has_result = false;
+  std::chrono::steady_clock::time_point t_last_result;
+  stream_frame frame;
+  while (read_stream_frame(fd, frame)) {
+    const auto t_now = std::chrono::steady_clock::now();
+    bool is_partial = false;
+    uint64_t utterance_id = 0;
+    std::string previous_text;
+    std::string text;
+    if (frame.type == STREAM_FRAME_SEGMENT &&
+        decode_segment_frame(frame.payload, is_partial, utterance_id, text)) {
+      (is_partial ? stats.n_partials : stats.n_finals)++;
+      if (is_partial && !has_partial) {
+        stats.first_partial.record(elapsed_us(t_begin, t_now));
+        has_partial = true;
+      }
+      if (has_result) {
+        stats.result_interval.record(elapsed_us(t_last_result, t_now));
+      }
+      has_result = true;
+      t_last_result = t_now;
+    } else if (frame.type == STREAM_FRAME_UPDATE &&
+               decode_update_frame(frame.payload, utterance_id,
+                                   previous_text, text)) {
+      stats.n_updates++;
+    } else if (frame.type == STREAM_FRAME_ERROR) {
+      fprintf(stderr, "server error: %.*s\n", (int)frame.payload.size(),
+              (const char *)frame.payload.data());
+      stats.n_errors++;
+    }
+  }
+
+  const int64_t t_end_us = t_end_sent_us.load();
+  if (t_end_us >= 0) {
+    const uint64_t t_close_us =
+        elapsed_us(t_begin, std::chrono::steady_clock::now());
+    stats.flush.record(t_close_us - std::min<uint64_t>(t_close_us, t_end_us));
+  }
+}
+
+static void run_client(const load_client_params &params,
+                       const std::vector<float> &pcmf32, load_stats &stats) {
+  const int fd = connect_to(params.socket_path);
+  if (fd < 0) {
+    stats.n_errors++;
+    return;
+  }
+  stats.n_connected++;
+
+  const auto t_begin = std::chrono::steady_clock::now();
+  std::atomic<int64_t> t_end_sent_us(-1);
+  std::thread receiver(receive_results, fd, std::ref(stats), t_begin,
+                       std::ref(t_end_sent_us));
+
+  const size_t chunk_size = params.chunk_ms * WHISPER_SAMPLE_RATE / 1000;
+  const size_t n_tail = (size_t)params.tail_ms * WHISPER_SAMPLE_RATE / 1000;
+  const size_t n_total = pcmf32.size() + n_tail;
+  std::vector<float> chunk;
+  bool is_sent = true;
+  for (size_t offset = 0; is_sent && offset < n_total;
+       offset += chunk_size) {
+    const size_t n = std::min(chunk_size, n_total - offset);
+    chunk.assign(n, 0.0f);
+    if (offset < pcmf32.size()) {
+      const size_t n_audio = std::min(n, pcmf32.size() - offset);
+      std::copy(pcmf32.begin() + offset, pcmf32.begin() + offset + n_audio,
+                chunk.begin());
+    }
+    if (params.is_realtime) {
+      // Pacing against the stream start, so send delays do not accumulate
+      std::this_thread::sleep_until(
+          t_begin + std::chrono::microseconds(
+                        (uint64_t)offset * 1000000 / WHISPER_SAMPLE_RATE));
+    }
+    is_sent = write_stream_frame(fd, STREAM_FRAME_AUDIO, chunk.data(),
+                                 chunk.size() * sizeof(float));
+  }
+
+  if (is_sent && write_stream_frame(fd, STREAM_FRAME_END, nullptr, 0)) {
+    t_end_sent_us =
+        (int64_t)elapsed_us(t_begin, std::chrono::steady_clock::now());
+  } else {
+    stats.n_errors++;
+    shutdown(fd, SHUT_RDWR);
+  }
+  receiver.join();
+  close(fd);
+}
+
+static void write_latency(FILE *out, const char *name,
+                          const latency_summary &summary) {
+  fprintf(out,
+          "    \"%s\": {\"count\": %llu, \"p50_ms\": %.3f, \"p95_ms\": %.3f, "
+          "\"p99_ms\": %.3f, \"max_ms\": %.3f}",
+          name, (unsigned long long)summary.count, summary.p50_ms,
+          summary.p95_ms, summary.p99_ms, summary.max_ms);
+}
+
+int main(int argc, char **argv) {
+  load_client_params params;
+  if (!parse_params(argc, argv, params)) {
+    print_usage(argv[0], params);
+    return 1;
+  }
+
+  std::vector<float> pcmf32;
+  if (!read_wav(params.fname_inp, pcmf32)) {
+    fprintf(stderr, "error: failed to read WAV file '%s'\n",
+            params.fname_inp.c_str());
+    return 1;
+  }
+
+  // Writes to a closed connection fail with EPIPE instead of killing the client
+  signal(SIGPIPE, SIG_IGN);
+  load_stats stats;
+  const auto t_begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (int i = 0; i < params.n_clients; i++) {
+    if (i > 0 && params.ramp_ms > 0) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(params.ramp_ms));
+    }
+    clients.emplace_back(run_client, std::cref(params), std::cref(pcmf32),
+                         std::ref(stats));
+  }
+  for (std::thread &client : clients) {
+    client.join();
+  }
+  const double wall_ms =
+      elapsed_us(t_begin, std::chrono::steady_clock::now()) / 1000.0;
+
+  FILE *out = stdout;
+  if (!params.fname_out.empty()) {
+    out = fopen(params.fname_out.c_str(), "w");
+    if (out == nullptr) {
+      fprintf(stderr, "error: failed to open '%s'\n", params.fname_out.c_str());
+      return 1;
+    }
+  }
+
+  fprintf(out, "{\n");
+  fprintf(out, "  \"socket\": \"%s\",\n",
+          json_escape(params.socket_path).c_str());
+  fprintf(out, "  \"file\": \"%s\",\n", json_escape(params.fname_inp).c_str());
+  fprintf(out, "  \"mode\": \"%s\",\n",
+          params.is_realtime ? "realtime" : "fast");
+  fprintf(out, "  \"clients\": %d,\n", params.n_clients);
+  fprintf(out, "  \"connected\": %d,\n", stats.n_connected.load());
+  fprintf(out, "  \"errors\": %d,\n", stats.n_errors.load());
+  fprintf(out, "  \"audio_ms\": %.3f,\n",
+          pcmf32.size() * 1000.0 / WHISPER_SAMPLE_RATE);
+  fprintf(out, "  \"wall_ms\": %.3f,\n", wall_ms);
+  fprintf(out, "  \"partials\": %d,\n", stats.n_partials.load());
+  fprintf(out, "  \"finals\": %d,\n", stats.n_finals.load());
+  fprintf(out, "  \"updates\": %d,\n", stats.n_updates.load());
+  fprintf(out, "  \"latency\": {\n");
+  write_latency(out, "first_partial", stats.first_partial.summary());
+  fprintf(out, ",\n");
+  write_latency(out, "result_interval", stats.result_interval.summary());
+  fprintf(out, ",\n");
+  write_latency(out, "flush", stats.flush.summary());
+  fprintf(out, "\n  }\n");
+  fprintf(out, "}\n");
+
+  if (out != stdout) {
+    fclose(out);
+  }
+  return stats.n_errors > 0 ? 1 : 0;
+}
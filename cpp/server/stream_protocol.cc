@@ -0,0 +1,131 @@
+#include "stream_protocol.h"
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+// Plain read/write instead of recv/send, so frames also work over pipes and
+// files. Writers ignore SIGPIPE and see a closed peer as EPIPE.
+
+static bool read_all(int fd, void *data, size_t size) {
+  uint8_t *bytes = (uint8_t *)data;
+  while (size > 0) {
+    const ssize_t n = read(fd, bytes, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+static bool write_all(int fd, const void *data, size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  while (size > 0) {
+    const ssize_t n = write(fd, bytes, size);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    bytes += n;
+    size -= n;
+  }
+  return true;
+}
+
+bool read_stream_frame(int fd, stream_frame &frame) {
+  uint8_t header[5];
+  if (!read_all(fd, header, sizeof(header))) {
+    return false;
+  }
+  uint32_t size = 0;
+  memcpy(&size, header + 1, sizeof(size));
+  if (size > max_stream_frame_size) {
+    return false;
+  }
+
+  frame.type = (stream_frame_type)header[0];
+  frame.payload.resize(size);
+  return size == 0 || read_all(fd, frame.payload.data(), size);
+}
+
+bool write_stream_frame(int fd, stream_frame_type type, const void *payload,
+                        uint32_t size) {
+  uint8_t header[5];
+  header[0] = type;
+  memcpy(header + 1, &size, sizeof(size));
+  return write_all(fd, header, sizeof(header)) &&
+         (size == 0 || write_all(fd, payload, size));
+}
+
+static void append(std::vector<uint8_t> &payload, const void *data,
+                   size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  payload.insert(payload.end(), bytes, bytes + size);
+}
+
+std::vector<uint8_t> encode_segment_frame(bool is_partial,
+                                          uint64_t utterance_id,
+                                          const std::string &text) {
+  std::vector<uint8_t> payload;
+  payload.reserve(1 + sizeof(utterance_id) + text.size());
+  payload.push_back(is_partial ? 1 : 0);
+  append(payload, &utterance_id, sizeof(utterance_id));
+  append(payload, text.data(), text.size());
+  return payload;
+}
+
+bool decode_segment_frame(const std::vector<uint8_t> &payload,
+                          bool &is_partial, uint64_t &utterance_id,
+                          std::string &text) {
+  const size_t header_size = 1 + sizeof(utterance_id);
+  if (payload.size() < header_size) {
+    return false;
+  }
+  is_partial = payload[0] != 0;
+  memcpy(&utterance_id, payload.data() + 1, sizeof(utterance_id));
+  text.assign((const char *)payload.data() + header_size,
+              payload.size() - header_size);
+  return true;
+}
+
+std::vector<uint8_t> encode_update_frame(uint64_t utterance_id,
+                                         const std::string &previous_text,
+                                         const std::string &text) {
+  const uint32_t previous_size = previous_text.size();
+  std::vector<uint8_t> payload;
+  payload.reserve(sizeof(utterance_id) + sizeof(previous_size) +
+                  previous_text.size() + text.size());
+  append(payload, &utterance_id, sizeof(utterance_id));
+  append(payload, &previous_size, sizeof(previous_size));
+  append(payload, previous_text.data(), previous_text.size());
+  append(payload, text.data(), text.size());
+  return payload;
+}
+
+bool decode_update_frame(const std::vector<uint8_t> &payload,
+                         uint64_t &utterance_id, std::string &previous_text,
+                         std::string &text) {
+  uint32_t previous_size = 0;
+  const size_t header_size = sizeof(utterance_id) + sizeof(previous_size);
+  if (payload.size() < header_size) {
+    return false;
+  }
+  memcpy(&utterance_id, payload.data(), sizeof(utterance_id));
+  memcpy(&previous_size, payload.data() + sizeof(utterance_id),
+         sizeof(previous_size));
+  if (payload.size() - header_size < previous_size) {
+    return false;
+  }
+  const char *strings = (const char *)payload.data() + header_size;
+  previous_text.assign(strings, previous_size);
+  text.assign(strings + previous_size,
+              payload.size() - header_size - previous_size);
+  return true;
+}
@@ -0,0 +1,86 @@
+#ifndef STT_SERVER_STREAM_PROTOCOL_H_
+#define STT_SERVER_STREAM_PROTOCOL_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Framing of the local streaming server (see stt_server.cc) and of the control
+// channel of the inference host (see host/stt_host.cc). Both directions of a
+// connection carry a sequence of frames.
+//
+// Binary layout (little endian):
+//   frame:   uint8 type | uint32 payload size | payload
+//   audio:   n * float32 16kHz mono samples
+//   segment: uint8 is_partial | uint64 utterance id | UTF-8 text
+//   update:  uint64 utterance id | uint32 size of previous text |
+//            previous text | UTF-8 text
+//   clear:   empty, or uint64 audio ring position (inference host only)
+//
+// Clients send audio, clear and end frames. After an end frame the server
+// flushes the remaining segments and closes the connection.
+//
+// The inference host receives its audio through a shm_audio_ring instead of
+// audio frames. A clear frame carries the ring position at the time of the
+// clear, samples before it are discarded. Start and stop frames control the
+// engine, the host reports ready once the models are loaded.
+//
+// Requests of the inference host (metrics, latency, tracing and session
+// recording) carry the UTF-8 path of the file to write, if any. The host
+// answers every request with a reply frame in the order of the requests, the
+// payload is the JSON result: the metrics and latency objects of the addon,
+// or 1 on success and 0 on failure.
+
+enum stream_frame_type : uint8_t {
+  // Client to server
+  STREAM_FRAME_AUDIO = 1,
+  STREAM_FRAME_CLEAR = 2,
+  STREAM_FRAME_END = 3,
+  STREAM_FRAME_START = 4,
+  STREAM_FRAME_STOP = 5,
+  STREAM_FRAME_GET_METRICS = 6,
+  STREAM_FRAME_GET_LATENCY = 7,
+  STREAM_FRAME_START_TRACING = 8,
+  STREAM_FRAME_STOP_TRACING = 9,
+  STREAM_FRAME_START_RECORDING = 10,
+  STREAM_FRAME_STOP_RECORDING = 11,
+  // Server to client
+  STREAM_FRAME_SEGMENT = 16,
+  STREAM_FRAME_UPDATE = 17,
+  STREAM_FRAME_ERROR = 18,
+  STREAM_FRAME_READY = 19,
+  STREAM_FRAME_REPLY = 20,
+};
+
+// Upper bound of a payload, larger frames are treated as a protocol error
+static const uint32_t max_stream_frame_size = 16 * 1024 * 1024;
+
+struct stream_frame {
+  stream_frame_type type;
+  std::vector<uint8_t> payload;
+};
+
+// Reads one complete frame from a blocking socket or pipe. Returns false on
+// EOF, on a read error or on an oversized frame.
+bool read_stream_frame(int fd, stream_frame &frame);
+
+// Writes one complete frame to a blocking socket or pipe. Not thread safe,
+// concurrent writers have to serialize their calls. Callers ignore SIGPIPE.
+bool write_stream_frame(int fd, stream_frame_type type, const void *payload,
+                        uint32_t size);
+
+std::vector<uint8_t> encode_segment_frame(bool is_partial,
+                                          uint64_t utterance_id,
+                                          const std::string &text);
+bool decode_segment_frame(const std::vector<uint8_t> &payload,
+                          bool &is_partial, uint64_t &utterance_id,
+                          std::string &text);
+
+std::vector<uint8_t> encode_update_frame(uint64_t utterance_id,
+                                         const std::string &previous_text,
+                                         const std::string &text);
+bool decode_update_frame(const std::vector<uint8_t> &payload,
+                         uint64_t &utterance_id, std::string &previous_text,
+                         std::string &text);
+
+#endif // STT_SERVER_STREAM_PROTOCOL_H_
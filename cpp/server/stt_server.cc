@@ -0,0 +1,318 @@
+// Local streaming server around the SpeechToTextEngine for headless machines.
+//
+// Listens on a Unix domain socket, every accepted connection gets its own
+// engine session. Clients stream 16kHz float32 PCM, the server streams the
+// partial and final segments back as they are produced (see
+// stream_protocol.h). Sessions share the loaded model and the CPU thread
+// budget, the model stays resident between connections.
+//
+// Usage:
+//   stt_server -m models/ggml-base.bin --socket /tmp/stt.sock
+#include "shared_model.h"
+#include "stream_protocol.h"
+#include "stream_whisper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+struct server_params {
+  std::string model = "whisper.cpp/models/ggml-base.bin";
+  std::string socket_path = "/tmp/stt.sock";
+  std::string language = "en";
+  int n_threads = 4;
+  int trigger_ms = 400;
+  int max_sessions = 8;
+  // Polling interval of the engine results per connection
+  int poll_ms = 50;
+  // After an end frame, results are flushed until the engine was idle this
+  // long
+  int flush_idle_ms = 1500;
+  bool is_pipelined = false;
+  bool is_refinement = false;
+};
+
+static void print_usage(const char *argv0, const server_params &params) {
+  fprintf(stderr, "usage: %s [options]\n\n", argv0);
+  fprintf(stderr, "options:\n");
+  fprintf(stderr, "  -h,  --help            show this help message\n");
+  fprintf(stderr, "  -m,  --model FNAME     model path (default: %s)\n",
+          params.model.c_str());
+  fprintf(stderr, "  -s,  --socket PATH     Unix socket to listen on "
+                  "(default: %s)\n",
+          params.socket_path.c_str());
+  fprintf(stderr, "  -l,  --language LANG   spoken language (default: %s)\n",
+          params.language.c_str());
+  fprintf(stderr, "  -t,  --threads N       inference threads per session "
+                  "(default: %d)\n",
+          params.n_threads);
+  fprintf(stderr, "       --trigger-ms N    engine trigger (default: %d)\n",
+          params.trigger_ms);
+  fprintf(stderr, "       --max-sessions N  concurrent connections, further "
+                  "ones are rejected (default: %d)\n",
+          params.max_sessions);
+  fprintf(stderr, "       --poll-ms N       result polling interval "
+                  "(default: %d)\n",
+          params.poll_ms);
+  fprintf(stderr, "       --pipelined       overlap encoder and decoder of "
+                  "consecutive windows\n");
+  fprintf(stderr, "       --refinement      refine finals in the background "
+                  "and send updates\n");
+}
+
+static bool parse_params(int argc, char **argv, server_params &params) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+
+    if (arg == "-h" || arg == "--help") {
+      return false;
+    } else if ((arg == "-m" || arg == "--model") && has_value) {
+      params.model = argv[++i];
+    } else if ((arg == "-s" || arg == "--socket") && has_value) {
+      params.socket_path = argv[++i];
+    } else if ((arg == "-l" || arg == "--language") && has_value) {
+      params.language = argv[++i];
+    } else if ((arg == "-t" || arg == "--threads") && has_value) {
+      params.n_threads = std::atoi(argv[++i]);
+    } else if (arg == "--trigger-ms" && has_value) {
+      params.trigger_ms = std::atoi(argv[++i]);
+    } else if (arg == "--max-sessions" && has_value) {
+      params.max_sessions = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--poll-ms" && has_value) {
+      params.poll_ms = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--pipelined") {
+      params.is_pipelined = true;
+    } else if (arg == "--refinement") {
+      params.is_refinement = true;
+    } else {
+      fprintf(stderr, "error: unknown argument: %s\n", arg.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+static std::atomic<int> n_active_sessions(0);
+
+// Engine session of one connection. The reading side feeds the engine, a
+// sender thread polls the results and writes them back.
+class connection_session {
+public:
+  connection_session(int fd, const server_params &params)
+      : fd(fd), params(params), is_reading(true), is_failed(false) {}
+
+  void run() {
+    SpeechToTextEngine engine(params.model, params.language.c_str(),
+                              params.n_threads, params.trigger_ms, false);
+    stream_configuration stream_config;
+    stream_config.trigger_ms = params.trigger_ms;
+    stream_config.is_pipelined = params.is_pipelined;
+    stream_config.is_refinement = params.is_refinement;
+    engine.SetStreamConfiguration(stream_config);
+    engine.Start();
+
+    std::thread sender([this, &engine] { send_results(engine); });
+    const bool is_ended = read_requests(engine);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      is_reading = false;
+      // A vanished client is not flushed
+      is_failed = is_failed || !is_ended;
+    }
+    cv.notify_all();
+    sender.join();
+    engine.Stop();
+  }
+
+private:
+  // Returns true when the client ended the stream with an end frame
+  bool read_requests(SpeechToTextEngine &engine) {
+    stream_frame frame;
+    std::vector<float> samples;
+    while (read_stream_frame(fd, frame)) {
+      switch (frame.type) {
+      case STREAM_FRAME_AUDIO:
+        if (frame.payload.size() % sizeof(float) != 0) {
+          send_error("audio frame is not a multiple of float32 samples");
+          return false;
+        }
+        samples.resize(frame.payload.size() / sizeof(float));
+        memcpy(samples.data(), frame.payload.data(), frame.payload.size());
+        engine.AddAudioData(samples);
+        break;
+      case STREAM_FRAME_CLEAR:
+        engine.ClearAudioData();
+        break;
+      case STREAM_FRAME_END:
+        return true;
+      default:
+        send_error("unexpected frame type");
+        return false;
+      }
+    }
+    return false;
+  }
+
+  void send_results(SpeechToTextEngine &engine) {
+    auto t_last_result = std::chrono::steady_clock::now();
+    bool was_flushing = false;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!is_failed) {
+      cv.wait_for(lock, std::chrono::milliseconds(params.poll_ms));
+      if (is_failed) {
+        break;
+      }
+      const bool is_flushing = !is_reading;
+      lock.unlock();
+
+      const std::vector<transcribed_segment> segments =
+          engine.GetTranscribedText();
+      const std::vector<segment_update> updates = engine.GetSegmentUpdates();
+      bool is_sent = true;
+      for (const transcribed_segment &segment : segments) {
+        const std::vector<uint8_t> payload = encode_segment_frame(
+            segment.is_partial, segment.utterance_id, segment.text);
+        is_sent = is_sent && write_frame(STREAM_FRAME_SEGMENT, payload);
+      }
+      for (const segment_update &update : updates) {
+        const std::vector<uint8_t> payload = encode_update_frame(
+            update.utterance_id, update.previous_text, update.text);
+        is_sent = is_sent && write_frame(STREAM_FRAME_UPDATE, payload);
+      }
+
+      const auto t_now = std::chrono::steady_clock::now();
+      // The idle time of the flush counts from the end frame at the earliest
+      if (!segments.empty() || !updates.empty() || !was_flushing) {
+        t_last_result = t_now;
+      }
+      was_flushing = is_flushing;
+      lock.lock();
+      if (!is_sent) {
+        is_failed = true;
+      } else if (is_flushing &&
+                 t_now - t_last_result >=
+                     std::chrono::milliseconds(params.flush_idle_ms)) {
+        break;
+      }
+    }
+    // Unblocks the reader when the client stopped reading results
+    shutdown(fd, SHUT_RDWR);
+  }
+
+  bool write_frame(stream_frame_type type,
+                   const std::vector<uint8_t> &payload) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    return write_stream_frame(fd, type, payload.data(), payload.size());
+  }
+
+  void send_error(const char *message) {
+    std::lock_guard<std::mutex> lock(write_mutex);
+    write_stream_frame(fd, STREAM_FRAME_ERROR, message, strlen(message));
+  }
+
+  const int fd;
+  const server_params &params;
+  std::mutex mutex;
+  std::condition_variable cv;
+  // Guarded by mutex
+  bool is_reading;
+  bool is_failed;
+  // Serializes the frames of the sender and error replies of the reader
+  std::mutex write_mutex;
+};
+
+static void serve_connection(int fd, const server_params &params) {
+  connection_session session(fd, params);
+  session.run();
+  close(fd);
+  n_active_sessions--;
+}
+
+static int listen_on(const std::string &path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "error: socket path too long: %s\n", path.c_str());
+    return -1;
+  }
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    perror("socket");
+    return -1;
+  }
+  // A stale socket file of a previous run would fail the bind
+  unlink(path.c_str());
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0 ||
+      listen(fd, SOMAXCONN) != 0) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int main(int argc, char **argv) {
+  server_params params;
+  if (!parse_params(argc, argv, params)) {
+    print_usage(argv[0], params);
+    return 1;
+  }
+
+  // Held for the lifetime of the server, so sessions of later connections
+  // reuse the loaded model
+  std::shared_ptr<whisper_context> model = load_shared_model(params.model);
+  if (!model) {
+    fprintf(stderr, "error: failed to load model '%s'\n",
+            params.model.c_str());
+    return 1;
+  }
+
+  // Writes to a vanished client fail with EPIPE instead of killing the server
+  signal(SIGPIPE, SIG_IGN);
+  const int listen_fd = listen_on(params.socket_path);
+  if (listen_fd < 0) {
+    return 1;
+  }
+  fprintf(stderr, "listening on %s\n", params.socket_path.c_str());
+
+  while (true) {
+    const int fd = accept(listen_fd, nullptr, nullptr);
+    if (fd < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("accept");
+      break;
+    }
+    if (n_active_sessions >= params.max_sessions) {
+      const char *message = "too many sessions";
+      write_stream_frame(fd, STREAM_FRAME_ERROR, message, strlen(message));
+      close(fd);
+      continue;
+    }
+    n_active_sessions++;
+    std::thread(serve_connection, fd, std::cref(params)).detach();
+  }
+
+  close(listen_fd);
+  unlink(params.socket_path.c_str());
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include "session_recorder.h"
+
+#include <cstring>
+
+static const char session_log_magic[8] = {'S', 'T', 'T', 'R',
+                                          'E', 'C', '0', '1'};
+
+session_recorder::session_recorder() : file(nullptr) {}
+
+session_recorder::~session_recorder() { close(); }
+
+bool session_recorder::open(const std::string &path, int sample_rate) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file != nullptr) {
+    fclose(file);
+  }
+
+  file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+
+  const uint32_t rate = sample_rate;
+  fwrite(session_log_magic, sizeof(session_log_magic), 1, file);
+  fwrite(&rate, sizeof(rate), 1, file);
+  t_begin = std::chrono::steady_clock::now();
+  return true;
+}
+
+void session_recorder::close() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (file != nullptr) {
+    fclose(file);
+    file = nullptr;
+  }
+}
+
+bool session_recorder::is_open() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return file != nullptr;
+}
+
+void session_recorder::record_audio(const std::vector<float> &samples) {
+  std::lock_guard<std::mutex> lock(mutex);
+  write_record(SESSION_EVENT_AUDIO, samples.data(), samples.size());
+}
+
+void session_recorder::record_event(session_event_type type) {
+  std::lock_guard<std::mutex> lock(mutex);
+  write_record(type, nullptr, 0);
+}
+
+void session_recorder::write_record(session_event_type type,
+                                    const float *samples, uint32_t n_samples) {
+  if (file == nullptr) {
+    return;
+  }
+
+  const uint8_t record_type = type;
+  const uint64_t t_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - t_begin)
+                            .count();
+  fwrite(&record_type, sizeof(record_type), 1, file);
+  fwrite(&t_us, sizeof(t_us), 1, file);
+  fwrite(&n_samples, sizeof(n_samples), 1, file);
+  if (n_samples > 0) {
+    fwrite(samples, sizeof(float), n_samples, file);
+  }
+  // Control events are rare, flushing them keeps the log usable when the
+  // application crashes right after.
+  if (type != SESSION_EVENT_AUDIO) {
+    fflush(file);
+  }
+}
+
+bool read_session_log(const std::string &path,
+                      std::vector<session_event> &events, int &sample_rate) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+
+  char magic[8];
+  uint32_t rate = 0;
+  if (fread(magic, sizeof(magic), 1, file) != 1 ||
+      memcmp(magic, session_log_magic, sizeof(magic)) != 0 ||
+      fread(&rate, sizeof(rate), 1, file) != 1) {
+    fprintf(stderr, "%s: '%s' is not a session log\n", __func__, path.c_str());
+    fclose(file);
+    return false;
+  }
+  sample_rate = rate;
+
+  while (true) {
+    uint8_t type = 0;
+    uint64_t t_us = 0;
+    uint32_t n_samples = 0;
+    if (fread(&type, sizeof(type), 1, file) != 1 ||
+        fread(&t_us, sizeof(t_us), 1, file) != 1 ||
+        fread(&n_samples, sizeof(n_samples), 1, file) != 1) {
+      break;
+    }
+
+    session_event event;
+    event.type = (session_event_type)type;
+    event.t_us = t_us;
+    event.samples.resize(n_samples);
+    if (n_samples > 0 &&
+        fread(event.samples.data(), sizeof(float), n_samples, file) !=
+            n_samples) {
+      break;
+    }
+    events.push_back(std::move(event));
+  }
+
+  fclose(file);
+  return true;
+}
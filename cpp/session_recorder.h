@@ -0,0 +1,56 @@
+#ifndef STT_SESSION_RECORDER_H_
+#define STT_SESSION_RECORDER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Capture of the engine input of a live session. The log stores every chunk
+// passed to AddAudioData and every Clear/Stop call with its arrival time, so a
+// session from the field can be replayed deterministically.
+//
+// Binary layout (little endian):
+//   header: "STTREC01" | uint32 sample rate
+//   record: uint8 type | uint64 arrival in us since start | uint32 n_samples |
+//           n_samples * float32 (audio records only)
+
+enum session_event_type : uint8_t {
+  SESSION_EVENT_AUDIO = 1,
+  SESSION_EVENT_CLEAR = 2,
+  SESSION_EVENT_STOP = 3,
+};
+
+struct session_event {
+  session_event_type type;
+  uint64_t t_us;
+  std::vector<float> samples;
+};
+
+class session_recorder {
+public:
+  session_recorder();
+  ~session_recorder();
+  bool open(const std::string &path, int sample_rate);
+  void close();
+  bool is_open();
+  void record_audio(const std::vector<float> &samples);
+  void record_event(session_event_type type);
+
+private:
+  void write_record(session_event_type type, const float *samples,
+                    uint32_t n_samples);
+
+  std::mutex mutex;
+  FILE *file;
+  std::chrono::steady_clock::time_point t_begin;
+};
+
+// Reads all events of a session log. Returns false when the file is not a
+// session log, a truncated last record (e.g. after a crash) is ignored.
+bool read_session_log(const std::string &path,
+                      std::vector<session_event> &events, int &sample_rate);
+
+#endif // STT_SESSION_RECORDER_H_
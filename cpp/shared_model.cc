@@ -0,0 +1,92 @@
+#include "shared_model.h"
+
+#include <algorithm>
+#include <map>
+#include <thread>
+
+std::shared_ptr<struct whisper_context>
+load_shared_model(const std::string &path_model) {
+  static std::mutex s_mutex;
+  static std::map<std::string, std::weak_ptr<struct whisper_context>> models;
+
+  // Loading under the lock, so two sessions starting with the same model at
+  // the same time do not load it twice.
+  std::lock_guard<std::mutex> lock(s_mutex);
+  std::shared_ptr<struct whisper_context> model = models[path_model].lock();
+  if (model) {
+    return model;
+  }
+
+  struct whisper_context *ctx = whisper_init_from_file_with_params_no_state(
+      path_model.c_str(), whisper_context_default_params());
+  if (!ctx) {
+    models.erase(path_model);
+    return nullptr;
+  }
+  model.reset(ctx, whisper_free);
+  models[path_model] = model;
+  return model;
+}
+
+thread_budget::thread_budget(int n_threads_total)
+    : n_threads_total(std::max(1, n_threads_total)), n_threads_in_use(0),
+      n_sessions(0), next_ticket(0), serving_ticket(0) {}
+
+void thread_budget::add_session() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  n_sessions++;
+}
+
+void thread_budget::remove_session() {
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    n_sessions--;
+  }
+  // A larger share for the remaining sessions
+  s_cv.notify_all();
+}
+
+int thread_budget::acquire(int n_requested) {
+  std::unique_lock<std::mutex> lock(s_mutex);
+  const uint64_t ticket = next_ticket++;
+  s_cv.wait(lock, [this, ticket] {
+    return ticket == serving_ticket && n_threads_in_use < n_threads_total;
+  });
+
+  const int n_share = std::max(1, n_threads_total / std::max(1, n_sessions));
+  const int n_granted =
+      std::max(1, std::min({n_requested, n_share,
+                            n_threads_total - n_threads_in_use}));
+  n_threads_in_use += n_granted;
+  serving_ticket++;
+  lock.unlock();
+  s_cv.notify_all();
+  return n_granted;
+}
+
+void thread_budget::release(int n_threads) {
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    n_threads_in_use -= n_threads;
+  }
+  s_cv.notify_all();
+}
+
+std::shared_ptr<thread_budget> shared_thread_budget() {
+  static std::shared_ptr<thread_budget> budget =
+      std::make_shared<thread_budget>(std::thread::hardware_concurrency());
+  return budget;
+}
+
+thread_lease::thread_lease(thread_budget *budget, int n_requested)
+    : budget(budget), n_granted(n_requested) {
+  if (budget) {
+    n_granted = budget->acquire(n_requested);
+  }
+}
+
+thread_lease::~thread_lease() {
+  if (budget) {
+    budget->release(n_granted);
+  }
+}
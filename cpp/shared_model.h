@@ -0,0 +1,67 @@
+#ifndef STT_SHARED_MODEL_H_
+#define STT_SHARED_MODEL_H_
+
+#include "whisper.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// Loads the model at the path, or returns the context another engine of the
+// process already loaded from it, so concurrent sessions hold each model only
+// once in memory. The context is freed together with its last user. Shared
+// contexts are loaded without a default state, all inference has to run on
+// whisper states of the caller (whisper_full_with_state). Returns nullptr when
+// the model could not be loaded.
+std::shared_ptr<struct whisper_context>
+load_shared_model(const std::string &path_model);
+
+// Fair share of the CPU threads among the sessions of a process. Every
+// inference leases its threads from the budget, a session gets at most the
+// cores divided by the number of active sessions and never more than are
+// free. Leases are granted in request order, so a busy session can not starve
+// the others.
+class thread_budget {
+public:
+  explicit thread_budget(int n_threads_total);
+
+  void add_session();
+  void remove_session();
+  // Blocks until at least one thread is free, returns the number of granted
+  // threads (1 <= granted <= n_requested).
+  int acquire(int n_requested);
+  void release(int n_threads);
+
+private:
+  std::mutex s_mutex;
+  std::condition_variable s_cv;
+  int n_threads_total;
+  int n_threads_in_use;
+  int n_sessions;
+  // Next ticket to hand out and the ticket which is served next
+  uint64_t next_ticket;
+  uint64_t serving_ticket;
+};
+
+// Budget of all engines in the process, sized to the hardware threads.
+std::shared_ptr<thread_budget> shared_thread_budget();
+
+// Threads of one inference, released at the end of the scope. Without budget
+// the requested threads are used as is.
+class thread_lease {
+public:
+  thread_lease(thread_budget *budget, int n_requested);
+  ~thread_lease();
+  thread_lease(const thread_lease &) = delete;
+  thread_lease &operator=(const thread_lease &) = delete;
+
+  int n_threads() const { return n_granted; }
+
+private:
+  thread_budget *budget;
+  int n_granted;
+};
+
+#endif // STT_SHARED_MODEL_H_
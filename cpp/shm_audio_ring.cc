@@ -0,0 +1,256 @@
+#include "shm_audio_ring.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <new>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char shm_ring_magic[8] = {'S', 'T', 'T', 'R',
+                                       'I', 'N', 'G', '1'};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "ring positions are shared between processes");
+
+// Producer and consumer positions live on separate cache lines, so the two
+// processes do not invalidate each other's line on every update.
+struct shm_audio_ring::shared_header {
+  char magic[8];
+  uint64_t capacity;
+  alignas(64) std::atomic<uint64_t> write_pos;
+  std::atomic<uint64_t> n_dropped;
+  alignas(64) std::atomic<uint64_t> read_pos;
+};
+
+shm_audio_ring::shm_audio_ring()
+    : header(nullptr), samples(nullptr), mapped_size(0) {}
+
+shm_audio_ring::~shm_audio_ring() { close(); }
+
+#ifndef _WIN32
+
+bool shm_audio_ring::create(const std::string &name, size_t min_capacity) {
+  close();
+  // Power of two capacity, the slot of a position is a mask of it
+  uint64_t capacity = 1;
+  while (capacity < min_capacity) {
+    capacity <<= 1;
+  }
+
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "%s: failed to create '%s'\n", __func__, name.c_str());
+    return false;
+  }
+  const size_t size = sizeof(shared_header) + capacity * sizeof(float);
+  void *mapped = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "%s: failed to map '%s'\n", __func__, name.c_str());
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  header = new (mapped) shared_header();
+  header->capacity = capacity;
+  header->write_pos.store(0, std::memory_order_relaxed);
+  header->n_dropped.store(0, std::memory_order_relaxed);
+  header->read_pos.store(0, std::memory_order_relaxed);
+  // Published last, a consumer opening the segment early rejects it
+  memcpy(header->magic, shm_ring_magic, sizeof(shm_ring_magic));
+  samples = (float *)(header + 1);
+  mapped_size = size;
+  owned_name = name;
+  return true;
+}
+
+bool shm_audio_ring::open(const std::string &name) {
+  close();
+  const int fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, name.c_str());
+    return false;
+  }
+  struct stat st;
+  void *mapped = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(shared_header)) {
+    mapped = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                  0);
+  }
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    fprintf(stderr, "%s: failed to map '%s'\n", __func__, name.c_str());
+    return false;
+  }
+
+  shared_header *shared = (shared_header *)mapped;
+  if (memcmp(shared->magic, shm_ring_magic, sizeof(shm_ring_magic)) != 0 ||
+      sizeof(shared_header) + shared->capacity * sizeof(float) >
+          (size_t)st.st_size) {
+    fprintf(stderr, "%s: '%s' is not an audio ring\n", __func__,
+            name.c_str());
+    munmap(mapped, st.st_size);
+    return false;
+  }
+  header = shared;
+  samples = (float *)(header + 1);
+  mapped_size = st.st_size;
+  return true;
+}
+
+void shm_audio_ring::close() {
+  if (header != nullptr) {
+    munmap(header, mapped_size);
+    header = nullptr;
+    samples = nullptr;
+    mapped_size = 0;
+  }
+  if (!owned_name.empty()) {
+    shm_unlink(owned_name.c_str());
+    owned_name.clear();
+  }
+}
+
+#else
+
+bool shm_audio_ring::create(const std::string &, size_t) { return false; }
+
+bool shm_audio_ring::open(const std::string &) { return false; }
+
+void shm_audio_ring::close() {}
+
+#endif
+
+size_t shm_audio_ring::write(const float *data, size_t n_samples) {
+  if (header == nullptr) {
+    return 0;
+  }
+  const uint64_t capacity = header->capacity;
+  const uint64_t write_pos =
+      header->write_pos.load(std::memory_order_relaxed);
+  const uint64_t read_pos = header->read_pos.load(std::memory_order_acquire);
+  const size_t n =
+      std::min<uint64_t>(n_samples, capacity - (write_pos - read_pos));
+
+  const size_t offset = write_pos & (capacity - 1);
+  const size_t n_first = std::min<size_t>(n, capacity - offset);
+  memcpy(samples + offset, data, n_first * sizeof(float));
+  memcpy(samples, data + n_first, (n - n_first) * sizeof(float));
+  header->write_pos.store(write_pos + n, std::memory_order_release);
+
+  if (n < n_samples) {
+    header->n_dropped.fetch_add(n_samples - n, std::memory_order_relaxed);
+  }
+  return n;
+}
+
+size_t shm_audio_ring::read(float *data, size_t max_samples) {
+  if (header == nullptr) {
+    return 0;
+  }
+  const uint64_t capacity = header->capacity;
+  const uint64_t read_pos = header->read_pos.load(std::memory_order_relaxed);
+  const uint64_t write_pos =
+      header->write_pos.load(std::memory_order_acquire);
+  const size_t n = std::min<uint64_t>(max_samples, write_pos - read_pos);
+
+  const size_t offset = read_pos & (capacity - 1);
+  const size_t n_first = std::min<size_t>(n, capacity - offset);
+  memcpy(data, samples + offset, n_first * sizeof(float));
+  memcpy(data + n_first, samples, (n - n_first) * sizeof(float));
+  header->read_pos.store(read_pos + n, std::memory_order_release);
+  return n;
+}
+
+void shm_audio_ring::discard_until(uint64_t position) {
+  if (header == nullptr) {
+    return;
+  }
+  const uint64_t read_pos = header->read_pos.load(std::memory_order_relaxed);
+  const uint64_t write_pos =
+      header->write_pos.load(std::memory_order_acquire);
+  const uint64_t target = std::min(position, write_pos);
+  if (target > read_pos) {
+    header->read_pos.store(target, std::memory_order_release);
+  }
+}
+
+uint64_t shm_audio_ring::write_position() const {
+  return header != nullptr ? header->write_pos.load(std::memory_order_acquire)
+                           : 0;
+}
+
+uint64_t shm_audio_ring::dropped_samples() const {
+  return header != nullptr
+             ? header->n_dropped.load(std::memory_order_relaxed)
+             : 0;
+}
+
+shm_audio_ring_reader::shm_audio_ring_reader() : is_stopped(true) {}
+
+shm_audio_ring_reader::~shm_audio_ring_reader() { stop(); }
+
+bool shm_audio_ring_reader::start(const std::string &name, int poll_ms,
+                                  samples_callback samples_callback) {
+  stop();
+  if (!ring.open(name)) {
+    return false;
+  }
+  ring.discard_until(ring.write_position());
+  callback = std::move(samples_callback);
+  is_stopped = false;
+  worker = std::thread(&shm_audio_ring_reader::run, this, poll_ms);
+  return true;
+}
+
+void shm_audio_ring_reader::stop() {
+  is_stopped = true;
+  if (worker.joinable()) {
+    worker.join();
+  }
+  ring.close();
+}
+
+void shm_audio_ring_reader::clear(uint64_t position,
+                                  const std::function<void()> &on_clear) {
+  std::lock_guard<std::mutex> lock(mutex);
+  ring.discard_until(position);
+  on_clear();
+}
+
+uint64_t shm_audio_ring_reader::write_position() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return ring.write_position();
+}
+
+void shm_audio_ring_reader::run(int poll_ms) {
+  // One second of 16kHz audio per read, larger backlogs take several reads
+  std::vector<float> chunk(16000);
+  std::vector<float> samples;
+  while (!is_stopped) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(poll_ms));
+
+    std::lock_guard<std::mutex> lock(mutex);
+    samples.clear();
+    size_t n = 0;
+    while ((n = ring.read(chunk.data(), chunk.size())) > 0) {
+      samples.insert(samples.end(), chunk.begin(), chunk.begin() + n);
+    }
+    // Delivered under the lock, so a clear cannot slip in between reading the
+    // samples and handing them over
+    if (!samples.empty()) {
+      callback(samples);
+    }
+  }
+}
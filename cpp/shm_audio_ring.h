@@ -0,0 +1,83 @@
+#ifndef STT_SHM_AUDIO_RING_H_
+#define STT_SHM_AUDIO_RING_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Single producer, single consumer ring of float32 samples in POSIX shared
+// memory, which hands audio from the application to the inference host
+// process (see host/stt_host.cc) without copying it through a pipe.
+//
+// The producer creates the segment and owns its name, the consumer opens it.
+// Positions count samples since the creation and never wrap, the slot of a
+// position is its value modulo the capacity. Samples which do not fit are
+// dropped and counted instead of blocking the producer.
+class shm_audio_ring {
+public:
+  shm_audio_ring();
+  ~shm_audio_ring();
+  shm_audio_ring(const shm_audio_ring &) = delete;
+  shm_audio_ring &operator=(const shm_audio_ring &) = delete;
+
+  // Creates the segment with room for at least the given number of samples,
+  // replacing a stale segment of the same name.
+  bool create(const std::string &name, size_t min_capacity);
+  bool open(const std::string &name);
+  // Unmaps the segment, the creator also removes its name
+  void close();
+  bool is_open() const { return header != nullptr; }
+
+  // Producer side, returns the number of samples written
+  size_t write(const float *samples, size_t n_samples);
+  // Consumer side, returns the number of samples read
+  size_t read(float *samples, size_t max_samples);
+  // Consumer side, skips all samples before the given position
+  void discard_until(uint64_t position);
+
+  uint64_t write_position() const;
+  uint64_t dropped_samples() const;
+
+private:
+  struct shared_header;
+
+  shared_header *header;
+  float *samples;
+  size_t mapped_size;
+  std::string owned_name;
+};
+
+// Consumer which drains a ring on a background thread and hands the samples
+// to a callback, e.g. SpeechToTextEngine::AddAudioData of the inference host.
+class shm_audio_ring_reader {
+public:
+  typedef std::function<void(const std::vector<float> &)> samples_callback;
+
+  shm_audio_ring_reader();
+  ~shm_audio_ring_reader();
+
+  // Opens the ring and delivers the samples written from now on
+  bool start(const std::string &name, int poll_ms, samples_callback callback);
+  void stop();
+
+  // Discards the samples before the position and runs the function before any
+  // later sample is delivered
+  void clear(uint64_t position, const std::function<void()> &on_clear);
+  uint64_t write_position();
+
+private:
+  void run(int poll_ms);
+
+  shm_audio_ring ring;
+  samples_callback callback;
+  std::mutex mutex;
+  std::atomic<bool> is_stopped;
+  std::thread worker;
+};
+
+#endif // STT_SHM_AUDIO_RING_H_
@@ -0,0 +1,219 @@
+#include "speculative_decoder.h"
+#include "whisper_ext.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+static double elapsed_ms(std::chrono::steady_clock::time_point t_begin,
+                         std::chrono::steady_clock::time_point t_end) {
+  return std::chrono::duration<double, std::milli>(t_end - t_begin).count();
+}
+
+speculative_decoder::speculative_decoder(struct whisper_context *target,
+                                         struct whisper_context *draft,
+                                         const char *language, int n_threads,
+                                         int n_draft)
+    : target(target), draft(draft), target_state(nullptr),
+      draft_state(nullptr), blank(-1), n_threads(n_threads),
+      n_draft(n_draft) {
+  target_state = whisper_init_state(target);
+
+  // Draft tokens can only be verified when both models share the tokenizer
+  if (draft && (whisper_n_vocab(draft) != whisper_n_vocab(target) ||
+                whisper_is_multilingual(draft) !=
+                    whisper_is_multilingual(target))) {
+    fprintf(stderr,
+            "%s: draft model does not share the vocabulary of the target "
+            "model, speculative decoding disabled\n",
+            __func__);
+    this->draft = nullptr;
+  }
+  if (this->draft) {
+    draft_state = whisper_init_state(this->draft);
+  }
+
+  // Same initial prompt as whisper_full with no_timestamps
+  prompt.push_back(whisper_token_sot(target));
+  if (whisper_is_multilingual(target)) {
+    prompt.push_back(whisper_token_lang(target, whisper_lang_id(language)));
+    prompt.push_back(whisper_token_transcribe(target));
+  }
+  prompt.push_back(whisper_token_not(target));
+
+  whisper_token space[2];
+  if (whisper_tokenize(target, " ", space, 2) == 1) {
+    blank = space[0];
+  }
+}
+
+speculative_decoder::~speculative_decoder() {
+  if (target_state) {
+    whisper_free_state(target_state);
+  }
+  if (draft_state) {
+    whisper_free_state(draft_state);
+  }
+}
+
+bool speculative_decoder::is_valid() const {
+  return target_state != nullptr &&
+         (draft == nullptr || draft_state != nullptr);
+}
+
+bool speculative_decoder::encode_state(struct whisper_context *ctx,
+                                       struct whisper_state *state,
+                                       const float *samples, int n_samples,
+                                       int audio_ctx, double &mel_ms,
+                                       double &encode_ms) {
+  const auto t_start = std::chrono::steady_clock::now();
+  if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples,
+                                    n_threads) != 0) {
+    return false;
+  }
+  const auto t_encode = std::chrono::steady_clock::now();
+  whisper_ext_set_audio_ctx(state, audio_ctx);
+  if (whisper_encode_with_state(ctx, state, 0, n_threads) != 0) {
+    return false;
+  }
+  const auto t_end = std::chrono::steady_clock::now();
+
+  mel_ms += elapsed_ms(t_start, t_encode);
+  encode_ms += elapsed_ms(t_encode, t_end);
+  return true;
+}
+
+whisper_token speculative_decoder::argmax(struct whisper_context *ctx,
+                                          struct whisper_state *state,
+                                          int index, bool is_initial) const {
+  const int n_vocab = whisper_n_vocab(ctx);
+  const float *logits =
+      whisper_get_logits_from_state(state) + (size_t)index * n_vocab;
+  // Tokens after end of text are special and timestamp tokens, which never
+  // occur in a segment decoded without timestamps.
+  const whisper_token eot = whisper_token_eot(ctx);
+  if (!is_initial) {
+    return (whisper_token)(std::max_element(logits, logits + eot + 1) -
+                           logits);
+  }
+
+  // suppress_blank of whisper_full, the segment does not start with a blank
+  // or end right away
+  whisper_token best = -1;
+  for (whisper_token token = 0; token < eot; token++) {
+    if (token != blank && (best < 0 || logits[token] > logits[best])) {
+      best = token;
+    }
+  }
+  return best;
+}
+
+bool speculative_decoder::decode(const float *samples, int n_samples,
+                                 int audio_ctx, int max_tokens,
+                                 speculative_result &result) {
+  return encode(samples, n_samples, audio_ctx, result) &&
+         decode(max_tokens, result);
+}
+
+bool speculative_decoder::encode(const float *samples, int n_samples,
+                                 int audio_ctx, speculative_result &result) {
+  result = speculative_result();
+
+  if (!encode_state(target, target_state, samples, n_samples, audio_ctx,
+                    result.mel_ms, result.encode_ms)) {
+    return false;
+  }
+  if (draft && !encode_state(draft, draft_state, samples, n_samples,
+                             audio_ctx, result.mel_ms, result.encode_ms)) {
+    return false;
+  }
+  return true;
+}
+
+bool speculative_decoder::decode(int max_tokens, speculative_result &result) {
+  const auto t_decode = std::chrono::steady_clock::now();
+  const whisper_token eot = whisper_token_eot(target);
+  const int n_max = std::min(max_tokens, whisper_n_text_ctx(target) / 2);
+
+  // Prompt and all accepted tokens, which are in the KV cache of the target
+  std::vector<whisper_token> tokens(prompt);
+  if (whisper_ext_decode_with_state(target, target_state, prompt.data(),
+                                    prompt.size(), 0, n_threads) != 0) {
+    return false;
+  }
+  // Greedy choice of the target model for the next position
+  whisper_token next =
+      argmax(target, target_state, prompt.size() - 1, true);
+
+  // Tokens which are in the KV cache of the draft model
+  int draft_n_past = 0;
+  // The next token followed by the draft tokens
+  std::vector<whisper_token> batch;
+  std::vector<whisper_token> pending;
+
+  while (next != eot && (int)(tokens.size() - prompt.size()) < n_max) {
+    batch.assign(1, next);
+
+    const int n_left = n_max - (int)(tokens.size() - prompt.size()) - 1;
+    const int n_propose = draft ? std::min(n_draft, n_left) : 0;
+    if (n_propose > 0) {
+      // Catching up with the tokens the target accepted since the last round
+      pending.assign(tokens.begin() + draft_n_past, tokens.end());
+      pending.push_back(next);
+      if (whisper_ext_decode_with_state(draft, draft_state, pending.data(),
+                                        pending.size(), draft_n_past,
+                                        n_threads) != 0) {
+        return false;
+      }
+      draft_n_past = tokens.size() + 1;
+      whisper_token proposal = argmax(draft, draft_state, pending.size() - 1);
+
+      for (int i = 0; i < n_propose; i++) {
+        batch.push_back(proposal);
+        result.n_draft_proposed++;
+        if (proposal == eot || i + 1 == n_propose) {
+          break;
+        }
+        if (whisper_ext_decode_with_state(draft, draft_state, &proposal, 1,
+                                          draft_n_past, n_threads) != 0) {
+          return false;
+        }
+        draft_n_past++;
+        proposal = argmax(draft, draft_state, 0);
+      }
+    }
+
+    // Verifying all draft tokens in one pass, the logits of each position
+    // are the greedy choice for the token after it.
+    if (whisper_ext_decode_with_state(target, target_state, batch.data(),
+                                      batch.size(), tokens.size(),
+                                      n_threads) != 0) {
+      return false;
+    }
+    result.n_target_passes++;
+
+    tokens.push_back(next);
+    size_t index = 0;
+    next = argmax(target, target_state, index);
+    while (index + 1 < batch.size() && next == batch[index + 1] &&
+           next != eot) {
+      tokens.push_back(next);
+      result.n_draft_accepted++;
+      index++;
+      next = argmax(target, target_state, index);
+    }
+
+    // Cache entries after the first rejected draft token are overwritten by
+    // the next decoder call of the draft.
+    draft_n_past = std::min(draft_n_past, (int)tokens.size());
+  }
+
+  for (size_t i = prompt.size(); i < tokens.size(); i++) {
+    if (tokens[i] < eot) {
+      result.text += whisper_token_to_str(target, tokens[i]);
+    }
+  }
+  result.n_tokens = tokens.size() - prompt.size();
+  result.decode_ms = elapsed_ms(t_decode, std::chrono::steady_clock::now());
+  return true;
+}
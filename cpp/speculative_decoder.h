@@ -0,0 +1,83 @@
+#ifndef STT_SPECULATIVE_DECODER_H_
+#define STT_SPECULATIVE_DECODER_H_
+
+#include "whisper.h"
+
+#include <string>
+#include <vector>
+
+struct speculative_result {
+  std::string text;
+  int n_tokens;
+  // Target model passes of the decoding loop, without the prompt pass
+  int n_target_passes;
+  // Draft tokens proposed and the ones accepted by the target model
+  int n_draft_proposed;
+  int n_draft_accepted;
+  double mel_ms;
+  double encode_ms;
+  double decode_ms;
+};
+
+// Greedy decoding of a single segment without timestamps, optionally sped up
+// by a draft model. The draft model (e.g. tiny or base, sharing the tokenizer
+// of the target model) proposes a few tokens, which the target model verifies
+// in a single batched decoder pass. A draft token is only accepted when it is
+// the argmax of the target model at its position, so the output is identical
+// to greedy decoding with the target model alone.
+//
+// The argmax applies the logit filters whisper_full applies with the default
+// parameters and no_timestamps: special and timestamp tokens are never chosen
+// and, like suppress_blank, the first token is neither a blank nor end of
+// text. Non-speech tokens are not suppressed, as in whisper_full by default.
+//
+// Every decoder owns its own whisper states, so one decoder per thread. The
+// encoder and decoder phases can also run separately, e.g. on two threads with
+// one decoder per pipeline stage, as long as a decoder is only used by one
+// thread at a time.
+class speculative_decoder {
+public:
+  // Without a draft model this is plain greedy decoding with the target.
+  speculative_decoder(struct whisper_context *target,
+                      struct whisper_context *draft, const char *language,
+                      int n_threads, int n_draft);
+  ~speculative_decoder();
+  speculative_decoder(const speculative_decoder &) = delete;
+  speculative_decoder &operator=(const speculative_decoder &) = delete;
+
+  // False when the states could not be allocated. A draft model with another
+  // vocabulary than the target is dropped instead.
+  bool is_valid() const;
+  // Encoder and decoder phase in one call
+  bool decode(const float *samples, int n_samples, int audio_ctx,
+              int max_tokens, speculative_result &result);
+  // Mel spectrogram and encoder pass of the window, which resets the result
+  bool encode(const float *samples, int n_samples, int audio_ctx,
+              speculative_result &result);
+  // Decoding of the window of the last encode call
+  bool decode(int max_tokens, speculative_result &result);
+  // Threads of the following passes, e.g. as granted by a thread budget
+  void set_n_threads(int n) { n_threads = n; }
+
+private:
+  bool encode_state(struct whisper_context *ctx, struct whisper_state *state,
+                    const float *samples, int n_samples, int audio_ctx,
+                    double &mel_ms, double &encode_ms);
+  // Greedy choice among the text tokens and end of text, see above. The
+  // initial token is the first one after the prompt.
+  whisper_token argmax(struct whisper_context *ctx, struct whisper_state *state,
+                       int index, bool is_initial = false) const;
+
+  struct whisper_context *target;
+  struct whisper_context *draft;
+  struct whisper_state *target_state;
+  struct whisper_state *draft_state;
+  std::vector<whisper_token> prompt;
+  // Token of a single space, suppressed as the initial token. -1 when the
+  // vocabulary has none.
+  whisper_token blank;
+  int n_threads;
+  int n_draft;
+};
+
+#endif // STT_SPECULATIVE_DECODER_H_
@@ -1,4 +1,8 @@
 #include "stream_whisper.h"
+#include "audio_file_reader.h"
+#include "speculative_decoder.h"
+#include "trace_events.h"
+#include "transcription_cache.h"
 #include "whisper.h"
 #include <algorithm>
 #include <stdio.h>
@@ -9,6 +13,8 @@
 #include <atomic>
 #include <cmath>
 #include <cstdio>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -79,6 +85,161 @@ bool vad_simple(std::vector<float> &pcmf32, int sample_rate, int last_ms,
   return true;
 }
 
+// Maximum number of iteration metrics kept until the client collects them.
+static const size_t max_iteration_metrics = 256;
+// Maximum number of utterances waiting for the refinement, the oldest are
+// dropped first as they most likely scrolled out of view already.
+static const size_t max_refine_jobs = 8;
+// Audio of a file transcribed at once, the progress is checkpointed between
+// the chunks.
+static const int file_chunk_seconds = 120;
+// Previous text passed as prompt into the next chunk of a file
+static const size_t max_prompt_chars = 400;
+
+// Timestamps of the phases in a whisper_full call. whisper.cpp only reports
+// averaged timings of its default state and no mel timing at all, so the phase
+// boundaries are recorded through the callbacks of the inference params.
+struct inference_timings {
+  std::chrono::steady_clock::time_point t_start;
+  std::chrono::steady_clock::time_point t_encode;
+  std::chrono::steady_clock::time_point t_decode;
+  bool is_encoding;
+  bool is_decoding;
+
+  void reset() {
+    t_start = std::chrono::steady_clock::now();
+    t_encode = t_start;
+    t_decode = t_start;
+    is_encoding = false;
+    is_decoding = false;
+  }
+};
+
+// Called by whisper.cpp after the mel spectrogram was computed, right before
+// the encoder runs.
+static bool on_encoder_begin(struct whisper_context * /*ctx*/,
+                             struct whisper_state * /*state*/,
+                             void *user_data) {
+  inference_timings *timings = static_cast<inference_timings *>(user_data);
+  if (!timings->is_encoding) {
+    timings->t_encode = std::chrono::steady_clock::now();
+    timings->is_encoding = true;
+  }
+  return true;
+}
+
+// Called by whisper.cpp before sampling each token, the first call marks the
+// begin of the decoding loop.
+static void on_logits_filter(struct whisper_context * /*ctx*/,
+                             struct whisper_state * /*state*/,
+                             const whisper_token_data * /*tokens*/,
+                             int /*n_tokens*/, float * /*logits*/,
+                             void *user_data) {
+  inference_timings *timings = static_cast<inference_timings *>(user_data);
+  if (!timings->is_decoding) {
+    timings->t_decode = std::chrono::steady_clock::now();
+    timings->is_decoding = true;
+  }
+}
+
+// Whisper encodes 30s of audio into 1500 frames of audio context
+static const int ms_per_audio_ctx = 20;
+static const int max_audio_ctx = 768;
+
+// Paces the streaming loop by the measured inference time. Running the next
+// iteration as soon as the previous one finished is the lowest latency the
+// machine can sustain, so the trigger follows a smoothed inference time. When
+// even the longest trigger can not keep up, the window shrinks, which reduces
+// the audio context and with that the encoder cost.
+struct adaptive_pacing {
+  int trigger_ms;
+  int window_ms;
+  double ema_inference_ms;
+  bool has_measurement;
+
+  void reset(int initial_trigger_ms, int initial_window_ms) {
+    trigger_ms = initial_trigger_ms;
+    window_ms = initial_window_ms;
+    ema_inference_ms = 0.0;
+    has_measurement = false;
+  }
+
+  void update(const stream_configuration &config, int max_window_ms,
+              double inference_ms) {
+    // Smoothing over a few iterations, single slow iterations (e.g. a long
+    // decode) should not double the latency of the following ones.
+    const double alpha = 0.25;
+    ema_inference_ms = has_measurement ? alpha * inference_ms +
+                                             (1.0 - alpha) * ema_inference_ms
+                                       : inference_ms;
+    has_measurement = true;
+
+    // Some headroom, so the queue drains a bit faster than it fills up
+    const double target_ms = ema_inference_ms * 1.1;
+    trigger_ms = std::max(config.min_trigger_ms,
+                          std::min(config.max_trigger_ms, (int)target_ms));
+
+    if (target_ms > config.max_trigger_ms) {
+      window_ms = std::min(max_window_ms,
+                           std::max(config.min_window_ms, window_ms * 3 / 4));
+    } else if (target_ms < config.max_trigger_ms / 2) {
+      window_ms = std::min(max_window_ms, window_ms * 5 / 4);
+    }
+  }
+
+  // Audio context covering the window plus the audio of one more trigger,
+  // which may be drained before the window gets finalized.
+  int audio_ctx(const stream_configuration &config) const {
+    const int ctx_ms = window_ms + config.max_trigger_ms;
+    return std::min(max_audio_ctx, ctx_ms / ms_per_audio_ctx);
+  }
+};
+
+// Removes the silent 100ms frames of freshly drained audio. A frame is silent
+// when its energy is below the VAD threshold relative to the reference energy
+// of the current window, or below the absolute noise floor. Returns the number
+// of dropped samples.
+static size_t drop_silent_frames(std::vector<float> &pcmf32,
+                                 float reference_energy, float vad_thold) {
+  const size_t n_samples_frame = WHISPER_SAMPLE_RATE / 10;
+  const float silence_thold = std::max(0.0001f, vad_thold * reference_energy);
+
+  size_t n_kept = 0;
+  for (size_t offset = 0; offset < pcmf32.size(); offset += n_samples_frame) {
+    const size_t n = std::min(n_samples_frame, pcmf32.size() - offset);
+    float energy = 0.0f;
+    for (size_t i = offset; i < offset + n; i++) {
+      energy += fabsf(pcmf32[i]);
+    }
+    if (energy / n < silence_thold) {
+      continue;
+    }
+    std::copy(pcmf32.begin() + offset, pcmf32.begin() + offset + n,
+              pcmf32.begin() + n_kept);
+    n_kept += n;
+  }
+
+  const size_t n_dropped = pcmf32.size() - n_kept;
+  pcmf32.resize(n_kept);
+  return n_dropped;
+}
+
+static float mean_energy(const std::vector<float> &pcmf32) {
+  if (pcmf32.empty()) {
+    return 0.0f;
+  }
+  float energy = 0.0f;
+  for (float sample : pcmf32) {
+    energy += fabsf(sample);
+  }
+  return energy / pcmf32.size();
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point t_begin,
+                         std::chrono::steady_clock::time_point t_end) {
+  return std::chrono::duration<double, std::milli>(t_end - t_begin).count();
+}
+
 // Extracting audio data from a Waveform audio file (.wav)
 // fname - File path
 // pcmf32 - Audio buffer
@@ -150,8 +311,15 @@ SpeechToTextEngine::SpeechToTextEngine(const std::string &path_model,
                                        const int n_threads,
                                        const int trigger_ms,
                                        const bool is_word_level_mode = false)
-    : is_running(false), is_clear_audio(false),
-      is_word_level_mode(is_word_level_mode) {
+    : fallback_ctx(nullptr), partial_ctx(nullptr), draft_ctx(nullptr),
+      refine_ctx(nullptr), is_running(false),
+      is_clear_audio(false), is_word_level_mode(is_word_level_mode),
+      n_samples_received(0), n_samples_drained(0), n_partials_skipped(0),
+      n_samples_silence_dropped(0), n_fallback_iterations(0),
+      budget(shared_thread_budget()), is_budget_session(false),
+      next_utterance_id(0), is_final_in_flight(false), clear_generation(0),
+      has_held_partial(false), is_foreground_busy(false),
+      is_final_pending(false) {
   fprintf(stdout, "path_model: %s\n", path_model.c_str());
   fprintf(stdout, "language: %s\n", language);
   fprintf(stdout, "n_threads: %d\n", n_threads);
@@ -160,52 +328,216 @@ SpeechToTextEngine::SpeechToTextEngine(const std::string &path_model,
   model_config.language = language;
   model_config.n_threads = n_threads;
   stream_config.trigger_ms = trigger_ms;
-  // Load Whisper model from local filesystem
-  ctx = whisper_init_from_file(path_model.c_str());
+  model_path = path_model;
+  // Load Whisper model from local filesystem, or share the one which another
+  // session already loaded
+  model = load_shared_model(path_model);
+  ctx = model.get();
 }
 
 SpeechToTextEngine::~SpeechToTextEngine() {
   is_running = false;
   if (worker.joinable())
     worker.join();
-  whisper_free(ctx);
+  s_final_cv.notify_all();
+  if (final_worker.joinable())
+    final_worker.join();
+  s_refine_cv.notify_all();
+  if (refine_worker.joinable())
+    refine_worker.join();
+  if (is_budget_session) {
+    budget->remove_session();
+  }
 }
 
 // Initiate the speech to text processing
 void SpeechToTextEngine::Start() {
   if (!is_running) {
+    // The running state has to be set before the thread starts, otherwise the
+    // worker may observe it unset and exit right away.
+    is_running = true;
+    if (!is_budget_session) {
+      budget->add_session();
+      is_budget_session = true;
+    }
     // For continuous processing we are running the speech to text process in a
     // separate thread.
     worker = std::thread(&SpeechToTextEngine::Process, this);
-    is_running = true;
-    t_last_iter = std::chrono::high_resolution_clock::now();
+    if (partial_ctx) {
+      final_worker = std::thread(&SpeechToTextEngine::ProcessFinals, this);
+    }
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (stream_config.is_refinement) {
+      refine_worker =
+          std::thread(&SpeechToTextEngine::ProcessRefinements, this);
+    }
   }
 }
 
 // In order to stop the background process of transcribing
 void SpeechToTextEngine::Stop() {
+  recorder.record_event(SESSION_EVENT_STOP);
   is_running = false;
   if (worker.joinable())
     worker.join();
+  // Woken up after the inference worker exited, so the final of the last
+  // utterance is not missed.
+  s_final_cv.notify_all();
+  if (final_worker.joinable())
+    final_worker.join();
+  // A running refinement is aborted, queued utterances are refined after the
+  // next call of Start().
+  s_refine_cv.notify_all();
+  if (refine_worker.joinable())
+    refine_worker.join();
+  if (is_budget_session) {
+    budget->remove_session();
+    is_budget_session = false;
+  }
 }
 
 // Utility to clear current queued audio buffer. For controlling purposes like
 // stopping the audio recording in the client.
 void SpeechToTextEngine::ClearAudioData() {
+  recorder.record_event(SESSION_EVENT_CLEAR);
   std::lock_guard<std::mutex> lock(s_mutex);
   is_clear_audio = true;
   s_queued_pcmf32.clear();
+  s_chunk_arrivals.clear();
+  n_samples_drained = n_samples_received;
+  s_final_queue.clear();
+  s_refine_queue.clear();
+  s_segment_updates.clear();
+  clear_generation++;
+  has_held_partial = false;
+}
+
+// Scheduling options for the inference worker (core pinning, priority). These
+// are applied by the worker thread itself, so changes take effect on the next
+// call of Start().
+void SpeechToTextEngine::SetSchedulingConfiguration(
+    const scheduling_configuration &config) {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  sched_config = config;
+}
+
+// Trigger and adaptive pacing bounds of the streaming loop, applied on the next
+// call of Start().
+void SpeechToTextEngine::SetStreamConfiguration(
+    const stream_configuration &config) {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  stream_config = config;
+}
+
+// Loads a smaller model which takes over while the engine is overloaded. Must
+// be called while the engine is stopped.
+bool SpeechToTextEngine::SetFallbackModel(const std::string &path_model) {
+  fallback_model = load_shared_model(path_model);
+  fallback_ctx = fallback_model.get();
+  return fallback_ctx != nullptr;
+}
+
+// Loads a fast model (e.g. tiny or base) for partials. The selected model then
+// only transcribes finalized utterances on a separate worker. Must be called
+// while the engine is stopped.
+bool SpeechToTextEngine::SetPartialModel(const std::string &path_model) {
+  partial_model = load_shared_model(path_model);
+  partial_ctx = partial_model.get();
+  return partial_ctx != nullptr;
+}
+
+// Loads a draft model (e.g. tiny or base with the tokenizer of the selected
+// model) for speculative decoding of the selected model. The transcription is
+// the same as greedy decoding without timestamps of the selected model alone.
+// Must be called while the engine is stopped.
+bool SpeechToTextEngine::SetDraftModel(const std::string &path_model) {
+  draft_model = load_shared_model(path_model);
+  draft_ctx = draft_model.get();
+  return draft_ctx != nullptr;
+}
+
+// Loads a larger model (e.g. medium for a base selection) for the refinement
+// of finalized utterances. Without it the selected model refines with beam
+// search. Must be called while the engine is stopped.
+bool SpeechToTextEngine::SetRefinementModel(const std::string &path_model) {
+  refine_model = load_shared_model(path_model);
+  refine_ctx = refine_model.get();
+  return refine_ctx != nullptr;
+}
+
+// Records every incoming chunk and Clear/Stop event with its arrival time into
+// a session log, which can be replayed with the benchmark tools.
+bool SpeechToTextEngine::StartSessionRecording(const std::string &path) {
+  return recorder.open(path, WHISPER_SAMPLE_RATE);
+}
+
+void SpeechToTextEngine::StopSessionRecording() { recorder.close(); }
+
+// Retains the incoming audio of at most the last max_seconds in the directory,
+// see audio_store. Finalized utterances are linked to their audio from now on.
+bool SpeechToTextEngine::StartAudioRetention(const std::string &directory,
+                                             int max_seconds) {
+  if (max_seconds <= 0) {
+    return false;
+  }
+  return audio_retention.open(directory,
+                              (uint64_t)max_seconds * WHISPER_SAMPLE_RATE);
+}
+
+void SpeechToTextEngine::StopAudioRetention() { audio_retention.close(); }
+
+// Audio the utterance was transcribed from, including the overlap with the
+// previous utterance. False when it is not retained (anymore).
+bool SpeechToTextEngine::GetUtteranceAudio(uint64_t utterance_id,
+                                           std::vector<float> &pcmf32) {
+  audio_span span;
+  return audio_retention.find_utterance(utterance_id, span) &&
+         audio_retention.read(span, pcmf32);
+}
+
+// Transcribes the retained audio of an utterance again, e.g. after changing the
+// model. Returns a single final segment, or none when the audio is gone.
+std::vector<transcribed_segment>
+SpeechToTextEngine::TranscribeUtterance(uint64_t utterance_id) {
+  std::vector<float> pcmf32;
+  if (!GetUtteranceAudio(utterance_id, pcmf32)) {
+    return {};
+  }
+
+  transcribed_segment segment;
+  segment.is_partial = false;
+  segment.utterance_id = utterance_id;
+  for (const transcribed_segment &part : TranscribeAudio(pcmf32)) {
+    segment.text += part.text;
+  }
+  return {segment};
 }
 
 // Receives audio data (in PCM f32 format) from render process and inserts data
 // in a queue
 void SpeechToTextEngine::AddAudioData(const std::vector<float> &data) {
-  std::lock_guard<std::mutex> lock(s_mutex);
-  s_queued_pcmf32.insert(s_queued_pcmf32.end(), data.begin(), data.end());
+  STT_TRACE_SCOPE("ingestion");
+  recorder.record_audio(data);
+  uint64_t position;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    const auto t_now = std::chrono::steady_clock::now();
+    if (s_queued_pcmf32.empty()) {
+      t_first_queued = t_now;
+    }
+    s_queued_pcmf32.insert(s_queued_pcmf32.end(), data.begin(), data.end());
+    // Timestamping the chunk with the sample counter of its last sample
+    position = n_samples_received;
+    n_samples_received += data.size();
+    s_chunk_arrivals.emplace_back(n_samples_received, t_now);
+  }
+  // Outside of the engine lock, the store may write a chunk to disk
+  audio_retention.append(position, data);
 }
 
 // Recent transcribed text will be shared from the thread via shared array
 std::vector<transcribed_segment> SpeechToTextEngine::GetTranscribedText() {
+  STT_TRACE_SCOPE("get_transcribed_text");
   std::vector<transcribed_segment> transcribed;
   std::lock_guard<std::mutex> lock(s_mutex);
   transcribed = std::move(s_transcribed_segments);
@@ -213,6 +545,37 @@ std::vector<transcribed_segment> SpeechToTextEngine::GetTranscribedText() {
   return transcribed;
 }
 
+// Refined texts of finalized utterances since the last call
+std::vector<segment_update> SpeechToTextEngine::GetSegmentUpdates() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  std::vector<segment_update> updates = std::move(s_segment_updates);
+  s_segment_updates.clear();
+  return updates;
+}
+
+// Timing metrics of the iterations since the last call
+std::vector<iteration_metrics> SpeechToTextEngine::GetIterationMetrics() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  std::vector<iteration_metrics> metrics = std::move(s_iteration_metrics);
+  s_iteration_metrics.clear();
+  return metrics;
+}
+
+// Percentiles of the end-to-end latency, from the arrival of the last audio
+// sample covered by a segment until the segment was emitted.
+latency_summary SpeechToTextEngine::GetLatencySummary(bool is_partial) const {
+  return is_partial ? latency_partial.summary() : latency_final.summary();
+}
+
+load_shedding_counters SpeechToTextEngine::GetLoadSheddingCounters() const {
+  load_shedding_counters counters;
+  counters.partials_skipped = n_partials_skipped.load();
+  counters.silence_dropped_ms =
+      n_samples_silence_dropped.load() * 1000.0 / WHISPER_SAMPLE_RATE;
+  counters.fallback_iterations = n_fallback_iterations.load();
+  return counters;
+}
+
 // Experimental, do not use in real-time
 // wlt stands for word-level-timestamp
 // Custom parameters for whisper inference configuration:
@@ -233,7 +596,12 @@ std::vector<transcribed_segment> SpeechToTextEngine::GetTranscribedText() {
 //   int max_len = 1;
 // };
 
-void SpeechToTextEngine::Process() {
+// Configuration of the inference for streaming, shared by the partial and the
+// final worker. The phase timings of each whisper_full call are collected into
+// the given timings.
+static struct whisper_full_params
+streaming_params(const whisper_configuration &model_config,
+                 inference_timings *timings) {
   struct whisper_full_params wparams = whisper_full_default_params(
       whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY);
   // Threads to use for whisper, use of 4 threads are showing great results
@@ -266,23 +634,404 @@ void SpeechToTextEngine::Process() {
   // Reducing the default audio context, max defined as 1500. This will result
   // in 1/2 audio length which was 30s chunks, so now its 15s. Longer context is
   // not needed in real time application and boosts model performance by 2x.
-  wparams.audio_ctx = 768;
+  wparams.audio_ctx = max_audio_ctx;
   wparams.temperature_inc = 0.0f;
+  // Single segments need no timestamps. The speculative and pipelined decoders
+  // decode without them as well, so every path produces the same tokens.
+  wparams.no_timestamps = true;
+  // Collecting the timings of the inference phases for the iteration metrics
+  wparams.encoder_begin_callback = on_encoder_begin;
+  wparams.encoder_begin_callback_user_data = timings;
+  wparams.logits_filter_callback = on_logits_filter;
+  wparams.logits_filter_callback_user_data = timings;
   // When sentence dictation mode is activated, we need to modify whisper model
   // parameters in order to receive word level timestamps.
   // wparams.split_on_word = is_word_level_mode;
   // wparams.token_timestamps = is_word_level_mode;
   // wparams.max_len = is_word_level_mode == true ? 1 : 0;
+  return wparams;
+}
+
+// Fills the timing breakdown of a finished whisper_full call into the metrics.
+static void measure_inference(inference_timings &timings,
+                              std::chrono::steady_clock::time_point t_end,
+                              size_t n_samples, iteration_metrics &metrics) {
+  // Phases which were not reached (e.g. no decoding step on silence) are
+  // accounted with zero length.
+  if (!timings.is_encoding) {
+    timings.t_encode = t_end;
+  }
+  if (!timings.is_decoding) {
+    timings.t_decode = t_end;
+  }
+  metrics.mel_ms = elapsed_ms(timings.t_start, timings.t_encode);
+  metrics.encode_ms = elapsed_ms(timings.t_encode, timings.t_decode);
+  metrics.decode_ms = elapsed_ms(timings.t_decode, t_end);
+  metrics.inference_ms = elapsed_ms(timings.t_start, t_end);
+  metrics.audio_ms = n_samples * 1000.0 / WHISPER_SAMPLE_RATE;
+  metrics.rtf = metrics.inference_ms / metrics.audio_ms;
+  if (trace_is_enabled()) {
+    trace_complete("whisper_full", timings.t_start, t_end);
+    trace_complete("mel", timings.t_start, timings.t_encode);
+    trace_complete("encode", timings.t_encode, timings.t_decode);
+    trace_complete("decode", timings.t_decode, t_end);
+  }
+}
+
+// Extracting text data from the segments of the inference process.
+static std::string extract_text(struct whisper_state *state, int &n_tokens) {
+  std::string text;
+  n_tokens = 0;
+  const int segments_size = whisper_full_n_segments_from_state(state);
+  for (int segment_index = 0; segment_index < segments_size; ++segment_index) {
+    STT_TRACE_SCOPE("segment_extraction");
+    // Get text information of segment
+    const char *segment_text =
+        whisper_full_get_segment_text_from_state(state, segment_index);
+    // for word level timestamps:
+    // const int64_t word_start_ms =
+    //     is_word_level_mode == true
+    //         ? whisper_full_get_segment_t0(ctx, segment_index)
+    //         : 0;
+    // const int64_t word_end_ms =
+    //     is_word_level_mode == true
+    //         ? whisper_full_get_segment_t1(ctx, segment_index)
+    //         : 0;
+
+    text += segment_text;
+    n_tokens += whisper_full_n_tokens_from_state(state, segment_index);
+    // segment.start_time_ms = word_start_ms;
+    // segment.end_time_ms = word_end_ms;
+  }
+  return text;
+}
+
+// Runs the inference over the window on the given state and fills the timings
+// and the text. The speculative decoder replaces whisper_full when given.
+// Returns 0 on success.
+static int run_inference(struct whisper_context *ctx,
+                         struct whisper_state *state,
+                         const struct whisper_full_params &wparams,
+                         inference_timings &timings,
+                         speculative_decoder *decoder,
+                         const std::vector<float> &pcmf32,
+                         iteration_metrics &metrics, std::string &text) {
+  metrics.n_draft_proposed = 0;
+  metrics.n_draft_accepted = 0;
+  timings.reset();
+
+  if (decoder) {
+    STT_TRACE_SCOPE("speculative_decode");
+    decoder->set_n_threads(wparams.n_threads);
+    speculative_result result;
+    if (!decoder->decode(pcmf32.data(), pcmf32.size(), wparams.audio_ctx,
+                         wparams.max_tokens, result)) {
+      return -1;
+    }
+    metrics.mel_ms = result.mel_ms;
+    metrics.encode_ms = result.encode_ms;
+    metrics.decode_ms = result.decode_ms;
+    metrics.inference_ms =
+        elapsed_ms(timings.t_start, std::chrono::steady_clock::now());
+    metrics.audio_ms = pcmf32.size() * 1000.0 / WHISPER_SAMPLE_RATE;
+    metrics.rtf = metrics.inference_ms / metrics.audio_ms;
+    metrics.n_tokens = result.n_tokens;
+    metrics.n_draft_proposed = result.n_draft_proposed;
+    metrics.n_draft_accepted = result.n_draft_accepted;
+    text = std::move(result.text);
+    return 0;
+  }
+
+  if (!state) {
+    return -1;
+  }
+  int ret = whisper_full_with_state(ctx, state, wparams, pcmf32.data(),
+                                    pcmf32.size());
+  if (ret != 0) {
+    return ret;
+  }
+  measure_inference(timings, std::chrono::steady_clock::now(), pcmf32.size(),
+                    metrics);
+  text = extract_text(state, metrics.n_tokens);
+  return 0;
+}
+
+// Whisper states of a worker, one per model it runs, allocated on first use.
+// The model contexts are shared with other sessions, so the default state of
+// a context must not be used.
+class worker_states {
+public:
+  worker_states() = default;
+  worker_states(const worker_states &) = delete;
+  worker_states &operator=(const worker_states &) = delete;
+  ~worker_states() {
+    for (auto &entry : states) {
+      whisper_free_state(entry.second);
+    }
+  }
+
+  // Returns nullptr when the state could not be allocated
+  struct whisper_state *get(struct whisper_context *ctx) {
+    for (auto &entry : states) {
+      if (entry.first == ctx) {
+        return entry.second;
+      }
+    }
+    struct whisper_state *state = whisper_init_state(ctx);
+    if (state) {
+      states.emplace_back(ctx, state);
+    }
+    return state;
+  }
+
+private:
+  std::vector<std::pair<struct whisper_context *, struct whisper_state *>>
+      states;
+};
+
+// The speculative_decoder produces the tokens of whisper_full only for these
+// parameters: greedy at temperature 0 without fallback, no timestamps, the
+// blank suppressed and no prompt. streaming_params sets them, a change there
+// has to keep the pipelined and speculative modes on whisper_full instead.
+static bool decodes_like_whisper_full(const whisper_full_params &wparams) {
+  return wparams.strategy == WHISPER_SAMPLING_GREEDY &&
+         wparams.temperature == 0.0f && wparams.temperature_inc == 0.0f &&
+         wparams.no_timestamps && wparams.suppress_blank &&
+         !wparams.suppress_non_speech_tokens && wparams.no_context &&
+         !wparams.initial_prompt && wparams.prompt_n_tokens == 0;
+}
+
+// Greedy decoder of the selected model, speculative when a draft model is
+// given. Each worker needs its own, as it holds whisper states.
+static std::unique_ptr<speculative_decoder>
+make_decoder(struct whisper_context *ctx, struct whisper_context *draft_ctx,
+             const whisper_configuration &model_config, int n_draft_tokens) {
+  std::unique_ptr<speculative_decoder> decoder(
+      new speculative_decoder(ctx, draft_ctx, model_config.language,
+                              model_config.n_threads, n_draft_tokens));
+  if (!decoder->is_valid()) {
+    fprintf(stderr, "%s: failed to initialize the decoder\n", __func__);
+    return nullptr;
+  }
+  return decoder;
+}
+
+// Returns nullptr when no draft model is set, whisper_full is used instead.
+static std::unique_ptr<speculative_decoder>
+make_speculative_decoder(struct whisper_context *ctx,
+                         struct whisper_context *draft_ctx,
+                         const whisper_configuration &model_config,
+                         int n_draft_tokens) {
+  if (!draft_ctx) {
+    return nullptr;
+  }
+  return make_decoder(ctx, draft_ctx, model_config, n_draft_tokens);
+}
+
+// Window on its way from the encoder stage on the inference worker to the
+// decoder stage. Its decoder holds the whisper states the window was encoded
+// into, so the next window is encoded into the other slot meanwhile.
+struct pipeline_slot {
+  std::unique_ptr<speculative_decoder> decoder;
+  speculative_result result;
+  iteration_metrics metrics = iteration_metrics();
+  transcribed_segment segment;
+  std::chrono::steady_clock::time_point t_start;
+  std::chrono::steady_clock::time_point t_last_sample_arrival;
+  // Audio of a final for the refinement, empty otherwise
+  std::vector<float> pcmf32_final;
+  int max_tokens;
+  uint64_t clear_generation;
+  // Encoded and not yet decoded
+  bool is_busy = false;
+};
+
+struct inference_pipeline {
+  pipeline_slot slots[2];
+  size_t next_slot = 0;
+  // Encoded slots in encoding order, the front one is being decoded
+  std::deque<pipeline_slot *> s_pending;
+  std::mutex s_mutex;
+  std::condition_variable s_cv;
+  bool is_stopping = false;
+  std::thread decode_stage;
+
+  // Next slot to encode into, once the decoding of its previous window ended
+  pipeline_slot &acquire() {
+    pipeline_slot &slot = slots[next_slot];
+    next_slot = (next_slot + 1) % 2;
+    std::unique_lock<std::mutex> lock(s_mutex);
+    s_cv.wait(lock, [&slot] { return !slot.is_busy; });
+    return slot;
+  }
+
+  void submit(pipeline_slot &slot) {
+    {
+      std::lock_guard<std::mutex> lock(s_mutex);
+      slot.is_busy = true;
+      s_pending.push_back(&slot);
+    }
+    s_cv.notify_all();
+  }
+
+  // Waits until all encoded windows were decoded and emitted
+  void wait_idle() {
+    std::unique_lock<std::mutex> lock(s_mutex);
+    s_cv.wait(lock, [this] { return s_pending.empty(); });
+  }
+
+  // The decoder stage finishes the pending windows before it exits
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(s_mutex);
+      is_stopping = true;
+    }
+    s_cv.notify_all();
+    if (decode_stage.joinable()) {
+      decode_stage.join();
+    }
+  }
+};
+
+// Pinning and prioritizing the calling worker before the first inference. The
+// ggml compute threads are spawned from the worker and inherit its affinity
+// mask and priority.
+void SpeechToTextEngine::ApplySchedulingConfiguration() {
+  std::lock_guard<std::mutex> lock(s_mutex);
+  if (!sched_config.cpu_affinity.empty() || sched_config.nice != 0 ||
+      sched_config.realtime) {
+    apply_thread_scheduling(sched_config);
+  }
+}
+
+// Hands a segment over to the client and records its end-to-end latency. Has
+// to be called with s_mutex held.
+void SpeechToTextEngine::EmitSegment(
+    transcribed_segment &&segment,
+    std::chrono::steady_clock::time_point t_last_sample_arrival) {
+  if (segment.is_partial &&
+      (is_final_in_flight || !s_final_queue.empty())) {
+    s_held_partial = std::move(segment);
+    t_held_partial_arrival = t_last_sample_arrival;
+    has_held_partial = true;
+    return;
+  }
+
+  const auto t_emit = std::chrono::steady_clock::now();
+  const uint64_t latency_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          t_emit - t_last_sample_arrival)
+          .count();
+  if (segment.is_partial) {
+    latency_partial.record(latency_us);
+  } else {
+    latency_final.record(latency_us);
+  }
+
+  const uint64_t utterance_id = segment.utterance_id;
+  const bool is_partial = segment.is_partial;
+  // Moving the segment to a shared array with client.
+  s_transcribed_segments.insert(s_transcribed_segments.end(),
+                                std::move(segment));
+
+  // Releasing the held partial once all finals before it were emitted
+  if (!is_partial && has_held_partial && !is_final_in_flight &&
+      s_final_queue.empty()) {
+    has_held_partial = false;
+    if (s_held_partial.utterance_id > utterance_id) {
+      EmitSegment(std::move(s_held_partial), t_held_partial_arrival);
+    }
+  }
+}
+
+// Queues the audio of a finalized segment for the refinement worker. Has to be
+// called with s_mutex held.
+void SpeechToTextEngine::QueueRefinement(const std::vector<float> &pcmf32,
+                                         const transcribed_segment &segment) {
+  if (segment.text.empty()) {
+    return;
+  }
+  if (s_refine_queue.size() >= max_refine_jobs) {
+    s_refine_queue.pop_front();
+  }
+  refine_job job;
+  job.utterance_id = segment.utterance_id;
+  job.pcmf32 = pcmf32;
+  job.text = segment.text;
+  job.clear_generation = clear_generation;
+  s_refine_queue.push_back(std::move(job));
+  s_refine_cv.notify_one();
+}
+
+// Has to be called with s_mutex held.
+void SpeechToTextEngine::PushIterationMetrics(
+    const iteration_metrics &metrics) {
+  if (s_iteration_metrics.size() >= max_iteration_metrics) {
+    s_iteration_metrics.erase(s_iteration_metrics.begin());
+  }
+  s_iteration_metrics.push_back(metrics);
+}
+
+void SpeechToTextEngine::Process() {
+  trace_set_thread_name("inference_worker");
+  ApplySchedulingConfiguration();
+  stream_configuration config;
+  // Received audio of the accumulated buffer, in samples since the engine was
+  // created. Dropped silence is still part of the span.
+  audio_span utterance_span;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    config = stream_config;
+    utterance_span.begin = n_samples_drained;
+    utterance_span.end = n_samples_drained;
+  }
+
+  inference_timings timings;
+  struct whisper_full_params wparams = streaming_params(model_config, &timings);
+  worker_states states;
+  // Finals are handed over to the final worker when a partial model is set
+  const bool is_two_tier = partial_ctx != nullptr;
+  // Encoding of the next window overlaps with the decoding of the current one
+  // on a second thread, not for the partial model of the two-tier mode. Both
+  // stages run the speculative_decoder, which decodes like whisper_full.
+  const bool is_decoding_equivalent = decodes_like_whisper_full(wparams);
+  if (!is_decoding_equivalent && (config.is_pipelined || draft_ctx)) {
+    fprintf(stderr, "%s: streaming parameters need whisper_full, pipelined "
+                    "and speculative decoding are off\n",
+            __func__);
+  }
+  std::unique_ptr<inference_pipeline> pipeline;
+  if (config.is_pipelined && !is_two_tier && is_decoding_equivalent) {
+    pipeline.reset(new inference_pipeline());
+    for (pipeline_slot &slot : pipeline->slots) {
+      slot.decoder =
+          make_decoder(ctx, draft_ctx, model_config, config.n_draft_tokens);
+      if (!slot.decoder) {
+        pipeline.reset();
+        break;
+      }
+    }
+  }
+  if (pipeline) {
+    pipeline->decode_stage = std::thread(&SpeechToTextEngine::ProcessDecodes,
+                                         this, std::ref(*pipeline));
+  }
+  // Speculative decoding of the selected model, when a draft model is set
+  std::unique_ptr<speculative_decoder> decoder =
+      is_two_tier || pipeline || !is_decoding_equivalent
+          ? nullptr
+          : make_speculative_decoder(ctx, draft_ctx, model_config,
+                                     config.n_draft_tokens);
 
-  fprintf(stdout, "trigger_ms: %d", stream_config.trigger_ms);
   // Audio data gets piped in and this defines the minimum treshold of audio
   // length needed to be processed with the whisper model
-  const int trigger_ms = stream_config.trigger_ms;
-  const int n_samples_trigger = (trigger_ms / 1000.0) * WHISPER_SAMPLE_RATE;
+  const int trigger_ms = config.trigger_ms;
   // This defines the maximum treshold of the audio length.
   const int iter_threshold_ms = trigger_ms * 35;
-  const int n_samples_iter_threshold =
-      (iter_threshold_ms / 1000.0) * WHISPER_SAMPLE_RATE;
+  // Effective trigger and window, fixed to the configuration unless adaptive
+  // pacing is enabled.
+  adaptive_pacing pacing;
+  pacing.reset(trigger_ms, iter_threshold_ms);
 
   // VAD sliding window of audio length from 3s
   const int vad_window_s = 3;
@@ -297,6 +1046,19 @@ void SpeechToTextEngine::Process() {
 
   // Accumulated audio buffer (PCM-F32)
   std::vector<float> pcmf32;
+  // Audio drained from the shared queue in the current iteration
+  std::vector<float> pcmf32_new;
+  // Audio of the finalized utterance, kept for the refinement
+  std::vector<float> pcmf32_final;
+
+  // State of the overload policies
+  bool is_shedding_partials = false;
+  bool is_fallback = false;
+
+  // Timing of the current iteration
+  iteration_metrics metrics;
+  // Arrival of the last sample in the local audio buffer
+  std::chrono::steady_clock::time_point t_last_sample_arrival;
 
   // Main Loop for running the inference.
   while (is_running) {
@@ -309,90 +1071,225 @@ void SpeechToTextEngine::Process() {
         pcmf32.clear();
         s_transcribed_segments.clear();
         is_clear_audio = false;
+        is_shedding_partials = false;
+        utterance_span.begin = n_samples_drained;
       }
     }
 
+    const size_t n_samples_trigger =
+        (size_t)pacing.trigger_ms * WHISPER_SAMPLE_RATE / 1000;
+    const size_t n_samples_iter_threshold =
+        (size_t)pacing.window_ms * WHISPER_SAMPLE_RATE / 1000;
+
     {
       std::unique_lock<std::mutex> lock(s_mutex);
       // When there is not enough audio data availabe, skip whisper inference.
       if (s_queued_pcmf32.size() < n_samples_trigger) {
         lock.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        // Polling often enough for short adaptive triggers
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(std::min(100, pacing.trigger_ms / 2)));
         continue;
       }
     }
 
     {
+      STT_TRACE_SCOPE("queue_drain");
       std::lock_guard<std::mutex> lock(s_mutex);
-      // Copying from the queued shared buffer to local buffer which will be
-      // processed by whisper.
-      pcmf32.insert(pcmf32.end(), s_queued_pcmf32.begin(),
-                    s_queued_pcmf32.end());
-      // After copy we clear the shared buffer.
-      s_queued_pcmf32.clear();
+      // Taking over the queued shared buffer, which leaves it empty. The audio
+      // is appended to the local buffer outside of the lock.
+      pcmf32_new.clear();
+      pcmf32_new.swap(s_queued_pcmf32);
+      metrics.queue_wait_ms =
+          elapsed_ms(t_first_queued, std::chrono::steady_clock::now());
+      // All queued chunks were drained, so the last sample of the local buffer
+      // is the last sample of the most recent chunk.
+      n_samples_drained = n_samples_received;
+      utterance_span.end = n_samples_drained;
+      while (!s_chunk_arrivals.empty() &&
+             s_chunk_arrivals.front().first <= n_samples_drained) {
+        t_last_sample_arrival = s_chunk_arrivals.front().second;
+        s_chunk_arrivals.pop_front();
+      }
+    }
+
+    // Audio which queued up beyond the trigger since the last drain. The
+    // drained audio is always at least the trigger, only the excess grows
+    // with the time the previous iteration took and measures the overload.
+    const int drained_ms = pcmf32_new.size() * 1000 / WHISPER_SAMPLE_RATE;
+    const int backlog_ms = std::max(0, drained_ms - pacing.trigger_ms);
+    // Yielding the CPU of the refinement worker until the loop caught up
+    is_foreground_busy = backlog_ms > pacing.trigger_ms;
+    size_t n_samples_dropped = 0;
+    if (config.drop_silence_backlog_ms > 0 &&
+        backlog_ms > config.drop_silence_backlog_ms) {
+      STT_TRACE_SCOPE("drop_silence");
+      n_samples_dropped =
+          drop_silent_frames(pcmf32_new, mean_energy(pcmf32), vad_thold);
+      n_samples_silence_dropped += n_samples_dropped;
+    }
+    // Dropped silence is not seen by the VAD anymore, a pause of the VAD
+    // length ends the speech as well.
+    const bool is_dropped_pause =
+        n_samples_dropped >= (size_t)WHISPER_SAMPLE_RATE * vad_last_ms / 1000;
+    // Nothing new to transcribe when all of the drained audio was silence,
+    // unless the pause ends an utterance which was not finalized yet (more
+    // than the audio kept from the previous final)
+    if (pcmf32_new.empty() &&
+        (!is_dropped_pause || pcmf32.size() <= (size_t)n_samples_keep_iter)) {
+      continue;
+    }
+    pcmf32.insert(pcmf32.end(), pcmf32_new.begin(), pcmf32_new.end());
+
+    if (config.shed_partials_backlog_ms > 0 &&
+        backlog_ms > config.shed_partials_backlog_ms) {
+      is_shedding_partials = true;
+    }
+    if (fallback_ctx && config.fallback_backlog_ms > 0) {
+      if (backlog_ms > config.fallback_backlog_ms) {
+        is_fallback = true;
+      } else if (backlog_ms < config.fallback_backlog_ms / 2) {
+        is_fallback = false;
+      }
+    }
+
+    // The kept tail of a final needs more audio than the keep length, e.g.
+    // the first drain after Start() can be mostly dropped silence
+    bool speech_has_end =
+        is_dropped_pause && pcmf32.size() > (size_t)n_samples_keep_iter;
+
+    // Check for Voice-Activity-Detection when enough audio was accumulated.
+    // This is used to check if the speech has ended and ensures a smoother
+    // transition to the next iteration. It only depends on the audio, so it
+    // runs ahead of the inference to decide whether a partial can be skipped.
+    // ref:
+    // https://github.com/ggerganov/whisper.cpp/blob/ccc2547210e09e3a1785817383ab770389bb442b/examples/stream/stream.cpp#L288
+    if ((int)pcmf32.size() >= n_samples_vad_window) {
+      STT_TRACE_SCOPE("vad");
+      std::vector<float> pcmf32_window(pcmf32.end() - n_samples_vad_window,
+                                       pcmf32.end());
+      speech_has_end =
+          speech_has_end || vad_simple(pcmf32_window, WHISPER_SAMPLE_RATE,
+                                       vad_last_ms, vad_thold, freq_thold,
+                                       false);
+    }
+
+    // Clearing audio buffer after the inference when:
+    // 1. Buffer size exceeds the iteration threshold.
+    // 2. End of speech was detected.
+    const bool is_final =
+        pcmf32.size() > n_samples_iter_threshold || speech_has_end;
+    if (!is_final && is_shedding_partials) {
+      n_partials_skipped++;
+      continue;
+    }
+    // Only the final of the overloaded window is transcribed, the next window
+    // starts with partials again.
+    if (is_final) {
+      is_shedding_partials = false;
+    }
+
+    if (is_final && is_two_tier) {
+      STT_TRACE_SCOPE("final_handoff");
+      final_job job;
+      job.utterance_id = next_utterance_id;
+      job.pcmf32 = pcmf32;
+      job.t_last_sample_arrival = t_last_sample_arrival;
+      job.metrics = metrics;
+      job.metrics.trigger_ms = pacing.trigger_ms;
+      job.metrics.window_ms = pacing.window_ms;
+      job.audio_ctx =
+          config.is_adaptive ? pacing.audio_ctx(config) : max_audio_ctx;
+      job.is_fallback = is_fallback;
+      {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        job.clear_generation = clear_generation;
+        s_final_queue.push_back(std::move(job));
+        is_final_pending = true;
+      }
+      s_final_cv.notify_one();
+
+      audio_retention.add_utterance(next_utterance_id, utterance_span);
+      utterance_span.begin = utterance_span.end - n_samples_keep_iter;
+      next_utterance_id++;
+      std::vector<float> last(pcmf32.end() - n_samples_keep_iter,
+                              pcmf32.end());
+      pcmf32 = std::move(last);
+      continue;
     }
 
     {
+      // Model of this iteration, the partial model in two-tier mode or the
+      // fallback model while overloaded
+      struct whisper_context *iter_ctx = ctx;
+      if (is_two_tier) {
+        iter_ctx = partial_ctx;
+      } else if (is_fallback) {
+        iter_ctx = fallback_ctx;
+        n_fallback_iterations++;
+      }
       // Contains the current transcription result
       transcribed_segment segment;
+      segment.utterance_id = next_utterance_id;
       // Running whisper inference on copied audio buffer with preconfigured
       // model parameters. This will create the transcription and store it in
       // whisper context.
-      int ret = whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size());
+      if (config.is_adaptive) {
+        wparams.audio_ctx = pacing.audio_ctx(config);
+      }
+      // Window of the pipelined mode, which is decoded by the decoder stage
+      pipeline_slot *slot = nullptr;
+      // Time the iteration occupies the worker, pipelined it is the slower
+      // one of both stages.
+      double stage_ms = 0.0;
+      int ret = 0;
+      if (pipeline && iter_ctx == ctx) {
+        STT_TRACE_SCOPE("pipeline_encode");
+        slot = &pipeline->acquire();
+        const double decode_ms = slot->metrics.decode_ms;
+        slot->t_start = std::chrono::steady_clock::now();
+        thread_lease lease(budget.get(), model_config.n_threads);
+        slot->decoder->set_n_threads(lease.n_threads());
+        if (!slot->decoder->encode(pcmf32.data(), pcmf32.size(),
+                                   wparams.audio_ctx, slot->result)) {
+          ret = -1;
+        }
+        metrics.mel_ms = slot->result.mel_ms;
+        metrics.encode_ms = slot->result.encode_ms;
+        metrics.audio_ms = pcmf32.size() * 1000.0 / WHISPER_SAMPLE_RATE;
+        stage_ms = std::max(metrics.mel_ms + metrics.encode_ms, decode_ms);
+      } else {
+        // Emitted segments stay in order with the pipelined windows
+        if (pipeline) {
+          pipeline->wait_idle();
+        }
+        thread_lease lease(budget.get(), model_config.n_threads);
+        wparams.n_threads = lease.n_threads();
+        ret = run_inference(iter_ctx, states.get(iter_ctx), wparams, timings,
+                            iter_ctx == ctx ? decoder.get() : nullptr, pcmf32,
+                            metrics, segment.text);
+        stage_ms = metrics.inference_ms;
+      }
       if (ret != 0) {
         fprintf(stderr, "Failed to process audio, returned %d\n", ret);
         continue;
       }
-      // Extracting text data from the segments of the inference process.
-      const int segments_size = whisper_full_n_segments(ctx);
-      for (int segment_index = 0; segment_index < segments_size;
-           ++segment_index) {
-        // Get text information of segment
-        const char *segment_text =
-            whisper_full_get_segment_text(ctx, segment_index);
-        // for word level timestamps:
-        // const int64_t word_start_ms =
-        //     is_word_level_mode == true
-        //         ? whisper_full_get_segment_t0(ctx, segment_index)
-        //         : 0;
-        // const int64_t word_end_ms =
-        //     is_word_level_mode == true
-        //         ? whisper_full_get_segment_t1(ctx, segment_index)
-        //         : 0;
-
-        segment.text += segment_text;
-        // segment.start_time_ms = word_start_ms;
-        // segment.end_time_ms = word_end_ms;
-      }
-
-      bool speech_has_end = false;
-
-      // Check for Voice-Activity-Detection when enough audio was accumulated.
-      // This is used to check if the speech has ended and ensures a smoother
-      // transition to the next iteration.
-      // ref:
-      // https://github.com/ggerganov/whisper.cpp/blob/ccc2547210e09e3a1785817383ab770389bb442b/examples/stream/stream.cpp#L288
-      if ((int)pcmf32.size() >= n_samples_vad_window) {
-        std::vector<float> pcmf32_window(pcmf32.end() - n_samples_vad_window,
-                                         pcmf32.end());
-        speech_has_end = vad_simple(pcmf32_window, WHISPER_SAMPLE_RATE,
-                                    vad_last_ms, vad_thold, freq_thold, false);
+      if (config.is_adaptive) {
+        pacing.update(config, iter_threshold_ms, stage_ms);
       }
+      metrics.trigger_ms = pacing.trigger_ms;
+      metrics.window_ms = pacing.window_ms;
 
-      // Clearing audio buffer when:
-      // 1. Buffer size exceeds the iteration threshold.
-      // 2. End of speech was detected.
-      if (pcmf32.size() > n_samples_iter_threshold || speech_has_end) {
-        const auto t_now = std::chrono::high_resolution_clock::now();
-        const auto t_diff =
-            std::chrono::duration_cast<std::chrono::milliseconds>(t_now -
-                                                                  t_last_iter)
-                .count();
-        printf("iter took: %ldms\n", t_diff);
-        t_last_iter = t_now;
+      if (is_final) {
         // Shared variable with the client which holds the processing state of
         // the segment.
         segment.is_partial = false;
+        audio_retention.add_utterance(next_utterance_id, utterance_span);
+        utterance_span.begin = utterance_span.end - n_samples_keep_iter;
+        next_utterance_id++;
+        if (config.is_refinement) {
+          pcmf32_final = pcmf32;
+        }
         std::vector<float> last(pcmf32.end() - n_samples_keep_iter,
                                 pcmf32.end());
         // Copy the recent 0.5s into the cleared buffer for a better transition
@@ -401,21 +1298,506 @@ void SpeechToTextEngine::Process() {
         segment.is_partial = true;
       }
 
+      if (slot) {
+        slot->segment = std::move(segment);
+        slot->metrics = metrics;
+        slot->t_last_sample_arrival = t_last_sample_arrival;
+        slot->max_tokens = wparams.max_tokens;
+        slot->pcmf32_final.clear();
+        if (is_final && config.is_refinement) {
+          slot->pcmf32_final.swap(pcmf32_final);
+        }
+        {
+          std::lock_guard<std::mutex> lock(s_mutex);
+          slot->clear_generation = clear_generation;
+        }
+        pipeline->submit(*slot);
+        continue;
+      }
+
+      STT_TRACE_SCOPE("result_handoff");
+      std::lock_guard<std::mutex> lock(s_mutex);
+      if (is_final && config.is_refinement) {
+        QueueRefinement(pcmf32_final, segment);
+      }
+      EmitSegment(std::move(segment), t_last_sample_arrival);
+      PushIterationMetrics(metrics);
+    }
+  }
+
+  if (pipeline) {
+    pipeline->stop();
+  }
+}
+
+// Decoder stage of the pipelined mode. Decodes the windows in the order the
+// inference worker encoded them and emits their segments.
+void SpeechToTextEngine::ProcessDecodes(inference_pipeline &pipeline) {
+  trace_set_thread_name("decode_stage");
+  ApplySchedulingConfiguration();
+
+  while (true) {
+    pipeline_slot *slot;
+    {
+      std::unique_lock<std::mutex> lock(pipeline.s_mutex);
+      pipeline.s_cv.wait(lock, [&pipeline] {
+        return !pipeline.s_pending.empty() || pipeline.is_stopping;
+      });
+      if (pipeline.s_pending.empty()) {
+        break;
+      }
+      slot = pipeline.s_pending.front();
+    }
+
+    bool is_decoded;
+    {
+      STT_TRACE_SCOPE("pipeline_decode");
+      thread_lease lease(budget.get(), model_config.n_threads);
+      slot->decoder->set_n_threads(lease.n_threads());
+      is_decoded = slot->decoder->decode(slot->max_tokens, slot->result);
+    }
+    iteration_metrics &metrics = slot->metrics;
+    metrics.decode_ms = slot->result.decode_ms;
+    metrics.inference_ms =
+        elapsed_ms(slot->t_start, std::chrono::steady_clock::now());
+    metrics.rtf = metrics.inference_ms / metrics.audio_ms;
+    metrics.n_tokens = slot->result.n_tokens;
+    metrics.n_draft_proposed = slot->result.n_draft_proposed;
+    metrics.n_draft_accepted = slot->result.n_draft_accepted;
+    slot->segment.text = std::move(slot->result.text);
+
+    {
+      STT_TRACE_SCOPE("result_handoff");
       std::lock_guard<std::mutex> lock(s_mutex);
-      // Moving the segment to a shared array with client.
-      s_transcribed_segments.insert(s_transcribed_segments.end(),
-                                    std::move(segment));
+      if (!is_decoded) {
+        fprintf(stderr, "Failed to decode audio\n");
+      } else if (slot->clear_generation == clear_generation) {
+        if (!slot->pcmf32_final.empty()) {
+          QueueRefinement(slot->pcmf32_final, slot->segment);
+        }
+        EmitSegment(std::move(slot->segment), slot->t_last_sample_arrival);
+        PushIterationMetrics(metrics);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(pipeline.s_mutex);
+      pipeline.s_pending.pop_front();
+      slot->is_busy = false;
+    }
+    pipeline.s_cv.notify_all();
+  }
+}
+
+// Transcribes the finalized utterances with the selected model, while the
+// inference worker continues with partials of the next utterance.
+void SpeechToTextEngine::ProcessFinals() {
+  trace_set_thread_name("final_worker");
+  ApplySchedulingConfiguration();
+
+  inference_timings timings;
+  struct whisper_full_params wparams = streaming_params(model_config, &timings);
+  worker_states states;
+  stream_configuration config;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    config = stream_config;
+  }
+  std::unique_ptr<speculative_decoder> decoder = make_speculative_decoder(
+      ctx, draft_ctx, model_config, config.n_draft_tokens);
+
+  while (true) {
+    final_job job;
+    {
+      std::unique_lock<std::mutex> lock(s_mutex);
+      s_final_cv.wait(lock,
+                      [this] { return !s_final_queue.empty() || !is_running; });
+      // Utterances which were finalized before Stop() are still transcribed
+      if (s_final_queue.empty()) {
+        break;
+      }
+      job = std::move(s_final_queue.front());
+      s_final_queue.pop_front();
+      is_final_in_flight = true;
+    }
+
+    struct whisper_context *iter_ctx = job.is_fallback ? fallback_ctx : ctx;
+    if (job.is_fallback) {
+      n_fallback_iterations++;
     }
+    transcribed_segment segment;
+    segment.utterance_id = job.utterance_id;
+    segment.is_partial = false;
+
+    wparams.audio_ctx = job.audio_ctx;
+    int ret;
+    {
+      thread_lease lease(budget.get(), model_config.n_threads);
+      wparams.n_threads = lease.n_threads();
+      ret = run_inference(iter_ctx, states.get(iter_ctx), wparams, timings,
+                          iter_ctx == ctx ? decoder.get() : nullptr,
+                          job.pcmf32, job.metrics, segment.text);
+    }
+    if (ret != 0) {
+      fprintf(stderr, "Failed to process audio, returned %d\n", ret);
+    }
+
+    STT_TRACE_SCOPE("result_handoff");
+    std::lock_guard<std::mutex> lock(s_mutex);
+    is_final_in_flight = false;
+    is_final_pending = !s_final_queue.empty();
+    if (ret != 0 || job.clear_generation != clear_generation) {
+      // A held partial must not wait for a final which is never emitted
+      if (has_held_partial && s_final_queue.empty()) {
+        has_held_partial = false;
+        EmitSegment(std::move(s_held_partial), t_held_partial_arrival);
+      }
+      continue;
+    }
+    if (config.is_refinement) {
+      QueueRefinement(job.pcmf32, segment);
+    }
+    EmitSegment(std::move(segment), job.t_last_sample_arrival);
+    PushIterationMetrics(job.metrics);
   }
 }
 
-// This function reads a WAV file and transcribe it with the whisper model.
+// Abort callback of the refinement inference, checked by ggml between the
+// graph nodes.
+bool SpeechToTextEngine::IsRefinementPreempted(void *user_data) {
+  SpeechToTextEngine *engine = static_cast<SpeechToTextEngine *>(user_data);
+  return !engine->is_running || engine->is_foreground_busy ||
+         engine->is_final_pending;
+}
+
+// Re-transcribes finalized utterances with beam search, and the refinement
+// model when set, on the cores the streaming workers leave idle. The worker
+// runs with the lowest priority, so the scheduler always prefers the streaming
+// workers, and its inference is aborted as soon as they fall behind. Aborted
+// utterances are retried once the streaming loop caught up again.
+void SpeechToTextEngine::ProcessRefinements() {
+  trace_set_thread_name("refine_worker");
+  scheduling_configuration low_priority;
+  low_priority.nice = 19;
+  apply_thread_scheduling(low_priority);
+
+  stream_configuration config;
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    config = stream_config;
+  }
+  struct whisper_context *iter_ctx = refine_ctx ? refine_ctx : ctx;
+  // Own state, the contexts are shared with the streaming workers and other
+  // sessions
+  worker_states states;
+  struct whisper_state *state = states.get(iter_ctx);
+  if (!state) {
+    fprintf(stderr, "%s: failed to initialize the refinement state\n",
+            __func__);
+    return;
+  }
+
+  struct whisper_full_params wparams = whisper_full_default_params(
+      whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH);
+  wparams.beam_search.beam_size = config.refinement_beam_size;
+  wparams.no_context = true;
+  wparams.single_segment = true;
+  wparams.print_progress = false;
+  wparams.print_realtime = false;
+  wparams.print_special = false;
+  wparams.print_timestamps = false;
+  wparams.language = model_config.language;
+  wparams.detect_language = false;
+  wparams.translate = false;
+  wparams.abort_callback = IsRefinementPreempted;
+  wparams.abort_callback_user_data = this;
+
+  while (true) {
+    refine_job job;
+    {
+      std::unique_lock<std::mutex> lock(s_mutex);
+      s_refine_cv.wait(
+          lock, [this] { return !s_refine_queue.empty() || !is_running; });
+      if (!is_running) {
+        break;
+      }
+      job = std::move(s_refine_queue.front());
+      s_refine_queue.pop_front();
+    }
+
+    // Waiting for idle cores before starting on the utterance
+    while (IsRefinementPreempted(this) && is_running) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+
+    int ret = -1;
+    if (is_running) {
+      STT_TRACE_SCOPE("refinement");
+      // Spare cores next to the threads of the streaming workers, leased like
+      // theirs so sessions and the refinement share the budget
+      const int n_streaming_threads =
+          model_config.n_threads * (partial_ctx ? 2 : 1);
+      thread_lease lease(
+          budget.get(),
+          std::max(1, (int)std::thread::hardware_concurrency() -
+                          n_streaming_threads));
+      wparams.n_threads = lease.n_threads();
+      ret = whisper_full_with_state(iter_ctx, state, wparams,
+                                    job.pcmf32.data(), job.pcmf32.size());
+    }
+
+    std::string text;
+    if (ret == 0) {
+      const int n_segments = whisper_full_n_segments_from_state(state);
+      for (int i = 0; i < n_segments; i++) {
+        text += whisper_full_get_segment_text_from_state(state, i);
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (job.clear_generation != clear_generation) {
+      continue;
+    }
+    if (ret != 0 && IsRefinementPreempted(this)) {
+      // Preempted by the streaming workers or Stop(), retried later. Newer
+      // utterances may have pushed the queue to its bound meanwhile.
+      if (s_refine_queue.size() < max_refine_jobs) {
+        s_refine_queue.push_front(std::move(job));
+      }
+      continue;
+    }
+    if (ret != 0) {
+      fprintf(stderr, "Failed to refine audio, returned %d\n", ret);
+      continue;
+    }
+    if (!text.empty() && text != job.text) {
+      segment_update update;
+      update.utterance_id = job.utterance_id;
+      update.text = std::move(text);
+      update.previous_text = std::move(job.text);
+      s_segment_updates.push_back(std::move(update));
+    }
+  }
+}
+
+// Hashes the decoding parameters which change the transcription, the
+// threads and logging are left out
+static uint64_t hash_decoding_params(const whisper_full_params &wparams,
+                                     uint64_t hash) {
+  const std::string language =
+      wparams.language != nullptr ? wparams.language : "";
+  const std::string initial_prompt =
+      wparams.initial_prompt != nullptr ? wparams.initial_prompt : "";
+  const int32_t values[] = {
+      wparams.strategy,       wparams.n_max_text_ctx,
+      wparams.translate,      wparams.no_context,
+      wparams.single_segment, wparams.max_len,
+      wparams.split_on_word,  wparams.max_tokens,
+      wparams.audio_ctx,      wparams.detect_language,
+      wparams.suppress_blank, wparams.greedy.best_of,
+      wparams.beam_search.beam_size};
+  const float thresholds[] = {
+      wparams.temperature,   wparams.temperature_inc, wparams.entropy_thold,
+      wparams.logprob_thold, wparams.no_speech_thold, wparams.length_penalty};
+  hash = fnv1a_64(values, sizeof(values), hash);
+  hash = fnv1a_64(thresholds, sizeof(thresholds), hash);
+  hash = fnv1a_64(language.c_str(), language.size() + 1, hash);
+  return fnv1a_64(initial_prompt.c_str(), initial_prompt.size() + 1, hash);
+}
+
+// Segments of a file transcription, we do not provide word level editing on
+// file uploads
+static std::vector<transcribed_segment>
+segments_from_texts(std::vector<std::string> &&texts) {
+  std::vector<transcribed_segment> segments;
+  for (std::string &text : texts) {
+    segments.push_back({std::move(text), false, segments.size()});
+  }
+  return segments;
+}
+
+// Latest texts of a file transcription, up to roughly max_prompt_chars in
+// whole segments
+static std::string prompt_from_texts(const std::vector<std::string> &texts) {
+  std::string prompt;
+  for (auto text = texts.rbegin();
+       text != texts.rend() && prompt.size() < max_prompt_chars; ++text) {
+    prompt = *text + prompt;
+  }
+  return prompt;
+}
+
+// Decodes the file from the start into the hasher and counts its samples
+static bool hash_audio_file(const std::string &file_path, uint64_t &hash,
+                            uint64_t &n_samples) {
+  audio_file_reader reader;
+  if (!reader.open(file_path, WHISPER_SAMPLE_RATE)) {
+    return false;
+  }
+  sample_hasher hasher;
+  n_samples = 0;
+  std::vector<float> block;
+  while (reader.read(block, WHISPER_SAMPLE_RATE * 30)) {
+    hasher.update(block.data(), block.size());
+    n_samples += block.size();
+  }
+  hash = hasher.digest();
+  return !reader.is_failed();
+}
+
+// Decodes a sound file (see audio_file_reader) and transcribes it with the
+// whisper model. With a cache directory, the transcription is looked up by
+// the content of the decoded audio, the model and the decoding parameters
+// first, and stored after a miss.
+//
+// Only the chunk being transcribed is held in memory, not the whole decoded
+// recording (460MB for two hours). The key of the cache is computed in a
+// first pass over the file, the transcription decodes it once more.
 std::vector<transcribed_segment>
-SpeechToTextEngine::TranscribeFileInput(const std::string &file_path) {
+SpeechToTextEngine::TranscribeFileInput(const std::string &file_path,
+                                        const std::string &cache_directory) {
   if (file_path.empty()) {
     fprintf(stdout, "[ stream_whisper ] Error: no input files specified.\n");
   }
 
+  // Without a cache directory there is neither a cache nor a checkpoint
+  std::unique_ptr<transcription_cache> cache;
+  uint64_t key = 0;
+  uint64_t offset = 0;
+  std::vector<std::string> texts;
+  uint64_t model_hash = 0;
+  if (!cache_directory.empty() && hash_model_file(model_path, model_hash)) {
+    uint64_t n_total = 0;
+    if (!hash_audio_file(file_path, key, n_total)) {
+      fprintf(stdout, "error: Decoding '%s' failed.\n", file_path.c_str());
+      return {};
+    }
+    key = fnv1a_64(&model_hash, sizeof(model_hash), key);
+    key = hash_decoding_params(FileTranscriptionParams(), key);
+    cache.reset(new transcription_cache(cache_directory));
+
+    if (cache->find(key, texts)) {
+      fprintf(stdout, "[ stream_whisper ] Transcription of '%s' cached\n",
+              file_path.c_str());
+      return segments_from_texts(std::move(texts));
+    }
+    if (cache->find_checkpoint(key, offset, texts)) {
+      if (offset > n_total) {
+        offset = 0;
+        texts.clear();
+      }
+      fprintf(stdout, "[ stream_whisper ] Resuming '%s' at %.1fs\n",
+              file_path.c_str(), (double)offset / WHISPER_SAMPLE_RATE);
+    }
+  }
+
+  audio_file_reader reader;
+  if (!reader.open(file_path, WHISPER_SAMPLE_RATE)) {
+    fprintf(stdout, "error: Reading audio file failed.\n");
+    return {};
+  }
+  worker_states states;
+  struct whisper_state *state = states.get(ctx);
+  if (!state) {
+    fprintf(stderr, "Failed to allocate the whisper state\n");
+    return {};
+  }
+
+  // Decoded audio from window_offset on, the audio before the offset is
+  // dropped, also the part a resumed transcription skips
+  const uint64_t chunk_samples =
+      (uint64_t)file_chunk_seconds * WHISPER_SAMPLE_RATE;
+  std::vector<float> window;
+  uint64_t window_offset = 0;
+  std::vector<float> block;
+  bool is_end = false;
+  while (true) {
+    // A sample past the chunk tells whether the chunk is the last one
+    while (!is_end && window_offset + window.size() <= offset + chunk_samples) {
+      if (!reader.read(block, WHISPER_SAMPLE_RATE * 30)) {
+        if (reader.is_failed()) {
+          fprintf(stdout, "error: Decoding '%s' failed.\n", file_path.c_str());
+          // The checkpoint stays for the next attempt
+          return {};
+        }
+        is_end = true;
+      }
+      window.insert(window.end(), block.begin(), block.end());
+      const uint64_t n_drop = std::min<uint64_t>(
+          offset - std::min(offset, window_offset), window.size());
+      window.erase(window.begin(), window.begin() + n_drop);
+      window_offset += n_drop;
+    }
+    const uint64_t window_end = window_offset + window.size();
+    if (offset >= window_end) {
+      break;
+    }
+
+    // The progress is saved after every chunk, an interrupted transcription
+    // loses at most one chunk
+    const uint64_t n_samples = std::min(window_end - offset, chunk_samples);
+    const bool is_last_chunk = is_end && offset + n_samples == window_end;
+    if (!TranscribeChunk(state, window.data() + (offset - window_offset),
+                         n_samples, is_last_chunk, offset, texts)) {
+      // The checkpoint stays for the next attempt
+      return {};
+    }
+    if (cache && !is_last_chunk) {
+      cache->store_checkpoint(key, offset, texts);
+    }
+  }
+
+  if (cache) {
+    // Failed transcriptions are not cached
+    if (!texts.empty()) {
+      cache->store(key, texts);
+    }
+    cache->remove_checkpoint(key);
+  }
+  return segments_from_texts(std::move(texts));
+}
+
+// Transcribes a chunk of up to file_chunk_seconds of the audio, which starts
+// at the offset, and advances the offset past the appended texts. Unless it
+// is the last chunk, its last segment is dropped and transcribed again with
+// the next chunk, so no word is cut at the chunk boundary.
+bool SpeechToTextEngine::TranscribeChunk(struct whisper_state *state,
+                                         const float *samples,
+                                         uint64_t n_samples, bool is_last_chunk,
+                                         uint64_t &offset,
+                                         std::vector<std::string> &texts) {
+  // The text so far continues in the next chunk
+  const std::string prompt = prompt_from_texts(texts);
+  whisper_full_params wparams = FileTranscriptionParams();
+  wparams.initial_prompt = prompt.empty() ? nullptr : prompt.c_str();
+  int ret = whisper_full_with_state(ctx, state, wparams, samples, n_samples);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to process audio, returned %d\n", ret);
+    return false;
+  }
+
+  int n_segments = whisper_full_n_segments_from_state(state);
+  uint64_t next_offset = offset + n_samples;
+  if (!is_last_chunk && n_segments > 1) {
+    // Segment timestamps are in 10ms
+    const int64_t t0 =
+        whisper_full_get_segment_t0_from_state(state, n_segments - 1);
+    const uint64_t restart = offset + t0 * (WHISPER_SAMPLE_RATE / 100);
+    if (restart > offset && restart < next_offset) {
+      n_segments--;
+      next_offset = restart;
+    }
+  }
+  for (int segment_index = 0; segment_index < n_segments; ++segment_index) {
+    texts.push_back(
+        whisper_full_get_segment_text_from_state(state, segment_index));
+  }
+  offset = next_offset;
+  return true;
+}
+
+// Whisper settings of file and utterance transcriptions
+whisper_full_params SpeechToTextEngine::FileTranscriptionParams() const {
   struct whisper_full_params wparams = whisper_full_default_params(
       whisper_sampling_strategy::WHISPER_SAMPLING_GREEDY);
 
@@ -432,31 +1814,37 @@ SpeechToTextEngine::TranscribeFileInput(const std::string &file_path) {
   wparams.detect_language = false;
   // Disabling translation
   wparams.translate = false;
-  // Audio buffer accumulated from file input
-  std::vector<float> pcmf32;
+  return wparams;
+}
+
+// Transcribes a whole recording at once, with default whisper settings
+std::vector<transcribed_segment>
+SpeechToTextEngine::TranscribeAudio(const std::vector<float> &pcmf32) {
+  const whisper_full_params wparams = FileTranscriptionParams();
   // Transcribed segments from the whisper model
   std::vector<transcribed_segment> segments;
 
-  // For WAV files we are using a library to read its contents and extract the
-  // audio buffer
-  if (!read_wav(file_path, pcmf32)) {
-    fprintf(stdout, "error: Reading WAV file failed.\n");
+  // Running whisper model on accumulated audio data. The state is separate
+  // from the streaming workers, which may run at the same time.
+  worker_states states;
+  struct whisper_state *state = states.get(ctx);
+  if (!state) {
+    fprintf(stderr, "Failed to allocate the whisper state\n");
     return segments;
   }
-
-  // Running whisper model on accumulated audio data
-  int ret = whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size());
+  int ret = whisper_full_with_state(ctx, state, wparams, pcmf32.data(),
+                                    pcmf32.size());
   if (ret != 0) {
     fprintf(stderr, "Failed to process audio, returned %d\n", ret);
     return segments;
   }
 
   // Extracting text contents from transcribed segments
-  const int n_segments = whisper_full_n_segments(ctx);
+  const int n_segments = whisper_full_n_segments_from_state(state);
   for (int segment_index = 0; segment_index < n_segments; ++segment_index) {
     transcribed_segment segment;
     const char *segment_text =
-        whisper_full_get_segment_text(ctx, segment_index);
+        whisper_full_get_segment_text_from_state(state, segment_index);
 
     segment.text += segment_text;
     // We do not provide word level editing on file uploads. The whole file is
@@ -464,6 +1852,7 @@ SpeechToTextEngine::TranscribeFileInput(const std::string &file_path) {
     // segment.start_time_ms = 0;
     // segment.end_time_ms = 0;
     segment.is_partial = false;
+    segment.utterance_id = segment_index;
     segments.push_back(segment);
   }
 
@@ -1,7 +1,17 @@
 #ifndef STT_WHISPER_H_
 #define STT_WHISPER_H_
 
+#include "audio_store.h"
+#include "latency_histogram.h"
+#include "session_recorder.h"
+#include "shared_model.h"
+#include "thread_scheduling.h"
+
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -10,6 +20,44 @@
 struct transcribed_segment {
   std::string text;
   bool is_partial;
+  // Partials and the final of the same utterance share the id, ids increase
+  // with every finalized utterance.
+  uint64_t utterance_id;
+};
+
+// Refined transcription of an already finalized utterance, which replaces the
+// final text of the same utterance id.
+struct segment_update {
+  uint64_t utterance_id;
+  std::string text;
+  // Final text the refinement replaces, so edited text can be left alone
+  std::string previous_text;
+};
+
+// Timing breakdown of a single inference iteration of the streaming loop.
+struct iteration_metrics {
+  // Time the oldest queued audio waited until the worker picked it up
+  double queue_wait_ms;
+  // Log-mel spectrogram computation
+  double mel_ms;
+  // Encoder pass, including the initial prompt pass of the decoder
+  double encode_ms;
+  // Token by token decoding until end of text or max_tokens
+  double decode_ms;
+  // Total wall time of whisper_full
+  double inference_ms;
+  // Number of decoded tokens over all segments
+  int n_tokens;
+  // Length of the audio window passed to whisper
+  double audio_ms;
+  // Real-time factor, inference time relative to the audio window length
+  double rtf;
+  // Effective trigger and maximum window length after this iteration
+  int trigger_ms;
+  int window_ms;
+  // Speculative decoding, draft tokens proposed and accepted by the target
+  int n_draft_proposed;
+  int n_draft_accepted;
 };
 
 struct whisper_configuration {
@@ -17,7 +65,48 @@ struct whisper_configuration {
   int n_threads;
 };
 struct stream_configuration {
+  // Preferred minimum of new audio before an iteration runs
   int trigger_ms;
+  // Adapts trigger and window length to the measured inference time, so the
+  // stream keeps up with real time on slow machines and runs with the lowest
+  // latency on fast ones. The trigger_ms preference is the starting point.
+  bool is_adaptive = true;
+  int min_trigger_ms = 100;
+  int max_trigger_ms = 2000;
+  // Lower bound of the window before it is finalized, the upper bound is the
+  // fixed window of trigger_ms * 35. Shorter windows are encoded with a
+  // reduced audio context. Kept above the 3s of the VAD window.
+  int min_window_ms = 4000;
+  // Overload policies, each triggered by the backlog of audio which queued up
+  // beyond the trigger while the previous iteration was running. A threshold
+  // of 0 disables the policy. Partials are skipped until the next final once
+  // triggered.
+  int shed_partials_backlog_ms = 2000;
+  int drop_silence_backlog_ms = 1000;
+  // Switches to the fallback model (see SetFallbackModel) until the backlog
+  // is below half of the threshold again.
+  int fallback_backlog_ms = 3000;
+  // Tokens the draft model proposes per verification pass of the selected
+  // model, see SetDraftModel.
+  int n_draft_tokens = 4;
+  // Overlaps the mel and encoder pass of the next window with the decoding of
+  // the current one, on two whisper states of the selected model. Uses twice
+  // the threads of the model configuration and the decoder of SetDraftModel,
+  // with or without draft model, which decodes the same tokens as the
+  // whisper_full call of the unpipelined mode.
+  bool is_pipelined = false;
+  // Re-transcribes finalized utterances with beam search on a low priority
+  // worker, optionally with a larger model (see SetRefinementModel). The
+  // refinement is aborted whenever the streaming loop falls behind.
+  bool is_refinement = false;
+  int refinement_beam_size = 5;
+};
+
+// How often the overload policies fired since the engine was created.
+struct load_shedding_counters {
+  uint64_t partials_skipped;
+  double silence_dropped_ms;
+  uint64_t fallback_iterations;
 };
 
 typedef struct {
@@ -37,6 +126,41 @@ typedef struct {
   bool print_timestamps;
 } whisper_stream_params;
 
+// First order high-pass filter, applied in place
+void high_pass_filter(std::vector<float> &data, float cutoff,
+                      float sample_rate);
+// Energy based voice activity detection, returns true when the last
+// `last_ms` of the buffer are silent compared to the whole buffer
+bool vad_simple(std::vector<float> &pcmf32, int sample_rate, int last_ms,
+                float vad_thold, float freq_thold, bool verbose);
+// Reads a 16kHz 16-bit mono or stereo WAV file into a mono PCM-F32 buffer
+bool read_wav(const std::string &fpath, std::vector<float> &pcmf32);
+
+// Finalized utterance waiting for the final model, see SetPartialModel.
+struct final_job {
+  uint64_t utterance_id;
+  std::vector<float> pcmf32;
+  // Arrival of the last sample of the utterance
+  std::chrono::steady_clock::time_point t_last_sample_arrival;
+  // Metrics of the partial worker at the time the utterance was finalized
+  iteration_metrics metrics;
+  int audio_ctx;
+  bool is_fallback;
+  // Jobs of an earlier ClearAudioData are dropped
+  uint64_t clear_generation;
+};
+
+// Finalized utterance waiting for the refinement worker.
+struct refine_job {
+  uint64_t utterance_id;
+  std::vector<float> pcmf32;
+  std::string text;
+  uint64_t clear_generation;
+};
+
+// Encoder and decoder stage of the pipelined mode, see is_pipelined.
+struct inference_pipeline;
+
 class SpeechToTextEngine {
 public:
   SpeechToTextEngine(const std::string &path_model, const char *language,
@@ -46,30 +170,135 @@ public:
   void Start();
   void Stop();
   void ClearAudioData();
+  void SetSchedulingConfiguration(const scheduling_configuration &config);
+  void SetStreamConfiguration(const stream_configuration &config);
+  bool SetFallbackModel(const std::string &path_model);
+  bool SetPartialModel(const std::string &path_model);
+  bool SetDraftModel(const std::string &path_model);
+  bool SetRefinementModel(const std::string &path_model);
+  bool StartSessionRecording(const std::string &path);
+  void StopSessionRecording();
+  bool StartAudioRetention(const std::string &directory, int max_seconds);
+  void StopAudioRetention();
+  bool GetUtteranceAudio(uint64_t utterance_id, std::vector<float> &pcmf32);
+  std::vector<transcribed_segment> TranscribeUtterance(uint64_t utterance_id);
   void AddAudioData(const std::vector<float> &new_data);
   std::vector<transcribed_segment> GetTranscribedText();
+  std::vector<segment_update> GetSegmentUpdates();
+  std::vector<iteration_metrics> GetIterationMetrics();
+  latency_summary GetLatencySummary(bool is_partial) const;
+  load_shedding_counters GetLoadSheddingCounters() const;
+  // Transcribes a WAV or FLAC file, or on macOS any format Core Audio reads,
+  // at any sample rate and channel count. Results are reused from the
+  // transcription cache in the directory, unless it is empty. Long files are
+  // decoded and transcribed in chunks with a checkpoint in the same directory,
+  // a failed or interrupted transcription of the same file resumes from the
+  // last chunk.
   std::vector<transcribed_segment>
-  TranscribeFileInput(const std::string &file_path);
+  TranscribeFileInput(const std::string &file_path,
+                      const std::string &cache_directory = "");
 
 private:
+  // Models are shared with the other engines of the process which use the
+  // same model files, each worker runs on whisper states of its own.
+  std::shared_ptr<struct whisper_context> model;
+  std::shared_ptr<struct whisper_context> fallback_model;
+  std::shared_ptr<struct whisper_context> partial_model;
+  std::shared_ptr<struct whisper_context> draft_model;
+  std::shared_ptr<struct whisper_context> refine_model;
   struct whisper_context *ctx;
+  // Path of the selected model, identifies it in the transcription cache
+  std::string model_path;
+  // Smaller model used while the engine is overloaded, optional
+  struct whisper_context *fallback_ctx;
+  // Fast model for partials, optional. When set, finals are transcribed by
+  // the selected model on a separate worker.
+  struct whisper_context *partial_ctx;
+  // Draft model for speculative decoding of the selected model, optional
+  struct whisper_context *draft_ctx;
+  // Larger model for the refinement of finalized utterances, optional
+  struct whisper_context *refine_ctx;
   // Shared conditions
   std::atomic<bool> is_running;
   std::atomic<bool> is_clear_audio;
   std::atomic<bool> is_word_level_mode;
   // Shared audio buffer
   std::vector<float> s_queued_pcmf32;
+  // Arrival of the oldest audio in the shared queue
+  std::chrono::steady_clock::time_point t_first_queued;
+  // Monotonic sample counters of all received and all drained audio
+  uint64_t n_samples_received;
+  uint64_t n_samples_drained;
+  // Arrival time of each queued chunk, keyed by the sample counter at its end
+  std::deque<std::pair<uint64_t, std::chrono::steady_clock::time_point>>
+      s_chunk_arrivals;
   // Shared transcription results
   std::vector<transcribed_segment> s_transcribed_segments;
+  // Shared timing metrics of the recent iterations, bounded in size
+  std::vector<iteration_metrics> s_iteration_metrics;
+  // End-to-end latency from audio arrival to emitted text
+  latency_histogram latency_partial;
+  latency_histogram latency_final;
+  // Counters of the overload policies
+  std::atomic<uint64_t> n_partials_skipped;
+  std::atomic<uint64_t> n_samples_silence_dropped;
+  std::atomic<uint64_t> n_fallback_iterations;
   // Whisper model & inference configuration
   whisper_configuration model_config;
   // Streaming configuration
   stream_configuration stream_config;
+  // Thread scheduling of the inference worker, applied on Start()
+  scheduling_configuration sched_config;
+  // CPU threads shared fairly with the other running engines of the process
+  std::shared_ptr<thread_budget> budget;
+  bool is_budget_session;
+  // Opt-in capture of the engine input for deterministic replays
+  session_recorder recorder;
+  // Opt-in retention of the input, linked to the finalized utterances
+  audio_store audio_retention;
+  // Id of the utterance the streaming loop transcribes. Keeps increasing over
+  // Stop() and Start(), so ids of earlier sessions never map to newer audio.
+  uint64_t next_utterance_id;
+  // Finalized utterances for the final worker
+  std::deque<final_job> s_final_queue;
+  bool is_final_in_flight;
+  uint64_t clear_generation;
+  std::condition_variable s_final_cv;
+  // Newest partial of the next utterance, held back until the final of the
+  // previous utterance was emitted, so the client receives them in order.
+  transcribed_segment s_held_partial;
+  std::chrono::steady_clock::time_point t_held_partial_arrival;
+  bool has_held_partial;
+  // Finalized utterances for the refinement worker, bounded in size
+  std::deque<refine_job> s_refine_queue;
+  std::condition_variable s_refine_cv;
+  std::vector<segment_update> s_segment_updates;
+  // Set while the streaming loop falls behind and while finals wait for the
+  // final worker, both abort and pause the refinement.
+  std::atomic<bool> is_foreground_busy;
+  std::atomic<bool> is_final_pending;
   // Thread for transcription processing in background
   std::mutex s_mutex;
   std::thread worker;
+  std::thread final_worker;
+  std::thread refine_worker;
   void Process();
-  std::chrono::time_point<std::chrono::high_resolution_clock> t_last_iter;
+  void ProcessFinals();
+  void ProcessRefinements();
+  void ProcessDecodes(inference_pipeline &pipeline);
+  void QueueRefinement(const std::vector<float> &pcmf32,
+                       const transcribed_segment &segment);
+  static bool IsRefinementPreempted(void *user_data);
+  void ApplySchedulingConfiguration();
+  void EmitSegment(transcribed_segment &&segment,
+                   std::chrono::steady_clock::time_point t_last_sample_arrival);
+  void PushIterationMetrics(const iteration_metrics &metrics);
+  struct whisper_full_params FileTranscriptionParams() const;
+  bool TranscribeChunk(struct whisper_state *state, const float *samples,
+                       uint64_t n_samples, bool is_last_chunk,
+                       uint64_t &offset, std::vector<std::string> &texts);
+  std::vector<transcribed_segment>
+  TranscribeAudio(const std::vector<float> &pcmf32);
 };
 
 #endif // STT_WHISPER_H_
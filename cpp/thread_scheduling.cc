@@ -0,0 +1,136 @@
+#include "thread_scheduling.h"
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#include <sys/qos.h>
+#else
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+bool apply_thread_scheduling(const scheduling_configuration &config) {
+  bool is_applied = true;
+  HANDLE thread = GetCurrentThread();
+
+  if (!config.cpu_affinity.empty()) {
+    DWORD_PTR mask = 0;
+    for (int cpu : config.cpu_affinity) {
+      if (cpu >= 0 && cpu < (int)(sizeof(DWORD_PTR) * 8)) {
+        mask |= ((DWORD_PTR)1) << cpu;
+      }
+    }
+    if (mask == 0 || SetThreadAffinityMask(thread, mask) == 0) {
+      fprintf(stderr, "%s: failed to set thread affinity\n", __func__);
+      is_applied = false;
+    }
+  }
+
+  // Windows has no per-thread nice value, raising the thread priority is the
+  // closest equivalent.
+  int priority = THREAD_PRIORITY_NORMAL;
+  if (config.realtime) {
+    priority = THREAD_PRIORITY_TIME_CRITICAL;
+  } else if (config.nice < 0) {
+    priority = THREAD_PRIORITY_HIGHEST;
+  } else if (config.nice > 0) {
+    priority = THREAD_PRIORITY_BELOW_NORMAL;
+  }
+  if (priority != THREAD_PRIORITY_NORMAL &&
+      SetThreadPriority(thread, priority) == 0) {
+    fprintf(stderr, "%s: failed to set thread priority\n", __func__);
+    is_applied = false;
+  }
+
+  return is_applied;
+}
+
+#elif defined(__APPLE__)
+
+bool apply_thread_scheduling(const scheduling_configuration &config) {
+  bool is_applied = true;
+
+  // Darwin does not support pinning threads to cores. The scheduler places
+  // user-interactive threads on the performance cores of Apple Silicon, which
+  // covers the main use case of the affinity setting.
+  if (!config.cpu_affinity.empty()) {
+    fprintf(stderr,
+            "%s: cpu affinity is not supported on macOS, using QoS instead\n",
+            __func__);
+  }
+
+  qos_class_t qos = QOS_CLASS_UNSPECIFIED;
+  if (config.realtime || config.nice < 0 || !config.cpu_affinity.empty()) {
+    qos = QOS_CLASS_USER_INTERACTIVE;
+  } else if (config.nice > 0) {
+    qos = QOS_CLASS_UTILITY;
+  }
+  if (qos != QOS_CLASS_UNSPECIFIED &&
+      pthread_set_qos_class_self_np(qos, 0) != 0) {
+    fprintf(stderr, "%s: failed to set thread QoS class\n", __func__);
+    is_applied = false;
+  }
+
+  return is_applied;
+}
+
+#else
+
+bool apply_thread_scheduling(const scheduling_configuration &config) {
+  bool is_applied = true;
+
+  if (!config.cpu_affinity.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int cpu : config.cpu_affinity) {
+      if (cpu >= 0 && cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &cpu_set);
+      }
+    }
+    int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                     &cpu_set);
+    if (ret != 0) {
+      fprintf(stderr, "%s: failed to set thread affinity: %s\n", __func__,
+              strerror(ret));
+      is_applied = false;
+    }
+  }
+
+  // On Linux the nice value is a per-thread attribute, addressed by the kernel
+  // thread id of the calling thread.
+  if (config.nice != 0) {
+    const pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (setpriority(PRIO_PROCESS, tid, config.nice) != 0) {
+      fprintf(stderr, "%s: failed to set nice value %d: %s\n", __func__,
+              config.nice, strerror(errno));
+      is_applied = false;
+    }
+  }
+
+  if (config.realtime) {
+    // Lowest real-time priority is enough to preempt every thread of the
+    // default class, while not starving other real-time threads (audio).
+    struct sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+    int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (ret != 0) {
+      fprintf(stderr, "%s: failed to set real-time scheduling: %s\n",
+              __func__, strerror(ret));
+      is_applied = false;
+    }
+  }
+
+  return is_applied;
+}
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef STT_THREAD_SCHEDULING_H_
+#define STT_THREAD_SCHEDULING_H_
+
+#include <vector>
+
+struct scheduling_configuration {
+  // CPU core ids the inference worker (and the compute threads it spawns) are
+  // pinned to, e.g. the performance cores on hybrid CPUs. An empty list keeps
+  // the default scheduling of the operating system.
+  std::vector<int> cpu_affinity;
+  // Nice value for the inference threads (-20 highest, 19 lowest). Only
+  // applied when set to a non-zero value. Linux only, other platforms map
+  // negative values to a raised thread priority.
+  int nice = 0;
+  // Requests a real-time scheduling class for the inference threads. This
+  // needs elevated privileges on Linux (CAP_SYS_NICE or rtprio limits) and
+  // falls back to the default class when not permitted.
+  bool realtime = false;
+};
+
+// Applies the scheduling configuration to the calling thread. Threads which
+// are created afterwards by the calling thread (e.g. ggml compute threads)
+// inherit affinity and priority on Linux and macOS. Returns false when one of
+// the settings could not be applied, which is not fatal for the caller.
+bool apply_thread_scheduling(const scheduling_configuration &config);
+
+#endif // STT_THREAD_SCHEDULING_H_
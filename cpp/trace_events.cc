@@ -0,0 +1,163 @@
+#include "trace_events.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> trace_enabled(false);
+
+// Events kept per thread, older events get overwritten. 64k events are ~1.5MB
+// per thread and cover several minutes of a streaming session.
+static const size_t trace_buffer_capacity = 1 << 16;
+
+struct trace_event {
+  const char *name;
+  int64_t ts_us;
+  int64_t dur_us;
+};
+
+struct trace_buffer {
+  // Only contended while a trace gets exported
+  std::mutex mutex;
+  std::vector<trace_event> events;
+  size_t head = 0;
+  bool is_wrapped = false;
+  uint64_t tid = 0;
+  std::string thread_name;
+  // Set when the thread exited, the buffer is dropped by the next trace_start
+  bool is_exited = false;
+};
+
+// Buffers of the threads which recorded since the last trace_start, kept alive
+// after a thread has exited so its events still get exported.
+static std::mutex trace_registry_mutex;
+static std::vector<std::shared_ptr<trace_buffer>> trace_registry;
+static uint64_t trace_next_tid = 1;
+static std::chrono::steady_clock::time_point trace_epoch =
+    std::chrono::steady_clock::now();
+
+// Name and buffer of the calling thread. The buffer is only allocated for the
+// first event recorded while tracing is on, threads which never record while
+// tracing (e.g. the workers of every recording) cost nothing.
+struct thread_trace_slot {
+  std::string thread_name;
+  std::shared_ptr<trace_buffer> buffer;
+
+  ~thread_trace_slot() {
+    if (buffer) {
+      std::lock_guard<std::mutex> lock(buffer->mutex);
+      buffer->is_exited = true;
+    }
+  }
+};
+
+static thread_local thread_trace_slot trace_slot;
+
+static trace_buffer &thread_trace_buffer() {
+  if (!trace_slot.buffer) {
+    std::shared_ptr<trace_buffer> buffer = std::make_shared<trace_buffer>();
+    buffer->events.resize(trace_buffer_capacity);
+    buffer->thread_name = trace_slot.thread_name;
+    std::lock_guard<std::mutex> lock(trace_registry_mutex);
+    buffer->tid = trace_next_tid++;
+    trace_registry.push_back(buffer);
+    trace_slot.buffer = std::move(buffer);
+  }
+  return *trace_slot.buffer;
+}
+
+void trace_start() {
+  {
+    std::lock_guard<std::mutex> lock(trace_registry_mutex);
+    std::vector<std::shared_ptr<trace_buffer>> live_buffers;
+    for (auto &buffer : trace_registry) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      // Events of exited threads belong to the previous trace only
+      if (buffer->is_exited) {
+        continue;
+      }
+      buffer->head = 0;
+      buffer->is_wrapped = false;
+      live_buffers.push_back(buffer);
+    }
+    trace_registry = std::move(live_buffers);
+  }
+  trace_enabled.store(true, std::memory_order_relaxed);
+}
+
+void trace_stop() { trace_enabled.store(false, std::memory_order_relaxed); }
+
+void trace_set_thread_name(const char *name) {
+  trace_slot.thread_name = name;
+  if (trace_slot.buffer) {
+    std::lock_guard<std::mutex> lock(trace_slot.buffer->mutex);
+    trace_slot.buffer->thread_name = name;
+  }
+}
+
+void trace_complete(const char *name,
+                    std::chrono::steady_clock::time_point t_begin,
+                    std::chrono::steady_clock::time_point t_end) {
+  if (!trace_is_enabled()) {
+    return;
+  }
+
+  trace_buffer &buffer = thread_trace_buffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  trace_event &event = buffer.events[buffer.head];
+  event.name = name;
+  event.ts_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    t_begin - trace_epoch)
+                    .count();
+  event.dur_us =
+      std::chrono::duration_cast<std::chrono::microseconds>(t_end - t_begin)
+          .count();
+  buffer.head++;
+  if (buffer.head == buffer.events.size()) {
+    buffer.head = 0;
+    buffer.is_wrapped = true;
+  }
+}
+
+bool trace_write(const std::string &path) {
+  FILE *file = fopen(path.c_str(), "w");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+                "\"args\":{\"name\":\"SpeechToTextEngine\"}}");
+
+  std::lock_guard<std::mutex> lock(trace_registry_mutex);
+  for (auto &buffer : trace_registry) {
+    std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+    if (!buffer->thread_name.empty()) {
+      fprintf(file,
+              ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+              "\"tid\":%llu,\"args\":{\"name\":\"%s\"}}",
+              (unsigned long long)buffer->tid, buffer->thread_name.c_str());
+    }
+
+    // Oldest event first, which is the write position once the ring wrapped
+    const size_t n_events =
+        buffer->is_wrapped ? buffer->events.size() : buffer->head;
+    const size_t first = buffer->is_wrapped ? buffer->head : 0;
+    for (size_t i = 0; i < n_events; i++) {
+      const trace_event &event =
+          buffer->events[(first + i) % buffer->events.size()];
+      fprintf(file,
+              ",\n{\"name\":\"%s\",\"cat\":\"stt\",\"ph\":\"X\",\"pid\":1,"
+              "\"tid\":%llu,\"ts\":%lld,\"dur\":%lld}",
+              event.name, (unsigned long long)buffer->tid,
+              (long long)event.ts_us, (long long)event.dur_us);
+    }
+  }
+
+  fprintf(file, "\n]}\n");
+  fclose(file);
+  return true;
+}
@@ -0,0 +1,67 @@
+#ifndef STT_TRACE_EVENTS_H_
+#define STT_TRACE_EVENTS_H_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Opt-in tracing of the streaming pipeline in the Chrome trace_event format,
+// which can be opened in Perfetto (ui.perfetto.dev) or chrome://tracing.
+//
+// Every thread records into its own fixed-size ring buffer, so tracing has a
+// bounded memory footprint and keeps the most recent events when it stays
+// enabled over a long session. The buffer is allocated with the first event a
+// thread records while tracing is on and released by the next trace_start()
+// after the thread exited. Event names must be string literals, only the
+// pointer is stored.
+
+extern std::atomic<bool> trace_enabled;
+
+inline bool trace_is_enabled() {
+  return trace_enabled.load(std::memory_order_relaxed);
+}
+
+// Enables recording and drops all events of a previous trace.
+void trace_start();
+// Disables recording, recorded events are kept until the next trace_start().
+void trace_stop();
+// Writes all recorded events as trace_event JSON. Returns false when the file
+// could not be written.
+bool trace_write(const std::string &path);
+// Names the calling thread in the exported trace.
+void trace_set_thread_name(const char *name);
+// Records a span with explicit begin and end, e.g. for phases which are only
+// known after the fact.
+void trace_complete(const char *name,
+                    std::chrono::steady_clock::time_point t_begin,
+                    std::chrono::steady_clock::time_point t_end);
+
+// Records the lifetime of the scope as a span.
+class trace_scope {
+public:
+  explicit trace_scope(const char *name)
+      : name(name), is_recording(trace_is_enabled()) {
+    if (is_recording) {
+      t_begin = std::chrono::steady_clock::now();
+    }
+  }
+  ~trace_scope() {
+    if (is_recording) {
+      trace_complete(name, t_begin, std::chrono::steady_clock::now());
+    }
+  }
+  trace_scope(const trace_scope &) = delete;
+  trace_scope &operator=(const trace_scope &) = delete;
+
+private:
+  const char *name;
+  bool is_recording;
+  std::chrono::steady_clock::time_point t_begin;
+};
+
+#define STT_TRACE_CONCAT_(a, b) a##b
+#define STT_TRACE_CONCAT(a, b) STT_TRACE_CONCAT_(a, b)
+#define STT_TRACE_SCOPE(name)                                                  \
+  trace_scope STT_TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif // STT_TRACE_EVENTS_H_
@@ -0,0 +1,268 @@
+#include "transcription_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <unordered_map>
+
+static const uint64_t fnv1a_64_prime = 1099511628211ull;
+static const char cache_entry_magic[8] = {'S', 'T', 'T', 'C',
+                                          'A', 'C', 'H', '1'};
+static const char checkpoint_magic[8] = {'S', 'T', 'T', 'P',
+                                         'A', 'R', 'T', '1'};
+// Bytes read from a model file at a time
+static const size_t model_block_bytes = 4 << 20;
+
+uint64_t fnv1a_64(const void *data, size_t n_bytes, uint64_t hash) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  for (size_t i = 0; i < n_bytes; i++) {
+    hash = (hash ^ bytes[i]) * fnv1a_64_prime;
+  }
+  return hash;
+}
+
+sample_hasher::sample_hasher()
+    : lanes{fnv1a_64_basis, fnv1a_64_basis ^ 1, fnv1a_64_basis ^ 2,
+            fnv1a_64_basis ^ 3},
+      n_hashed(0) {}
+
+// Sample i goes to lane i % 4 of the whole sequence, whatever the pieces are
+void sample_hasher::update(const float *samples, size_t n_samples) {
+  size_t i = 0;
+  for (; i < n_samples && (n_hashed + i) % 4 != 0; i++) {
+    uint32_t word;
+    memcpy(&word, &samples[i], sizeof(word));
+    uint64_t &lane = lanes[(n_hashed + i) % 4];
+    lane = (lane ^ word) * fnv1a_64_prime;
+  }
+  for (; i + 4 <= n_samples; i += 4) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint32_t word;
+      memcpy(&word, &samples[i + lane], sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * fnv1a_64_prime;
+    }
+  }
+  for (int lane = 0; i < n_samples; i++, lane++) {
+    uint32_t word;
+    memcpy(&word, &samples[i], sizeof(word));
+    lanes[lane] = (lanes[lane] ^ word) * fnv1a_64_prime;
+  }
+  n_hashed += n_samples;
+}
+
+uint64_t sample_hasher::digest() const {
+  const uint64_t hash = fnv1a_64(lanes, sizeof(lanes));
+  return fnv1a_64(&n_hashed, sizeof(n_hashed), hash);
+}
+
+uint64_t hash_samples(const float *samples, size_t n_samples) {
+  sample_hasher hasher;
+  hasher.update(samples, n_samples);
+  return hasher.digest();
+}
+
+// FNV-1a over the 64-bit words of the bytes in four interleaved lanes like
+// hash_samples, the bytes after the last full group of lanes go to lane 0
+static void hash_words(const uint8_t *bytes, size_t n_bytes,
+                       uint64_t lanes[4]) {
+  size_t i = 0;
+  for (; i + 32 <= n_bytes; i += 32) {
+    for (int lane = 0; lane < 4; lane++) {
+      uint64_t word;
+      memcpy(&word, &bytes[i + lane * 8], sizeof(word));
+      lanes[lane] = (lanes[lane] ^ word) * fnv1a_64_prime;
+    }
+  }
+  lanes[0] = fnv1a_64(bytes + i, n_bytes - i, lanes[0]);
+}
+
+bool hash_model_file(const std::string &path, uint64_t &hash) {
+  struct model_hash {
+    uint64_t size;
+    std::filesystem::file_time_type mtime;
+    uint64_t hash;
+  };
+  static std::mutex s_mutex;
+  static std::unordered_map<std::string, model_hash> s_hashes;
+
+  std::error_code error;
+  const uint64_t size = std::filesystem::file_size(path, error);
+  const std::filesystem::file_time_type mtime =
+      error ? std::filesystem::file_time_type()
+            : std::filesystem::last_write_time(path, error);
+  if (error) {
+    fprintf(stderr, "%s: failed to stat '%s'\n", __func__, path.c_str());
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_hashes.find(path);
+    if (it != s_hashes.end() && it->second.size == size &&
+        it->second.mtime == mtime) {
+      hash = it->second.hash;
+      return true;
+    }
+  }
+
+  // Models can be larger than the range of ftell on Windows
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__, path.c_str());
+    return false;
+  }
+  uint64_t lanes[4] = {fnv1a_64_basis, fnv1a_64_basis ^ 1,
+                       fnv1a_64_basis ^ 2, fnv1a_64_basis ^ 3};
+  // A multiple of the lane group, so only the last block has a remainder
+  std::vector<char> buffer(model_block_bytes);
+  uint64_t n_read = 0;
+  while (file) {
+    file.read(buffer.data(), buffer.size());
+    if (file.bad()) {
+      return false;
+    }
+    hash_words((const uint8_t *)buffer.data(), file.gcount(), lanes);
+    n_read += file.gcount();
+  }
+  hash = fnv1a_64(&n_read, sizeof(n_read), fnv1a_64(lanes, sizeof(lanes)));
+
+  std::lock_guard<std::mutex> lock(s_mutex);
+  s_hashes[path] = {size, mtime, hash};
+  return true;
+}
+
+// Entry layout: magic | key | [audio offset] | number of texts |
+// (size | bytes) per text, the offset is present in checkpoints only
+static bool read_entry(const std::string &path, const char *magic,
+                       uint64_t key, uint64_t *offset,
+                       std::vector<std::string> &texts) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return false;
+  }
+  // Sizes read from the entry are checked against the bytes left in the
+  // file, so a corrupt entry can not make us allocate arbitrary amounts.
+  // Entries are small, the range of ftell is not an issue here.
+  long n_file_bytes = -1;
+  if (fseek(file, 0, SEEK_END) == 0) {
+    n_file_bytes = ftell(file);
+  }
+  rewind(file);
+
+  char entry_magic[sizeof(cache_entry_magic)];
+  uint64_t entry_key = 0;
+  uint32_t n_texts = 0;
+  bool is_valid =
+      fread(entry_magic, sizeof(entry_magic), 1, file) == 1 &&
+      memcmp(entry_magic, magic, sizeof(entry_magic)) == 0 &&
+      fread(&entry_key, sizeof(entry_key), 1, file) == 1 && entry_key == key &&
+      (offset == nullptr || fread(offset, sizeof(*offset), 1, file) == 1) &&
+      fread(&n_texts, sizeof(n_texts), 1, file) == 1 && n_file_bytes >= 0;
+
+  texts.clear();
+  for (uint32_t i = 0; is_valid && i < n_texts; i++) {
+    uint32_t size = 0;
+    is_valid = fread(&size, sizeof(size), 1, file) == 1 &&
+               size <= (uint64_t)(n_file_bytes - ftell(file));
+    if (is_valid) {
+      std::string text(size, '\0');
+      is_valid = size == 0 || fread(&text[0], size, 1, file) == 1;
+      texts.push_back(std::move(text));
+    }
+  }
+  fclose(file);
+
+  if (!is_valid) {
+    fprintf(stderr, "%s: ignoring the corrupt entry '%s'\n", __func__,
+            path.c_str());
+    texts.clear();
+  }
+  return is_valid;
+}
+
+// Writes a temporary file and renames it, see transcription_cache
+static bool write_entry(const std::string &path, const char *magic,
+                        uint64_t key, const uint64_t *offset,
+                        const std::vector<std::string> &texts) {
+  // Unique per store, so concurrent stores of the same key, also from other
+  // processes, do not share the temporary file
+  static const uint64_t process_nonce = std::random_device()();
+  static std::atomic<uint64_t> n_stores(0);
+  const uint64_t writer = process_nonce ^ (n_stores++ << 32);
+  const std::string temporary_path =
+      path + ".tmp-" + std::to_string(writer);
+
+  FILE *file = fopen(temporary_path.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "%s: failed to open '%s'\n", __func__,
+            temporary_path.c_str());
+    return false;
+  }
+  const uint32_t n_texts = texts.size();
+  bool is_written =
+      fwrite(magic, sizeof(cache_entry_magic), 1, file) == 1 &&
+      fwrite(&key, sizeof(key), 1, file) == 1 &&
+      (offset == nullptr || fwrite(offset, sizeof(*offset), 1, file) == 1) &&
+      fwrite(&n_texts, sizeof(n_texts), 1, file) == 1;
+  for (const std::string &text : texts) {
+    const uint32_t size = text.size();
+    is_written = is_written && fwrite(&size, sizeof(size), 1, file) == 1 &&
+                 (size == 0 || fwrite(text.data(), size, 1, file) == 1);
+  }
+  is_written = fclose(file) == 0 && is_written;
+
+  // Replacing an existing file fails on Windows, checkpoints are removed
+  // first there. A cache entry stored meanwhile by another writer is equal.
+  if (is_written && rename(temporary_path.c_str(), path.c_str()) != 0) {
+    remove(path.c_str());
+    is_written = rename(temporary_path.c_str(), path.c_str()) == 0;
+  }
+  if (!is_written) {
+    remove(temporary_path.c_str());
+  }
+  return is_written;
+}
+
+transcription_cache::transcription_cache(const std::string &directory)
+    : directory(directory) {}
+
+std::string transcription_cache::entry_path(uint64_t key,
+                                            const char *extension) const {
+  char name[40];
+  snprintf(name, sizeof(name), "%016" PRIx64 ".%s", key, extension);
+  return directory + "/" + name;
+}
+
+bool transcription_cache::find(uint64_t key,
+                               std::vector<std::string> &texts) const {
+  return read_entry(entry_path(key, "sttcache"), cache_entry_magic, key,
+                    nullptr, texts);
+}
+
+bool transcription_cache::store(uint64_t key,
+                                const std::vector<std::string> &texts) const {
+  return write_entry(entry_path(key, "sttcache"), cache_entry_magic, key,
+                     nullptr, texts);
+}
+
+bool transcription_cache::find_checkpoint(
+    uint64_t key, uint64_t &offset, std::vector<std::string> &texts) const {
+  return read_entry(entry_path(key, "sttpart"), checkpoint_magic, key,
+                    &offset, texts);
+}
+
+bool transcription_cache::store_checkpoint(
+    uint64_t key, uint64_t offset,
+    const std::vector<std::string> &texts) const {
+  return write_entry(entry_path(key, "sttpart"), checkpoint_magic, key,
+                     &offset, texts);
+}
+
+void transcription_cache::remove_checkpoint(uint64_t key) const {
+  remove(entry_path(key, "sttpart").c_str());
+}
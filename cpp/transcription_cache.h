@@ -0,0 +1,73 @@
+#ifndef STT_TRANSCRIPTION_CACHE_H_
+#define STT_TRANSCRIPTION_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+static const uint64_t fnv1a_64_basis = 14695981039346656037ull;
+
+// 64-bit FNV-1a over the bytes, continuing the given hash
+uint64_t fnv1a_64(const void *data, size_t n_bytes,
+                  uint64_t hash = fnv1a_64_basis);
+// FNV-1a over the 32-bit words of the samples in four interleaved lanes,
+// which hides the latency of the multiplications. Hashes an hour of 16kHz
+// audio in tens of milliseconds. Samples can be added piece by piece while
+// they are decoded, the hash only depends on the whole sequence.
+class sample_hasher {
+public:
+  sample_hasher();
+
+  void update(const float *samples, size_t n_samples);
+  uint64_t digest() const;
+
+private:
+  uint64_t lanes[4];
+  uint64_t n_hashed;
+};
+
+// Hash of sample_hasher over all the samples at once
+uint64_t hash_samples(const float *samples, size_t n_samples);
+// Hashes all bytes of a model file, so fine-tunes of the same architecture
+// get different hashes. Reading a large model takes seconds, the hash is
+// remembered by path for the process and taken again when the size or the
+// modification time of the file changed.
+bool hash_model_file(const std::string &path, uint64_t &hash);
+
+// Content-addressed store of file transcriptions, so importing the same
+// recording again with the same model and decoding parameters returns without
+// running whisper.
+//
+// The key is computed by the caller from everything the result depends on
+// (see SpeechToTextEngine::TranscribeFileInput). Each entry is a file
+// `<directory>/<key in hex>.sttcache` with the segment texts. Entries are
+// written to a temporary file and renamed, so a crash never leaves a partial
+// entry behind and concurrent writers of the same key do not interfere.
+//
+// A transcription in progress keeps a checkpoint of the same key
+// (`<key in hex>.sttpart`) with the texts so far and the audio offset they
+// cover, so an interrupted transcription of the same audio continues from
+// there.
+class transcription_cache {
+public:
+  // The directory has to exist
+  explicit transcription_cache(const std::string &directory);
+
+  bool find(uint64_t key, std::vector<std::string> &texts) const;
+  bool store(uint64_t key, const std::vector<std::string> &texts) const;
+
+  // The offset is in samples of the transcribed audio
+  bool find_checkpoint(uint64_t key, uint64_t &offset,
+                       std::vector<std::string> &texts) const;
+  bool store_checkpoint(uint64_t key, uint64_t offset,
+                        const std::vector<std::string> &texts) const;
+  void remove_checkpoint(uint64_t key) const;
+
+private:
+  std::string entry_path(uint64_t key, const char *extension) const;
+
+  std::string directory;
+};
+
+#endif // STT_TRANSCRIPTION_CACHE_H_
@@ -0,0 +1,50 @@
+// whisper.cpp keeps its batch and decoder internals static, so the extensions
+// are compiled together with it in one translation unit.
+#include "src/whisper.cpp"
+
+#include "whisper_ext.h"
+
+#include <type_traits>
+
+// The internals used below are not part of the API of whisper.cpp and change
+// between its releases, see the revision note in whisper_ext.h. These checks
+// name the internal which moved instead of failing inside the calls.
+static_assert(std::is_invocable_r_v<bool, decltype(whisper_decode_internal),
+                                    whisper_context &, whisper_state &,
+                                    const whisper_batch &, int, bool,
+                                    ggml_abort_callback, void *>,
+              "whisper_decode_internal changed, update whisper_ext.cc");
+static_assert(std::is_invocable_v<decltype(whisper_batch_prep_legacy),
+                                  whisper_batch &, const whisper_token *, int,
+                                  int, int>,
+              "whisper_batch_prep_legacy changed, update whisper_ext.cc");
+static_assert(std::is_invocable_v<decltype(whisper_kv_cache_seq_rm),
+                                  whisper_kv_cache &, int, int, int>,
+              "whisper_kv_cache_seq_rm changed, update whisper_ext.cc");
+static_assert(std::is_same_v<decltype(whisper_state::exp_n_audio_ctx), int32_t>,
+              "whisper_state::exp_n_audio_ctx changed, update whisper_ext.cc");
+
+int whisper_ext_decode_with_state(struct whisper_context *ctx,
+                                  struct whisper_state *state,
+                                  const whisper_token *tokens, int n_tokens,
+                                  int n_past, int n_threads) {
+  whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
+  // The legacy batch only requests the logits of the last token
+  for (int i = 0; i < n_tokens; i++) {
+    state->batch.logits[i] = 1;
+  }
+
+  whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
+
+  if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false,
+                               nullptr, nullptr)) {
+    WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+    return 1;
+  }
+
+  return 0;
+}
+
+void whisper_ext_set_audio_ctx(struct whisper_state *state, int audio_ctx) {
+  state->exp_n_audio_ctx = audio_ctx;
+}
@@ -0,0 +1,30 @@
+#ifndef STT_WHISPER_EXT_H_
+#define STT_WHISPER_EXT_H_
+
+#include "whisper.h"
+
+// Extensions of the whisper.cpp API which need access to its internals. The
+// implementation compiles whisper.cpp as part of its translation unit, so it
+// replaces whisper.cpp/src/whisper.cpp in the sources of binding.gyp.
+//
+// Written against the whisper.cpp 1.6 sources listed in binding.gyp (with
+// src/whisper-mel.hpp and ggml/src/ggml-aarch64.c). The extensions use
+// whisper_decode_internal, whisper_batch_prep_legacy, whisper_kv_cache_seq_rm
+// and whisper_state::exp_n_audio_ctx: when the submodule is moved to another
+// revision, check these against its src/whisper.cpp. whisper_ext.cc asserts
+// their signatures at compile time.
+
+// Same as whisper_decode_with_state, but keeps the logits of every token of
+// the batch instead of the last one only. The logits of the i-th token start at
+// whisper_get_logits_from_state(state) + i * whisper_n_vocab(ctx). Like the
+// original, the KV cache of the state is truncated to n_past first.
+int whisper_ext_decode_with_state(struct whisper_context *ctx,
+                                  struct whisper_state *state,
+                                  const whisper_token *tokens, int n_tokens,
+                                  int n_past, int n_threads);
+
+// Audio context of the next whisper_encode_with_state call, the equivalent of
+// whisper_full_params.audio_ctx. 0 uses the full context of the model.
+void whisper_ext_set_audio_ctx(struct whisper_state *state, int audio_ctx);
+
+#endif // STT_WHISPER_EXT_H_
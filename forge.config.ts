@@ -111,6 +111,19 @@ const config: ForgeConfig = {
         nativeAddonPath,
         path.join(destPath, "addon.node"),
       );
+      // Optional out-of-process inference host, see src/utils/inferenceHost.ts
+      const inferenceHostPath = path.resolve(
+        __dirname,
+        "build",
+        "Release",
+        "stt_host",
+      );
+      if (fs.existsSync(inferenceHostPath)) {
+        await fs.promises.copyFile(
+          inferenceHostPath,
+          path.join(destPath, "stt_host"),
+        );
+      }
     },
   },
 };
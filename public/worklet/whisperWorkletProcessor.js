@@ -10,6 +10,9 @@
  * multiple of 128 for zero latency.
  */
 
+// Report buffers per channel in flight between the worklet and main thread
+const REPORT_POOL_SIZE = 4;
+
 /**
  * @typedef Options
  * @property {ProcessorOptions} processorOptions
@@ -20,6 +23,8 @@
  * @extends AudioWorkletProcessor
  *
  * A recorder that exposes raw audio data (PCM, f32) via message events.
+ * Receivers hand the reported buffers back with
+ * `port.postMessage({ recycle: recordBuffer }, transfer)`.
  */
 class RecorderProcessor extends AudioWorkletProcessor {
   /**
@@ -37,61 +42,103 @@ class RecorderProcessor extends AudioWorkletProcessor {
     // Only Mono-Channel Support for Whisper Model
     this.recordChannelCount = 1;
 
-    this.buffer = [];
+    // Report buffers are preallocated and transferred to the main thread,
+    // which returns them with a `recycle` message once the samples are sent.
+    // process() only copies into them, so the audio thread does not allocate.
+    this.pool = [];
+    for (let i = 0; i < REPORT_POOL_SIZE * this.recordChannelCount; i++) {
+      this.pool.push(new Float32Array(this.reportSize));
+    }
+    this.recordBuffer = [];
     for (let i = 0; i < this.recordChannelCount; i++) {
-      this.buffer[i] = [];
+      this.recordBuffer[i] = this.takeBuffer();
     }
+    this.recordLength = 0;
+    // Reused for every report, postMessage copies the fields
+    this.message = { currentFrame: 0, sampleRate, recordBuffer: [] };
+    this.transfer = [];
 
     this.port.onmessage = (e) => {
       if (e.data === "pause") this.enable = false;
       else if (e.data === "resume") this.enable = true;
+      else if (e.data && e.data.recycle) this.recycle(e.data.recycle);
     };
   }
 
-  process(inputs, outputs) {
+  /**
+   * @returns {Float32Array}
+   */
+  takeBuffer() {
+    // Only allocates while the main thread holds every buffer of the pool
+    return this.pool.pop() || new Float32Array(this.reportSize);
+  }
+
+  /**
+   * @param {Float32Array[]} buffers Report buffers returned by the main thread
+   */
+  recycle(buffers) {
+    for (let i = 0; i < buffers.length; i++) {
+      if (buffers[i].length === this.reportSize) {
+        this.pool.push(buffers[i]);
+      }
+    }
+  }
+
+  process(inputs) {
     if (!this.enable) {
-      this.buffer = this.buffer.map((_) => []);
+      this.recordLength = 0;
       return true;
     }
 
     const input = inputs[0];
-    const output = outputs[0];
     if (!input || !input.length) {
       return true;
     }
 
-    for (
-      let channel = 0;
-      channel < Math.min(input.length, this.recordChannelCount);
-      channel++
-    ) {
-      let inputChannel;
-      try {
-        inputChannel = input[channel];
-        this.buffer[channel].push(...inputChannel.slice());
-      } catch (e) {
-        console.error("[ AudioWorkeltProcessor ]: ", e, {
-          channel,
-          inputs,
-          outputs,
-          input,
-          output,
-        });
+    const channelCount = Math.min(input.length, this.recordChannelCount);
+    const frameCount = input[0].length;
+    let offset = 0;
+    while (offset < frameCount) {
+      const count = Math.min(
+        frameCount - offset,
+        this.reportSize - this.recordLength,
+      );
+      // Indexed copy, subarray() would allocate a view per quantum
+      for (let channel = 0; channel < channelCount; channel++) {
+        const source = input[channel];
+        const target = this.recordBuffer[channel];
+        for (let i = 0; i < count; i++) {
+          target[this.recordLength + i] = source[offset + i];
+        }
       }
-    }
+      this.recordLength += count;
+      offset += count;
 
-    if (this.buffer[0].length >= this.reportSize) {
-      const recordBuffer = [];
-      for (let channel = 0; channel < this.buffer.length; channel++) {
-        const floats = this.buffer[channel].slice(0, this.reportSize);
-        recordBuffer[channel] = new Float32Array(floats);
-        this.buffer[channel].splice(0, this.reportSize);
+      if (this.recordLength === this.reportSize) {
+        this.report();
       }
-
-      this.port.postMessage({ currentFrame, sampleRate, recordBuffer });
     }
     return true;
   }
+
+  /**
+   * Transfers the full report buffers to the main thread and continues with
+   * buffers from the pool.
+   */
+  report() {
+    const message = this.message;
+    message.currentFrame = currentFrame;
+    message.recordBuffer.length = 0;
+    this.transfer.length = 0;
+    for (let channel = 0; channel < this.recordChannelCount; channel++) {
+      const buffer = this.recordBuffer[channel];
+      message.recordBuffer.push(buffer);
+      this.transfer.push(buffer.buffer);
+      this.recordBuffer[channel] = this.takeBuffer();
+    }
+    this.port.postMessage(message, this.transfer);
+    this.recordLength = 0;
+  }
 }
 // Doc: https://developer.mozilla.org/en-US/docs/Web/API/AudioWorkletGlobalScope/registerProcessor
 // Register processor via AudioWorkletGlobalScope.registerProcessor
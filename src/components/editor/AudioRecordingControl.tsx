@@ -55,8 +55,14 @@ export const AudioRecordingControl = (props: Props) => {
 
 				const { recordBuffer } = event.data as RecorderProcessorMessageData;
 
-				if (recordBuffer[0].length === 0) return;
-				api.addAudioData(recordBuffer[0]);
+				if (recordBuffer[0].length > 0) {
+					// Serialized synchronously, the buffers are free for reuse afterwards
+					api.addAudioData(recordBuffer[0]);
+				}
+				worklet.port.postMessage(
+					{ recycle: recordBuffer },
+					recordBuffer.map((buffer) => buffer.buffer),
+				);
 			};
 			source.connect(worklet);
 			worklet.connect(audioContext.destination);
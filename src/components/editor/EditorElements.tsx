@@ -25,12 +25,14 @@ function createSpanText(textContent: string, dataset: Dataset) {
 type TranscribedSegmentPayload = {
 	text: string;
 	isPartial: boolean;
+	utteranceId?: number;
 };
 function createNewParagraph(segment: TranscribedSegmentPayload) {
 	const paragraph = createParagraph();
 	const textSpan = createSpanText(segment.text, {
 		id: cuid(),
 		partial: String(segment.isPartial),
+		...(segment.utteranceId !== undefined && { utteranceId: String(segment.utteranceId) }),
 	});
 	paragraph.appendChild(textSpan);
 	return paragraph;
@@ -14,7 +14,7 @@ export const ImportWarningDialog = (props: Props) => {
 				<Dialog.Content className="no-drag data-[state=open]:animate-contentShow fixed top-[50%] left-[50%] max-h-[85vh] w-[90vw] max-w-[450px] translate-x-[-50%] translate-y-[-50%] rounded-2xl bg-white p-6 focus:outline-none z-[100] overflow-auto">
 					<Dialog.Title className="text-gray-900 m-0 text-lg font-medium">Audiodatei importieren</Dialog.Title>
 					<Dialog.Description className="text-gray-600 mt-2 mb-2 text-base leading-normal">
-						Es sind nur Audiodateien gültig die eine Abtastrate von 16kHz und Mono-Audio-Channel Kriterien erfüllen.
+						Die Audiodatei konnte nicht gelesen werden oder enthält keine Sprache. Unterstützt werden WAV- und FLAC-Dateien, unter macOS außerdem MP3, AAC und AIFF.
 					</Dialog.Description>
 					<div className="mt-[25px] flex justify-end">
 						<Dialog.Close asChild>
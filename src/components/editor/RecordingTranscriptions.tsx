@@ -309,6 +309,8 @@ export const RecordingTranscriptions = (props: Props) => {
 		const textContainer = textContainerRef.current;
 		if (!textContainer) return;
 
+		applySegmentUpdates(newTranscriptions);
+
 		const selection = window.getSelection();
 		if (!isSelectionInEditor()) {
 			appendTranscripts(newTranscriptions);
@@ -318,6 +320,22 @@ export const RecordingTranscriptions = (props: Props) => {
 		insertTranscriptsIntoSelection(selection, newTranscriptions);
 	};
 
+	// Replaces finals with their refined text, unless the user edited them in the meantime.
+	const applySegmentUpdates = (newTranscriptions: Awaited<ReturnType<typeof api.getTranscribedText>>) => {
+		const textContainer = textContainerRef.current;
+		if (!textContainer || !newTranscriptions.updates) return;
+
+		for (const update of newTranscriptions.updates) {
+			const spans = textContainer.querySelectorAll<HTMLSpanElement>(
+				`span[data-utterance-id="${update.utteranceId}"][data-partial="false"]`,
+			);
+			const span = spans[spans.length - 1];
+			if (span && span.textContent === update.previousText) {
+				span.textContent = update.text;
+			}
+		}
+	};
+
 	// Append new paragraph/span element with transcript contents to the end of the current paragraph.
 	const appendTranscripts = (newTranscriptions: Awaited<ReturnType<typeof api.getTranscribedText>>) => {
 		const textContainer = textContainerRef.current;
@@ -340,6 +358,7 @@ export const RecordingTranscriptions = (props: Props) => {
 			if (hasSpanChild && isPartial) {
 				const lastText = lastChild.lastChild as HTMLSpanElement;
 				lastText.textContent = segment.text;
+				lastText.dataset.utteranceId = String(segment.utteranceId);
 				if (!segment.isPartial) {
 					lastText.dataset.partial = "false";
 				}
@@ -347,6 +366,7 @@ export const RecordingTranscriptions = (props: Props) => {
 				const newText = createSpanText(segment.text, {
 					id: cuid(),
 					partial: String(segment.isPartial),
+					utteranceId: String(segment.utteranceId),
 				});
 				lastChild.appendChild(newText);
 			}
@@ -371,6 +391,7 @@ export const RecordingTranscriptions = (props: Props) => {
 			if (lastChild?.dataset?.partial === "true") {
 				const currentSpan = lastChild as HTMLSpanElement;
 				currentSpan.textContent = segment.text;
+				currentSpan.dataset.utteranceId = String(segment.utteranceId);
 				if (!segment.isPartial) {
 					lastChild.dataset.partial = "false";
 				}
@@ -380,6 +401,7 @@ export const RecordingTranscriptions = (props: Props) => {
 			let newSpan = createSpanText(segment.text, {
 				id: cuid(),
 				partial: String(segment.isPartial),
+				utteranceId: String(segment.utteranceId),
 			});
 
 			if (startOffset === 0 && startContainer.parentElement === currentParagraph.firstChild) {
@@ -67,6 +67,11 @@ function useDbUserPreferences() {
 }
 
 interface Props {}
+
+const importExtensions = navigator.userAgent.includes("Mac")
+	? ["wav", "flac", "mp3", "m4a", "aac", "aif", "aiff", "caf"]
+	: ["wav", "flac"];
+
 export function HomeContent(_: Props) {
 	const navigate = useNavigate();
 	// Fetch db datas
@@ -89,8 +94,8 @@ export function HomeContent(_: Props) {
 		// File selection is provided by Electron via an API which has to be called from the main process.
 		const filePath = await api.openDialog({
 			properties: ["openFile"],
-			// Enabling selection for only .wav files, since its required for whisper to work with.
-			filters: [{ name: "Audio", extensions: ["wav"] }],
+			// Formats the native file decoder reads, compressed formats other than FLAC are decoded by Core Audio on macOS only.
+			filters: [{ name: "Audio", extensions: importExtensions }],
 			title: "Audiodatei Importieren",
 		});
 
@@ -17,6 +17,16 @@ export const WHISPER_IPC_CHANNELS = {
   WHISPER_CLEAR_AUDIO: "whisper:clear_audio",
   WHISPER_GET_TRANSCRIBED_TEXT: "whisper:get_transcribed_text",
   WHISPER_TRANSCRIBE_FILE_INPUT: "whisper:trnascribe_file_input",
+  WHISPER_GET_METRICS: "whisper:get_metrics",
+  WHISPER_GET_LATENCY_HISTOGRAMS: "whisper:get_latency_histograms",
+  WHISPER_START_TRACING: "whisper:start_tracing",
+  WHISPER_STOP_TRACING: "whisper:stop_tracing",
+  WHISPER_START_SESSION_RECORDING: "whisper:start_session_recording",
+  WHISPER_STOP_SESSION_RECORDING: "whisper:stop_session_recording",
+  WHISPER_START_AUDIO_RETENTION: "whisper:start_audio_retention",
+  WHISPER_STOP_AUDIO_RETENTION: "whisper:stop_audio_retention",
+  WHISPER_GET_UTTERANCE_AUDIO: "whisper:get_utterance_audio",
+  WHISPER_TRANSCRIBE_UTTERANCE: "whisper:transcribe_utterance",
 } as const;
 
 export const DIALOG_IPC_CHANNELS = {
@@ -1,12 +1,19 @@
+import fs from "node:fs";
+import path from "node:path";
 import { assert } from "../components/utils/assert";
-import { ipcMain } from "electron";
+import { app, ipcMain } from "electron";
 import { WHISPER_IPC_CHANNELS } from "./IPC";
 import { getWhisperModelPath } from "@/utils/whisperModel";
 import { UserPreferencesDbService } from "@/backend/db";
-import { TranscribedSegments } from "@/shared/ipcPayloads";
+import {
+  EngineMetrics,
+  LatencyHistograms,
+  TranscribedSegments,
+} from "@/shared/ipcPayloads";
 
-// Depends on addon.cc definition from STTAddon::Init
-type STTEngineModule = {
+// Depends on addon.cc definition from STTAddon::Init, also implemented by the
+// out-of-process InferenceHostSupervisor
+export type STTEngineModule = {
   start: () => void;
   stop: () => void;
   reconfigure: (data: {
@@ -14,11 +21,53 @@ type STTEngineModule = {
     model_path: string;
     trigger_ms: number;
     n_threads: number;
+    // Optional adaptive pacing, see stream_configuration
+    adaptive_trigger?: boolean;
+    min_trigger_ms?: number;
+    max_trigger_ms?: number;
+    min_window_ms?: number;
+    // Optional overload policies, see stream_configuration
+    shed_partials_backlog_ms?: number;
+    drop_silence_backlog_ms?: number;
+    fallback_backlog_ms?: number;
+    fallback_model_path?: string;
+    // Optional fast model for partials, finals use the selected model
+    partial_model_path?: string;
+    // Optional draft model for speculative decoding of the selected model
+    draft_model_path?: string;
+    n_draft_tokens?: number;
+    // Optional overlap of encoder and decoder of consecutive windows
+    pipelined?: boolean;
+    // Optional beam search refinement of finals, with a larger model if set
+    refinement?: boolean;
+    refinement_beam_size?: number;
+    refinement_model_path?: string;
+    // Optional scheduling of the inference threads, see scheduling_configuration
+    cpu_affinity?: number[];
+    nice?: number;
+    realtime_priority?: boolean;
   }) => number;
   addAudioData: (data: Float32Array) => void;
   clearAudioData: () => void;
-  getTranscribedText: () => string;
-  transcribeFileInput: (filePath: string) => TranscribedSegments;
+  getTranscribedText: () => TranscribedSegments;
+  // Reuses results from the transcription cache in the directory, if given.
+  // The inference host transcribes in a child process and returns a promise.
+  transcribeFileInput: (
+    filePath: string,
+    cacheDirectory?: string,
+  ) => TranscribedSegments | Promise<TranscribedSegments>;
+  // The inference host answers these over its channel with a promise
+  getMetrics: () => EngineMetrics | Promise<EngineMetrics>;
+  getLatencyHistograms: () => LatencyHistograms | Promise<LatencyHistograms>;
+  startTracing: () => number | Promise<number>;
+  stopTracing: (tracePath: string) => number | Promise<number>;
+  startSessionRecording: (logPath: string) => number | Promise<number>;
+  stopSessionRecording: () => number | Promise<number>;
+  // Optional retention of the input audio, see audio_store
+  startAudioRetention?: (directory: string, maxSeconds: number) => number;
+  stopAudioRetention?: () => number;
+  getUtteranceAudio?: (utteranceId: number) => Float32Array | null;
+  transcribeUtterance?: (utteranceId: number) => TranscribedSegments;
 };
 // Defines the IPC-Handlers for all STT-Engine interactions, including reconfiguration of the Whisper model parameters.
 export function registerWhisperIPCHandler(
@@ -99,9 +148,116 @@ export function registerWhisperIPCHandler(
   );
   ipcMain.handle(
     WHISPER_IPC_CHANNELS["WHISPER_TRANSCRIBE_FILE_INPUT"],
-    (_event, data) => {
-      const segments = sttEngineModule.transcribeFileInput(data);
+    async (_event, data) => {
+      // Imports of the same recording are answered from the cache, see
+      // cpp/transcription_cache.h
+      const cachePath = path.join(app.getPath("userData"), "transcriptions");
+      fs.mkdirSync(cachePath, { recursive: true });
+
+      const segments = await sttEngineModule.transcribeFileInput(
+        data,
+        cachePath,
+      );
       return segments;
     },
   );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_GET_METRICS"],
+    async (_event, _data) => {
+      return await sttEngineModule.getMetrics();
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_GET_LATENCY_HISTOGRAMS"],
+    async (_event, _data) => {
+      return await sttEngineModule.getLatencyHistograms();
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_START_TRACING"],
+    async (_event, _data) => {
+      console.log("[ whisperIPC ] Starting pipeline tracing.");
+      await sttEngineModule.startTracing();
+    },
+  );
+  // Writes the recorded trace into the user data directory and returns its path,
+  // the file can be opened with https://ui.perfetto.dev
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_STOP_TRACING"],
+    async (_event, _data) => {
+      const tracesPath = path.join(app.getPath("userData"), "traces");
+      fs.mkdirSync(tracesPath, { recursive: true });
+      const tracePath = path.join(tracesPath, `stt-trace-${Date.now()}.json`);
+
+      const isWritten = await sttEngineModule.stopTracing(tracePath);
+      console.log(`[ whisperIPC ] Pipeline trace written to ${tracePath}`);
+      return isWritten === 1 ? tracePath : null;
+    },
+  );
+  // Captures the engine input into the user data directory, the log can be
+  // replayed with `stt_replay_bench --session <file>` to reproduce a session.
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_START_SESSION_RECORDING"],
+    async (_event, _data) => {
+      const sessionsPath = path.join(app.getPath("userData"), "sessions");
+      fs.mkdirSync(sessionsPath, { recursive: true });
+      const logPath = path.join(sessionsPath, `stt-session-${Date.now()}.sttrec`);
+
+      const isStarted = await sttEngineModule.startSessionRecording(logPath);
+      console.log(`[ whisperIPC ] Recording session input to ${logPath}`);
+      return isStarted === 1 ? logPath : null;
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_STOP_SESSION_RECORDING"],
+    async (_event, _data) => {
+      await sttEngineModule.stopSessionRecording();
+    },
+  );
+  // Retains the input audio of the last `maxSeconds` in the user data
+  // directory, so finalized utterances can be played back and re-transcribed.
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_START_AUDIO_RETENTION"],
+    (_event, maxSeconds) => {
+      assert.strictEqual(typeof maxSeconds === "number", true);
+      if (!sttEngineModule.startAudioRetention) {
+        return false;
+      }
+      const audioPath = path.join(
+        app.getPath("userData"),
+        "audio",
+        `stt-audio-${Date.now()}`,
+      );
+      fs.mkdirSync(audioPath, { recursive: true });
+
+      const isStarted = sttEngineModule.startAudioRetention(
+        audioPath,
+        maxSeconds,
+      );
+      console.log(`[ whisperIPC ] Retaining session audio in ${audioPath}`);
+      return isStarted === 1;
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_STOP_AUDIO_RETENTION"],
+    (_event, _data) => {
+      sttEngineModule.stopAudioRetention?.();
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_GET_UTTERANCE_AUDIO"],
+    (_event, utteranceId) => {
+      assert.strictEqual(typeof utteranceId === "number", true);
+      return sttEngineModule.getUtteranceAudio?.(utteranceId) ?? null;
+    },
+  );
+  ipcMain.handle(
+    WHISPER_IPC_CHANNELS["WHISPER_TRANSCRIBE_UTTERANCE"],
+    (_event, utteranceId) => {
+      assert.strictEqual(typeof utteranceId === "number", true);
+      return (
+        sttEngineModule.transcribeUtterance?.(utteranceId) ?? { segments: [] }
+      );
+    },
+  );
 }
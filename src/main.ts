@@ -15,6 +15,7 @@ import {
   requestMicrophonePermission,
 } from "./utils/microphone";
 import { registerDialogIPCHandler } from "./ipc/dialogIPCHandlers";
+import { InferenceHostSupervisor } from "./utils/inferenceHost";
 
 // Disable security warnings in devtools
 process.env.ELECTRON_DISABLE_SECURITY_WARNINGS = "true";
@@ -44,6 +45,15 @@ const addon = require(addonPath);
 assert.strictEqual(typeof addon, "object");
 assert.strictEqual(typeof addon.SpeechToTextEngine, "function");
 
+// Optional out-of-process inference, see src/utils/inferenceHost.ts. The host
+// binary is built with `node-gyp configure -- -Dbuild_inference_host=true`
+// and placed next to the addon binary.
+const inferenceHostPath = path.join(path.dirname(addonPath), "stt_host");
+const isInferenceHostEnabled =
+  process.env.VOICE_TYPING_INFERENCE_HOST === "1" &&
+  process.platform !== "win32";
+let inferenceHost: InferenceHostSupervisor | null = null;
+
 // Handle creating/removing shortcuts on Windows when installing/uninstalling.
 if (require("electron-squirrel-startup")) {
   app.quit();
@@ -100,15 +110,27 @@ app.whenReady().then(() => {
     userPreferences.speechRecognitionModelType,
   );
 
-  // Initializing native addon instance
-  const sttWhisperStreamingModule = new addon.SpeechToTextEngine(
-    {
-      language_id: whisperConfiguration.modelLanguage,
-      model_path: whisperConfiguration.modelPath,
-      trigger_ms: userPreferences.speechRecognitionTriggerMs,
-      n_threads: userPreferences.speechRecognitionThreads,
-    },
-  );
+  // Initializing native addon instance, or the inference host which runs the
+  // engine in a separate process
+  const engineConfiguration = {
+    language_id: whisperConfiguration.modelLanguage,
+    model_path: whisperConfiguration.modelPath,
+    trigger_ms: userPreferences.speechRecognitionTriggerMs,
+    n_threads: userPreferences.speechRecognitionThreads,
+  };
+  let sttWhisperStreamingModule;
+  if (isInferenceHostEnabled) {
+    inferenceHost = new InferenceHostSupervisor(
+      inferenceHostPath,
+      addon.SharedAudioRing,
+      engineConfiguration,
+    );
+    sttWhisperStreamingModule = inferenceHost;
+  } else {
+    sttWhisperStreamingModule = new addon.SpeechToTextEngine(
+      engineConfiguration,
+    );
+  }
   assert.strictEqual(typeof sttWhisperStreamingModule, "object");
 
   // Registering IPC-Endpoints and there handlers for renderer processes.
@@ -136,5 +158,6 @@ app.on("window-all-closed", () => {
 });
 
 app.on("will-quit", () => {
+  inferenceHost?.dispose();
   closeDatabase();
 });
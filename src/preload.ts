@@ -26,6 +26,32 @@ contextBridge.exposeInMainWorld("electronAPI", {
     ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_CLEAR_AUDIO"]),
   getTranscribedText: () =>
     ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_GET_TRANSCRIBED_TEXT"]),
+  getMetrics: () => ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_GET_METRICS"]),
+  getLatencyHistograms: () =>
+    ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_GET_LATENCY_HISTOGRAMS"]),
+  startTracing: () => ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_START_TRACING"]),
+  stopTracing: () => ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_STOP_TRACING"]),
+  startSessionRecording: () =>
+    ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_START_SESSION_RECORDING"]),
+  stopSessionRecording: () =>
+    ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_STOP_SESSION_RECORDING"]),
+  startAudioRetention: (maxSeconds: number) =>
+    ipcRenderer.invoke(
+      WHISPER_IPC_CHANNELS["WHISPER_START_AUDIO_RETENTION"],
+      maxSeconds,
+    ),
+  stopAudioRetention: () =>
+    ipcRenderer.invoke(WHISPER_IPC_CHANNELS["WHISPER_STOP_AUDIO_RETENTION"]),
+  getUtteranceAudio: (utteranceId: number) =>
+    ipcRenderer.invoke(
+      WHISPER_IPC_CHANNELS["WHISPER_GET_UTTERANCE_AUDIO"],
+      utteranceId,
+    ),
+  transcribeUtterance: (utteranceId: number) =>
+    ipcRenderer.invoke(
+      WHISPER_IPC_CHANNELS["WHISPER_TRANSCRIBE_UTTERANCE"],
+      utteranceId,
+    ),
   queryTranscripts: () =>
     ipcRenderer.invoke(DB_IPC_CHANNELS["TRANSCRIPT_GET_ALL"]),
   queryTranscriptById: (id: string) =>
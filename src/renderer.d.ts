@@ -5,6 +5,8 @@ import {
   UserPreferences,
 } from "./shared/models";
 import {
+  EngineMetrics,
+  LatencyHistograms,
   TranscribedSegmentPayload,
   TranscribedSegments,
 } from "./shared/ipcPayloads";
@@ -29,6 +31,20 @@ export interface ElectronAPI {
   addAudioData: (data: Float32Array) => Promise<void>;
   clearAudioData: () => Promise<void>;
   getTranscribedText: () => Promise<TranscribedSegments>;
+  getMetrics: () => Promise<EngineMetrics>;
+  getLatencyHistograms: () => Promise<LatencyHistograms>;
+  startTracing: () => Promise<void>;
+  // Resolves to the path of the written trace file
+  stopTracing: () => Promise<string | null>;
+  // Resolves to the path of the session log
+  startSessionRecording: () => Promise<string | null>;
+  stopSessionRecording: () => Promise<void>;
+  // Resolves to false when the engine cannot retain audio
+  startAudioRetention: (maxSeconds: number) => Promise<boolean>;
+  stopAudioRetention: () => Promise<void>;
+  // Retained audio of a finalized utterance (16kHz), null when not retained
+  getUtteranceAudio: (utteranceId: number) => Promise<Float32Array | null>;
+  transcribeUtterance: (utteranceId: number) => Promise<TranscribedSegments>;
   // Db
   queryTranscripts: () => Promise<Transcript[]>;
   queryTranscriptById: (id: number) => Promise<Transcript>;
@@ -1,8 +1,64 @@
 export type TranscribedSegmentPayload = {
   text: string;
   isPartial: boolean;
+  // Shared by the partials and the final of an utterance
+  utteranceId: number;
+};
+
+// Refined text of an earlier final, see stream_configuration::is_refinement
+export type SegmentUpdatePayload = {
+  utteranceId: number;
+  text: string;
+  // Final text which the refinement replaces
+  previousText: string;
 };
 
 export type TranscribedSegments = {
   segments: TranscribedSegmentPayload[];
+  // Only set by getTranscribedText while refinement is enabled
+  updates?: SegmentUpdatePayload[];
+};
+
+export type IterationMetricsPayload = {
+  queueWaitMs: number;
+  melMs: number;
+  encodeMs: number;
+  decodeMs: number;
+  inferenceMs: number;
+  nTokens: number;
+  audioMs: number;
+  rtf: number;
+  // Effective trigger and window length of the adaptive pacing
+  triggerMs: number;
+  windowMs: number;
+  // Speculative decoding, draft tokens proposed and accepted
+  nDraftProposed: number;
+  nDraftAccepted: number;
+};
+
+export type LatencySummary = {
+  count: number;
+  p50Ms: number;
+  p95Ms: number;
+  p99Ms: number;
+  maxMs: number;
+};
+
+// End-to-end latency from audio arrival to emitted text
+export type LatencyHistograms = {
+  partial: LatencySummary;
+  final: LatencySummary;
+};
+
+// How often each overload policy fired since the engine was created
+export type LoadSheddingCounters = {
+  partialsSkipped: number;
+  silenceDroppedMs: number;
+  fallbackIterations: number;
+};
+
+export type EngineMetrics = {
+  iterations: IterationMetricsPayload[];
+  rtf: number;
+  loadShedding: LoadSheddingCounters;
 };
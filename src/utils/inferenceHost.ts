@@ -0,0 +1,475 @@
+import { ChildProcess, spawn } from "node:child_process";
+import { Writable } from "node:stream";
+import type { STTEngineModule } from "@/ipc/whisperIPCHandlers";
+import {
+  EngineMetrics,
+  LatencyHistograms,
+  SegmentUpdatePayload,
+  TranscribedSegmentPayload,
+  TranscribedSegments,
+} from "@/shared/ipcPayloads";
+
+type EngineConfiguration = Parameters<STTEngineModule["reconfigure"]>[0];
+
+// Depends on addon.cc definition from SharedAudioRing::Init
+type SharedAudioRing = {
+  write: (data: Float32Array) => number;
+  position: () => number;
+  droppedSamples: () => number;
+  close: () => number;
+};
+export type SharedAudioRingConstructor = new (
+  name: string,
+  capacity: number,
+) => SharedAudioRing;
+
+// Frame types of cpp/server/stream_protocol.h
+const FRAME_CLEAR = 2;
+const FRAME_END = 3;
+const FRAME_START = 4;
+const FRAME_STOP = 5;
+const FRAME_GET_METRICS = 6;
+const FRAME_GET_LATENCY = 7;
+const FRAME_START_TRACING = 8;
+const FRAME_STOP_TRACING = 9;
+const FRAME_START_RECORDING = 10;
+const FRAME_STOP_RECORDING = 11;
+const FRAME_SEGMENT = 16;
+const FRAME_UPDATE = 17;
+const FRAME_ERROR = 18;
+const FRAME_READY = 19;
+const FRAME_REPLY = 20;
+const FRAME_HEADER_SIZE = 5;
+
+// Room for 30 seconds of 16kHz audio while the host is busy or restarting
+const RING_CAPACITY = 16000 * 30;
+// The inherited control channel of the host, see cpp/host/stt_host.cc
+const CHANNEL_FD = 3;
+const MIN_RESTART_DELAY_MS = 500;
+const MAX_RESTART_DELAY_MS = 30000;
+// A host which ran this long before exiting restarts without backoff
+const STABLE_RUNTIME_MS = 60000;
+
+function encodeFrame(type: number, payload?: Buffer): Buffer {
+  const size = payload ? payload.length : 0;
+  const frame = Buffer.alloc(FRAME_HEADER_SIZE + size);
+  frame.writeUInt8(type, 0);
+  frame.writeUInt32LE(size, 1);
+  payload?.copy(frame, FRAME_HEADER_SIZE);
+  return frame;
+}
+
+// Splits complete frames off the buffer, returns the unconsumed rest
+function decodeFrames(
+  buffer: Buffer,
+  onFrame: (type: number, payload: Buffer) => void,
+): Buffer {
+  let offset = 0;
+  while (buffer.length - offset >= FRAME_HEADER_SIZE) {
+    const size = buffer.readUInt32LE(offset + 1);
+    if (buffer.length - offset - FRAME_HEADER_SIZE < size) {
+      break;
+    }
+    const payloadOffset = offset + FRAME_HEADER_SIZE;
+    onFrame(
+      buffer.readUInt8(offset),
+      buffer.subarray(payloadOffset, payloadOffset + size),
+    );
+    offset = payloadOffset + size;
+  }
+  return buffer.subarray(offset);
+}
+
+function decodeSegment(payload: Buffer): TranscribedSegmentPayload {
+  return {
+    isPartial: payload.readUInt8(0) !== 0,
+    utteranceId: Number(payload.readBigUInt64LE(1)),
+    text: payload.toString("utf8", 9),
+  };
+}
+
+function decodeUpdate(payload: Buffer): SegmentUpdatePayload {
+  const previousSize = payload.readUInt32LE(8);
+  return {
+    utteranceId: Number(payload.readBigUInt64LE(0)),
+    previousText: payload.toString("utf8", 12, 12 + previousSize),
+    text: payload.toString("utf8", 12 + previousSize),
+  };
+}
+
+// Command line of stt_host for an addon configuration, see STTAddon::Reconfigure
+function hostArguments(config: EngineConfiguration): string[] {
+  const args = [
+    "-m",
+    config.model_path,
+    "-l",
+    config.language_id === 0 ? "de" : "en",
+    "-t",
+    String(config.n_threads),
+    "--trigger-ms",
+    String(config.trigger_ms),
+  ];
+  const numberOptions: [number | undefined, string][] = [
+    [config.min_trigger_ms, "--min-trigger-ms"],
+    [config.max_trigger_ms, "--max-trigger-ms"],
+    [config.min_window_ms, "--min-window-ms"],
+    [config.shed_partials_backlog_ms, "--shed-partials-backlog-ms"],
+    [config.drop_silence_backlog_ms, "--drop-silence-backlog-ms"],
+    [config.fallback_backlog_ms, "--fallback-backlog-ms"],
+    [config.n_draft_tokens, "--draft-tokens"],
+    [config.refinement_beam_size, "--refinement-beam-size"],
+    [config.nice, "--nice"],
+  ];
+  for (const [value, flag] of numberOptions) {
+    if (value !== undefined) {
+      args.push(flag, String(value));
+    }
+  }
+  const pathOptions: [string | undefined, string][] = [
+    [config.fallback_model_path, "--fallback-model"],
+    [config.partial_model_path, "--partial-model"],
+    [config.draft_model_path, "--draft-model"],
+    [config.refinement_model_path, "--refinement-model"],
+  ];
+  for (const [value, flag] of pathOptions) {
+    if (value !== undefined) {
+      args.push(flag, value);
+    }
+  }
+  if (config.adaptive_trigger === false) {
+    args.push("--fixed-trigger");
+  }
+  if (config.pipelined) {
+    args.push("--pipelined");
+  }
+  if (config.refinement) {
+    args.push("--refinement");
+  }
+  if (config.realtime_priority) {
+    args.push("--realtime-priority");
+  }
+  if (config.cpu_affinity && config.cpu_affinity.length > 0) {
+    args.push("--cpu-affinity", config.cpu_affinity.join(","));
+  }
+  return args;
+}
+
+// Runs the SpeechToTextEngine in the stt_host helper process instead of the
+// Electron main process. Audio is handed over through a shared memory ring,
+// control frames and results go over the inherited channel of the host. The
+// host is restarted with exponential backoff when it exits unexpectedly, a
+// started session is resumed after the restart.
+//
+// Metrics, latency histograms, tracing and session recording are requested
+// from the host, requests pending when the host exits return empty results.
+export class InferenceHostSupervisor implements STTEngineModule {
+  private readonly ringName = `/stt-audio-${process.pid}`;
+  private readonly ring: SharedAudioRing;
+  private child: ChildProcess | null = null;
+  private args: string[];
+  private isStarted = false;
+  private isDisposed = false;
+  private received = Buffer.alloc(0);
+  private segments: TranscribedSegmentPayload[] = [];
+  private updates: SegmentUpdatePayload[] = [];
+  // Resolvers of the requests sent to the host, answered in order
+  private requests: ((reply: unknown) => void)[] = [];
+  private restartDelayMs = MIN_RESTART_DELAY_MS;
+  private restartTimer: NodeJS.Timeout | null = null;
+  private spawnedAt = 0;
+
+  constructor(
+    private readonly hostPath: string,
+    SharedAudioRing: SharedAudioRingConstructor,
+    config: EngineConfiguration,
+  ) {
+    this.ring = new SharedAudioRing(this.ringName, RING_CAPACITY);
+    this.args = hostArguments(config);
+    this.spawnHost();
+  }
+
+  start() {
+    this.isStarted = true;
+    this.send(encodeFrame(FRAME_START));
+  }
+
+  stop() {
+    this.isStarted = false;
+    this.send(encodeFrame(FRAME_STOP));
+  }
+
+  reconfigure(config: EngineConfiguration) {
+    this.args = hostArguments(config);
+    // A new host loads the new models, the running one is replaced
+    this.isStarted = false;
+    if (this.restartTimer) {
+      clearTimeout(this.restartTimer);
+      this.restartTimer = null;
+    }
+    this.killHost();
+    this.restartDelayMs = MIN_RESTART_DELAY_MS;
+    this.spawnHost();
+    return 1;
+  }
+
+  addAudioData(data: Float32Array) {
+    const nWritten = this.ring.write(data);
+    if (nWritten < data.length) {
+      console.warn(
+        `[ inferenceHost ] Audio ring full, dropped ${data.length - nWritten} samples`,
+      );
+    }
+  }
+
+  clearAudioData() {
+    // Samples written before the clear are discarded by the host
+    const position = Buffer.alloc(8);
+    position.writeBigUInt64LE(BigInt(this.ring.position()));
+    this.segments = [];
+    this.updates = [];
+    this.send(encodeFrame(FRAME_CLEAR, position));
+  }
+
+  getTranscribedText(): TranscribedSegments {
+    const payload = { segments: this.segments, updates: this.updates };
+    this.segments = [];
+    this.updates = [];
+    return payload;
+  }
+
+  // Runs in a short-lived host, so a crash while decoding the file does not
+  // take down the main process either. Resolves once the host exits, the main
+  // process keeps serving the renderer meanwhile. The file host loads its own
+  // copy of the models, for the duration of the import the memory in use grows
+  // by the size of the model files.
+  transcribeFileInput(
+    filePath: string,
+    cacheDirectory?: string,
+  ): Promise<TranscribedSegments> {
+    const cacheArgs = cacheDirectory
+      ? ["--transcription-cache", cacheDirectory]
+      : [];
+    return new Promise((resolve) => {
+      const host = spawn(
+        this.hostPath,
+        [...this.args, ...cacheArgs, "--transcribe", filePath],
+        { stdio: ["ignore", "inherit", "inherit", "pipe"] },
+      );
+      const segments: TranscribedSegmentPayload[] = [];
+      let received = Buffer.alloc(0);
+      const channel = host.stdio[CHANNEL_FD];
+      channel?.on("data", (data: Buffer) => {
+        received = decodeFrames(
+          Buffer.concat([received, data]),
+          (type, payload) => {
+            if (type === FRAME_SEGMENT) {
+              segments.push(decodeSegment(payload));
+            }
+          },
+        );
+      });
+      // A broken channel surfaces through the exit of the host
+      channel?.on("error", () => undefined);
+      host.on("error", (error) => {
+        console.error(
+          `[ inferenceHost ] Failed to transcribe ${filePath}: ${error.message}`,
+        );
+        resolve({ segments });
+      });
+      // Emitted after the channel was read to its end
+      host.on("close", () => resolve({ segments }));
+    });
+  }
+
+  async getMetrics(): Promise<EngineMetrics> {
+    const metrics = await this.request(FRAME_GET_METRICS);
+    if (typeof metrics === "object" && metrics !== null) {
+      return metrics as EngineMetrics;
+    }
+    return {
+      iterations: [],
+      rtf: 0,
+      loadShedding: {
+        partialsSkipped: 0,
+        silenceDroppedMs: 0,
+        fallbackIterations: 0,
+      },
+    };
+  }
+
+  async getLatencyHistograms(): Promise<LatencyHistograms> {
+    const histograms = await this.request(FRAME_GET_LATENCY);
+    if (typeof histograms === "object" && histograms !== null) {
+      return histograms as LatencyHistograms;
+    }
+    const empty = { count: 0, p50Ms: 0, p95Ms: 0, p99Ms: 0, maxMs: 0 };
+    return { partial: empty, final: { ...empty } };
+  }
+
+  async startTracing() {
+    return (await this.request(FRAME_START_TRACING)) === 1 ? 1 : 0;
+  }
+
+  async stopTracing(tracePath: string) {
+    const reply = await this.request(
+      FRAME_STOP_TRACING,
+      Buffer.from(tracePath, "utf8"),
+    );
+    return reply === 1 ? 1 : 0;
+  }
+
+  async startSessionRecording(logPath: string) {
+    const reply = await this.request(
+      FRAME_START_RECORDING,
+      Buffer.from(logPath, "utf8"),
+    );
+    return reply === 1 ? 1 : 0;
+  }
+
+  async stopSessionRecording() {
+    return (await this.request(FRAME_STOP_RECORDING)) === 1 ? 1 : 0;
+  }
+
+  // Ends the host and removes the shared memory ring
+  dispose() {
+    this.isDisposed = true;
+    if (this.restartTimer) {
+      clearTimeout(this.restartTimer);
+      this.restartTimer = null;
+    }
+    // The host exits on its own once the channel closes, the kill covers a
+    // host which is stuck in inference
+    this.send(encodeFrame(FRAME_END));
+    this.killHost();
+    this.ring.close();
+  }
+
+  private channel(): Writable | null {
+    const stream = this.child?.stdio[CHANNEL_FD];
+    return stream instanceof Writable ? stream : null;
+  }
+
+  private send(frame: Buffer) {
+    // Frames sent while the host restarts are dropped, the session state is
+    // restored with a start frame once the new host runs
+    this.channel()?.write(frame);
+  }
+
+  // Resolves with the JSON reply of the host, or null if the host is not
+  // running or exits before it replies
+  private request(type: number, payload?: Buffer): Promise<unknown> {
+    const channel = this.channel();
+    if (!channel) {
+      return Promise.resolve(null);
+    }
+    return new Promise((resolve) => {
+      this.requests.push(resolve);
+      channel.write(encodeFrame(type, payload));
+    });
+  }
+
+  private cancelRequests() {
+    const requests = this.requests;
+    this.requests = [];
+    for (const resolve of requests) {
+      resolve(null);
+    }
+  }
+
+  private spawnHost() {
+    const child = spawn(this.hostPath, [
+      ...this.args,
+      "--ring",
+      this.ringName,
+      "--channel-fd",
+      String(CHANNEL_FD),
+    ], {
+      stdio: ["ignore", "inherit", "inherit", "pipe"],
+    });
+    this.child = child;
+    this.received = Buffer.alloc(0);
+    this.spawnedAt = Date.now();
+
+    const channel = child.stdio[CHANNEL_FD];
+    channel?.on("data", (data: Buffer) => {
+      // Replies of a replaced host would answer requests of its successor
+      if (child !== this.child) {
+        return;
+      }
+      this.received = decodeFrames(
+        Buffer.concat([this.received, data]),
+        (type, payload) => this.onFrame(type, payload),
+      );
+    });
+    // A broken channel surfaces through the exit of the host
+    channel?.on("error", () => undefined);
+    child.on("exit", (code, signal) => this.onExit(child, code, signal));
+
+    if (this.isStarted) {
+      this.send(encodeFrame(FRAME_START));
+    }
+  }
+
+  private killHost() {
+    const child = this.child;
+    this.child = null;
+    this.cancelRequests();
+    if (child) {
+      child.removeAllListeners("exit");
+      child.kill();
+    }
+  }
+
+  private onFrame(type: number, payload: Buffer) {
+    switch (type) {
+      case FRAME_SEGMENT:
+        this.segments.push(decodeSegment(payload));
+        break;
+      case FRAME_UPDATE:
+        this.updates.push(decodeUpdate(payload));
+        break;
+      case FRAME_READY:
+        console.log("[ inferenceHost ] Inference host ready.");
+        break;
+      case FRAME_ERROR:
+        console.error(`[ inferenceHost ] ${payload.toString("utf8")}`);
+        break;
+      case FRAME_REPLY: {
+        let reply: unknown = null;
+        try {
+          reply = JSON.parse(payload.toString("utf8"));
+        } catch (error) {
+          console.error(`[ inferenceHost ] Malformed reply: ${error}`);
+        }
+        this.requests.shift()?.(reply);
+        break;
+      }
+    }
+  }
+
+  private onExit(
+    child: ChildProcess,
+    code: number | null,
+    signal: NodeJS.Signals | null,
+  ) {
+    if (child !== this.child || this.isDisposed) {
+      return;
+    }
+    this.child = null;
+    this.cancelRequests();
+    if (Date.now() - this.spawnedAt >= STABLE_RUNTIME_MS) {
+      this.restartDelayMs = MIN_RESTART_DELAY_MS;
+    }
+    console.error(
+      `[ inferenceHost ] Inference host exited (code ${code}, signal ${signal}), restarting in ${this.restartDelayMs}ms`,
+    );
+    this.restartTimer = setTimeout(() => {
+      this.restartTimer = null;
+      this.spawnHost();
+    }, this.restartDelayMs);
+    this.restartDelayMs = Math.min(
+      this.restartDelayMs * 2,
+      MAX_RESTART_DELAY_MS,
+    );
+  }
+}